@@ -0,0 +1,378 @@
+#include "eventsource.h"
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+EventChunk::EventChunk(int capacity, int nsensors)
+{
+    this->capacity = capacity;
+    this->nsensors = nsensors;
+    signal.resize((size_t)capacity*nsensors);
+    x.resize(capacity);
+    y.resize(capacity);
+    photons.resize(capacity);
+}
+
+// ============== Text ===============
+
+TextEventSource::TextEventSource(const std::string &fname, int nsensors, int bufsize)
+{
+    this->nsensors = nsensors;
+    SetTruthColumns(nsensors, nsensors+1, nsensors+2);
+    buf.resize(std::max(bufsize, 1024));
+    f = fopen(fname.c_str(), "rb");
+    if (!f) {
+        error_msg = "can't open " + fname;
+        return;
+    }
+    valid = true;
+}
+
+TextEventSource::~TextEventSource()
+{
+    if (f)
+        fclose(f);
+}
+
+void TextEventSource::SetTruthColumns(int photons_col, int x_col, int y_col)
+{
+    col_photons = photons_col;
+    col_x = x_col;
+    col_y = y_col;
+    has_truth = col_x >= 0 && col_y >= 0;
+    ncols = std::max({nsensors, col_photons+1, col_x+1, col_y+1});
+    row.resize(ncols);
+}
+
+bool TextEventSource::Rewind()
+{
+    if (!f || fseek(f, 0, SEEK_SET) != 0)
+        return false;
+    pos = len = 0;
+    eof = false;
+    nskipped = 0;
+    return true;
+}
+
+// moves the unparsed tail to the beginning of the buffer and reads more
+bool TextEventSource::fill()
+{
+    if (eof)
+        return false;
+    if (pos > 0) {
+        memmove(&buf[0], &buf[pos], len-pos);
+        len -= pos;
+        pos = 0;
+    }
+    if (len == buf.size())
+        buf.resize(buf.size()*2); // a line longer than the buffer
+    size_t n = fread(&buf[len], 1, buf.size()-len, f);
+    len += n;
+    if (n == 0)
+        eof = true;
+    return n > 0;
+}
+
+static inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+// Exact for up to 19 significant digits as long as the mantissa fits
+// into a double and the decimal exponent is small (the common case);
+// everything else, including nan/inf, goes to strtod
+const char *TextEventSource::ParseDouble(const char *p, const char *end, double *val)
+{
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    const char *start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    uint64_t mant = 0;
+    int ndig = 0, exp10 = 0;
+    bool any = false, dropped = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (ndig < 19) {
+            mant = mant*10 + (*p - '0');
+            ndig += mant ? 1 : 0;
+        } else {
+            exp10++;
+            dropped = true;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (ndig < 19) {
+                mant = mant*10 + (*p - '0');
+                ndig += mant ? 1 : 0;
+                exp10--;
+            } else
+                dropped = true;
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p+1;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            eneg = *q++ == '-';
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+                e = std::min(e*10 + (*q - '0'), 100000);
+            exp10 += eneg ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any && !dropped && mant < (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        double v = (double)mant;
+        v = exp10 < 0 ? v/pow10[-exp10] : v*pow10[exp10];
+        *val = neg ? -v : v;
+        return p;
+    }
+
+// slow path
+    char tmp[64];
+    const char *q = start;
+    while (q < end && !IsBlank(*q) && *q != '\n')
+        q++;
+    size_t n = q - start;
+    if (n == 0 || n >= sizeof(tmp))
+        return nullptr;
+    memcpy(tmp, start, n);
+    tmp[n] = 0;
+    char *stop;
+    *val = strtod(tmp, &stop);
+    return stop == tmp ? nullptr : start + (stop - tmp);
+}
+
+bool TextEventSource::parseLine(const char *p, const char *end, EventChunk &chunk)
+{
+    int n = 0;
+    while (n < ncols) {
+        while (p < end && IsBlank(*p))
+            p++;
+        if (p == end)
+            break;
+        p = ParseDouble(p, end, &row[n]);
+        if (!p)
+            break;
+        n++;
+    }
+    if (n < nsensors) {
+    // empty lines are not counted as skipped
+        while (p && p < end && IsBlank(*p))
+            p++;
+        if (n > 0 || (p && p < end))
+            nskipped++;
+        return false;
+    }
+
+    int i = chunk.nevents;
+    std::copy(&row[0], &row[0] + nsensors, &chunk.signal[(size_t)i*nsensors]);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    chunk.x[i] = col_x >= 0 && col_x < n ? row[col_x] : nan;
+    chunk.y[i] = col_y >= 0 && col_y < n ? row[col_y] : nan;
+    chunk.photons[i] = col_photons >= 0 && col_photons < n ? row[col_photons] : nan;
+    chunk.nevents++;
+    return true;
+}
+
+int TextEventSource::ReadChunk(EventChunk &chunk)
+{
+    chunk.nevents = 0;
+    chunk.has_truth = has_truth;
+    if (!valid || chunk.nsensors != nsensors)
+        return 0;
+
+    while (chunk.nevents < chunk.capacity) {
+        const char *p = &buf[0] + pos;
+        const char *nl = (const char*)memchr(p, '\n', len-pos);
+        if (!nl) {
+            if (fill())
+                continue;
+        // last line without a newline
+            if (pos < len)
+                parseLine(&buf[0] + pos, &buf[0] + len, chunk);
+            pos = len;
+            break;
+        }
+        parseLine(p, nl, chunk);
+        pos = nl - &buf[0] + 1;
+    }
+    return chunk.nevents;
+}
+
+// ============== Binary ===============
+
+BinaryEventSource::BinaryEventSource(const std::string &fname)
+{
+    f = fopen(fname.c_str(), "rb");
+    if (!f) {
+        error_msg = "can't open " + fname;
+        return;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || strncmp(header.magic, EVT_MAGIC, sizeof(header.magic)) != 0) {
+        error_msg = "not a binary event file";
+        return;
+    }
+    if (header.endian_tag != EVT_ENDIAN_TAG) {
+        error_msg = "byte order of the file doesn't match the host";
+        return;
+    }
+    if (header.version != EVT_VERSION) {
+        error_msg = "unsupported version " + std::to_string(header.version);
+        return;
+    }
+    size_t amp_size = header.amplitude == EventFileHeader::UInt16 ? 2 : 4;
+    bool truth = header.flags & EventFileHeader::HasTruth;
+    if (header.amplitude > EventFileHeader::UInt16 || header.record_size != header.nsensors*amp_size + (truth ? 12 : 0)) {
+        error_msg = "inconsistent header";
+        return;
+    }
+    nsensors = header.nsensors;
+    has_truth = truth;
+    valid = true;
+}
+
+BinaryEventSource::~BinaryEventSource()
+{
+    if (f)
+        fclose(f);
+}
+
+bool BinaryEventSource::Rewind()
+{
+    if (!valid || fseek(f, sizeof(header), SEEK_SET) != 0)
+        return false;
+    nread = 0;
+    return true;
+}
+
+int BinaryEventSource::ReadChunk(EventChunk &chunk)
+{
+    chunk.nevents = 0;
+    chunk.has_truth = has_truth;
+    if (!valid || chunk.nsensors != nsensors)
+        return 0;
+
+    size_t rs = header.record_size;
+    buf.resize((size_t)chunk.capacity*rs);
+    size_t n = fread(&buf[0], rs, chunk.capacity, f);
+
+    for (size_t i=0; i<n; i++) {
+        const char *r = &buf[i*rs];
+        double *s = &chunk.signal[i*nsensors];
+        if (header.amplitude == EventFileHeader::UInt16) {
+            uint16_t a;
+            for (int j=0; j<nsensors; j++) {
+                memcpy(&a, r + 2*j, 2);
+                s[j] = a;
+            }
+            r += 2*nsensors;
+        } else {
+            float a;
+            for (int j=0; j<nsensors; j++) {
+                memcpy(&a, r + 4*j, 4);
+                s[j] = a;
+            }
+            r += 4*nsensors;
+        }
+        if (has_truth) {
+            float t[3];
+            memcpy(t, r, sizeof(t));
+            chunk.x[i] = t[0];
+            chunk.y[i] = t[1];
+            chunk.photons[i] = t[2];
+        }
+    }
+    nread += n;
+    chunk.nevents = n;
+    return n;
+}
+
+// ============== Writer ===============
+
+BinaryEventWriter::BinaryEventWriter(const std::string &fname, int nsensors, EventFileHeader::Amplitude amp, bool truth)
+{
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, EVT_MAGIC, sizeof(header.magic));
+    header.version = EVT_VERSION;
+    header.endian_tag = EVT_ENDIAN_TAG;
+    header.nsensors = nsensors;
+    header.amplitude = amp;
+    header.flags = truth ? EventFileHeader::HasTruth : 0;
+    header.record_size = nsensors*(amp == EventFileHeader::UInt16 ? 2 : 4) + (truth ? 12 : 0);
+    rec.resize(header.record_size);
+
+    f = fopen(fname.c_str(), "wb");
+    if (f && fwrite(&header, sizeof(header), 1, f) != 1) {
+        fclose(f);
+        f = nullptr;
+    }
+}
+
+BinaryEventWriter::~BinaryEventWriter()
+{
+    Close();
+}
+
+// uint16 amplitudes are rounded and clamped to [0, 65535]
+bool BinaryEventWriter::Write(const double *signals, const double *truth)
+{
+    if (!f)
+        return false;
+    int n = header.nsensors;
+    char *r = &rec[0];
+    if (header.amplitude == EventFileHeader::UInt16) {
+        for (int j=0; j<n; j++) {
+            uint16_t a = (uint16_t)std::min(std::max(std::round(signals[j]), 0.), 65535.);
+            memcpy(r + 2*j, &a, 2);
+        }
+        r += 2*n;
+    } else {
+        for (int j=0; j<n; j++) {
+            float a = signals[j];
+            memcpy(r + 4*j, &a, 4);
+        }
+        r += 4*n;
+    }
+    if (header.flags & EventFileHeader::HasTruth) {
+        float t[3] = {0.f, 0.f, 0.f};
+        if (truth)
+            for (int k=0; k<3; k++)
+                t[k] = truth[k];
+        memcpy(r, t, sizeof(t));
+    }
+    if (fwrite(&rec[0], rec.size(), 1, f) != 1)
+        return false;
+    header.nevents++;
+    return true;
+}
+
+bool BinaryEventWriter::Write(const EventChunk &chunk)
+{
+    for (int i=0; i<chunk.nevents; i++) {
+        double truth[3] = {chunk.x[i], chunk.y[i], chunk.photons[i]};
+        if (!Write(chunk.GetSignals(i), chunk.has_truth ? truth : nullptr))
+            return false;
+    }
+    return true;
+}
+
+bool BinaryEventWriter::Close()
+{
+    if (!f)
+        return false;
+    bool ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    f = nullptr;
+    return ok;
+}
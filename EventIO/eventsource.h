@@ -0,0 +1,161 @@
+#ifndef EVENTSOURCE_H
+#define EVENTSOURCE_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+// Fixed-capacity block of events, reused from chunk to chunk,
+// so that a whole run can be processed in constant memory
+struct EventChunk
+{
+    EventChunk(int capacity, int nsensors);
+
+    int capacity;
+    int nsensors;
+    int nevents = 0;
+    bool has_truth = false;
+    std::vector <double> signal;    // nevents x nsensors, one event per row
+// simulation truth, valid if has_truth
+    std::vector <double> x;
+    std::vector <double> y;
+    std::vector <double> photons;
+
+    const double *GetSignals(int i) const {return &signal[(size_t)i*nsensors];}
+};
+
+// Binary event file, version 1 (little-endian):
+//   EventFileHeader
+//   records: nsensors amplitudes (float32 or uint16),
+//            followed by float32 x, y, photons if HasTruth is set
+#define EVT_MAGIC "LREVENT"
+#define EVT_VERSION 1
+#define EVT_ENDIAN_TAG 0x01020304u
+
+struct EventFileHeader
+{
+    enum Amplitude {
+        Float32,
+        UInt16
+    };
+    enum Flags {
+        HasTruth = 1
+    };
+
+    char magic[8];          // EVT_MAGIC with terminating 0
+    uint32_t version;
+    uint32_t endian_tag;
+    uint32_t nsensors;
+    uint32_t amplitude;     // Amplitude
+    uint32_t flags;
+    uint32_t record_size;   // bytes per event
+    uint64_t nevents;
+};
+
+static_assert(sizeof(EventFileHeader) == 40, "EventFileHeader layout");
+
+class EventSource
+{
+public:
+    EventSource() {}
+    virtual ~EventSource() {}
+
+// fills the chunk with up to chunk.capacity events, returns their number (0 at the end)
+    virtual int ReadChunk(EventChunk &chunk) = 0;
+    virtual bool Rewind() = 0;
+
+    int GetSensorCount() const {return nsensors;}
+    bool HasTruth() const {return has_truth;}
+    bool IsValid() const {return valid;}
+    std::string GetError() const {return error_msg;}
+
+protected:
+    int nsensors = 0;
+    bool has_truth = false;
+    bool valid = false;
+    std::string error_msg;
+};
+
+// Whitespace separated text, one event per line:
+// a0 ... a(nsensors-1) [photons x y ...]
+// Read through a fixed buffer and parsed in place without allocations.
+class TextEventSource : public EventSource
+{
+public:
+    TextEventSource(const std::string &fname, int nsensors, int bufsize = 1<<20);
+    ~TextEventSource();
+    TextEventSource(const TextEventSource&) = delete;
+    TextEventSource& operator=(const TextEventSource&) = delete;
+
+    virtual int ReadChunk(EventChunk &chunk);
+    virtual bool Rewind();
+
+// columns of the truth values, -1 if absent (default: photons x y after the amplitudes)
+    void SetTruthColumns(int photons_col, int x_col, int y_col);
+    int GetSkippedLines() const {return nskipped;}
+
+// parses a number starting at p, returns the position after it or nullptr
+    static const char *ParseDouble(const char *p, const char *end, double *val);
+
+protected:
+    bool fill();
+    bool parseLine(const char *p, const char *end, EventChunk &chunk);
+
+protected:
+    FILE *f = nullptr;
+    std::vector <char> buf;
+    size_t pos = 0;         // start of unparsed data in buf
+    size_t len = 0;         // end of valid data in buf
+    bool eof = false;
+    int col_photons, col_x, col_y;
+    int ncols;              // columns needed per line
+    int nskipped = 0;       // lines with too few values
+    std::vector <double> row;
+};
+
+// Binary event file read through a fixed buffer
+class BinaryEventSource : public EventSource
+{
+public:
+    BinaryEventSource(const std::string &fname);
+    ~BinaryEventSource();
+    BinaryEventSource(const BinaryEventSource&) = delete;
+    BinaryEventSource& operator=(const BinaryEventSource&) = delete;
+
+    virtual int ReadChunk(EventChunk &chunk);
+    virtual bool Rewind();
+
+    uint64_t GetEventCount() const {return header.nevents;}
+
+protected:
+    FILE *f = nullptr;
+    EventFileHeader header;
+    uint64_t nread = 0;
+    std::vector <char> buf;
+};
+
+// Writes events in the binary format
+class BinaryEventWriter
+{
+public:
+    BinaryEventWriter(const std::string &fname, int nsensors,
+                      EventFileHeader::Amplitude amp = EventFileHeader::Float32, bool truth = false);
+    ~BinaryEventWriter();
+    BinaryEventWriter(const BinaryEventWriter&) = delete;
+    BinaryEventWriter& operator=(const BinaryEventWriter&) = delete;
+
+    bool IsValid() const {return f != nullptr;}
+// truth = {x, y, photons}, ignored if the file has no truth
+    bool Write(const double *signals, const double *truth = nullptr);
+    bool Write(const EventChunk &chunk);
+// updates the event count in the header, also called by the destructor
+    bool Close();
+
+protected:
+    FILE *f = nullptr;
+    EventFileHeader header;
+    std::vector <char> rec;
+};
+
+#endif // EVENTSOURCE_H
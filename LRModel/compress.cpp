@@ -1,5 +1,6 @@
 #include "compress.h"
 #include "json11.hpp"
+#include "lrbinary.h"
 
 Compress1d* Compress1d::Factory(const Json &json)
 {
@@ -16,6 +17,17 @@ Compress1d* Compress1d::Factory(const Json &json)
         return NULL;
 }
 
+Compress1d* Compress1d::Factory(const LRBinLRF &rec)
+{
+    if (rec.compress != LRBinLRF::DualSlope)
+        return NULL;
+    Compress1d *comp = new DualSlopeCompress(rec.k, rec.r0, rec.lam);
+    if (comp->fValid)
+        return comp;
+    delete comp;
+    return NULL;
+}
+
 void DualSlopeCompress::Init()
 {
     if (r0 < 0. || k <= 1.)
@@ -58,7 +70,7 @@ double DualSlopeCompress::Rho(double r) const
 double DualSlopeCompress::RhoDrv(double r) const
 {
     double dr = r - r0;
-    return dr/sqrt(dr*dr + lam2) + a;
+    return a - dr/sqrt(dr*dr + lam2);
 }
 
 void  DualSlopeCompress::ToJsonObject(Json_object &json) const
@@ -69,3 +81,13 @@ void  DualSlopeCompress::ToJsonObject(Json_object &json) const
     json["k"] = k;
 }
 
+void DualSlopeCompress::ToBinary(LRBinLRF &rec) const
+{
+    rec.compress = LRBinLRF::DualSlope;
+    rec.k = k;
+    rec.r0 = r0;
+    rec.lam = lam;
+    rec.a = a;
+    rec.b = b;
+    rec.lam2 = lam2;
+}
@@ -4,6 +4,8 @@
 #include <cmath>
 #include "lrfio.h"
 
+struct LRBinLRF;
+
 class Compress1d : public LRF_IO
 {
 public:
@@ -13,8 +15,10 @@ public:
     virtual double Rho(double r) const = 0;
     virtual double RhoDrv(double r) const = 0;
     virtual void ToJsonObject(Json_object &json) const = 0;
+    virtual void ToBinary(LRBinLRF &rec) const = 0;
 
     static Compress1d* Factory(const Json &json);
+    static Compress1d* Factory(const LRBinLRF &rec);
 
 protected:
     bool fValid = false;
@@ -24,6 +28,7 @@ protected:
 
 class DualSlopeCompress : public Compress1d
 {
+friend class CompiledLRModel;
 public:
     DualSlopeCompress(double k, double r0, double lam);
     DualSlopeCompress(const Json &json);
@@ -32,6 +37,7 @@ public:
     virtual double Rho(double r) const;
     virtual double RhoDrv(double r) const;
     virtual void ToJsonObject(Json_object &json) const;
+    virtual void ToBinary(LRBinLRF &rec) const;
 
 private:
     double k;
@@ -0,0 +1,120 @@
+#include "lrbinary.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+LRModelFile::LRModelFile(const std::string &fname)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_msg = "can't open " + fname;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LRBinHeader)) {
+        error_msg = "file is too short";
+        close(fd);
+        return;
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        error_msg = "mmap failed";
+        return;
+    }
+
+    if (!check()) {
+        munmap(data, size);
+        data = nullptr;
+        header = nullptr;
+    }
+}
+
+LRModelFile::~LRModelFile()
+{
+    if (data)
+        munmap(data, size);
+}
+
+// validate the header and make sure all tables lie within the file
+bool LRModelFile::check()
+{
+    const char *base = (const char*)data;
+    const LRBinHeader *h = (const LRBinHeader*)base;
+    if (strncmp(h->magic, LRBIN_MAGIC, sizeof(h->magic)) != 0) {
+        error_msg = "not a binary LRModel file";
+        return false;
+    }
+    if (h->endian_tag != LRBIN_ENDIAN_TAG) {
+        error_msg = "byte order of the file doesn't match the host";
+        return false;
+    }
+    if (h->version < 1 || h->version > LRBIN_VERSION) {
+        error_msg = "unsupported version " + std::to_string(h->version);
+        return false;
+    }
+    if (h->file_size != size) {
+        error_msg = "file is truncated";
+        return false;
+    }
+
+    struct {uint64_t offset, count, size;} table[] = {
+        {h->sensor_offset, h->n_sensors, sizeof(LRBinSensor)},
+        {h->group_offset, h->n_groups, sizeof(LRBinGroup)},
+        {h->member_offset, h->n_members, sizeof(int32_t)},
+        {h->lrf_offset, h->n_lrfs, sizeof(LRBinLRF)},
+        {h->coef_offset, h->n_coef, sizeof(double)}
+    };
+    for (auto &t : table)
+        if (t.offset % 8 || t.offset > size || t.count > (size - t.offset)/t.size) {
+            error_msg = "corrupted table offsets";
+            return false;
+        }
+
+    header = h;
+    sensors = (const LRBinSensor*)(base + h->sensor_offset);
+    groups = (const LRBinGroup*)(base + h->group_offset);
+    members = (const int32_t*)(base + h->member_offset);
+    lrfs = (const LRBinLRF*)(base + h->lrf_offset);
+    coef = (const double*)(base + h->coef_offset);
+
+// version 1: the degree field was reserved, all splines are cubic
+    if (h->version < 2) {
+        lrf_copy.assign(lrfs, lrfs + h->n_lrfs);
+        for (LRBinLRF &l : lrf_copy)
+            l.degree = 3;
+        lrfs = lrf_copy.data();
+    }
+
+// references between the tables
+    for (uint32_t i=0; i<h->n_sensors; i++)
+        if (sensors[i].lrf >= (int32_t)h->n_lrfs || sensors[i].group_id >= (int32_t)h->n_groups) {
+            error_msg = "corrupted sensor table";
+            return false;
+        }
+    for (uint32_t i=0; i<h->n_groups; i++)
+        if (groups[i].lrf >= (int32_t)h->n_lrfs || groups[i].first_member > h->n_members
+                || groups[i].n_members > h->n_members - groups[i].first_member) {
+            error_msg = "corrupted group table";
+            return false;
+        }
+    for (uint32_t i=0; i<h->n_lrfs; i++) {
+        const LRBinLRF &l = lrfs[i];
+        if (l.nint < 0 || l.nbas < 0 || l.coef + l.nbas > h->n_coef || l.poly + 4*(uint64_t)l.nint > h->n_coef
+                || (l.type == LRBinLRF::Axial && l.degree != 2 && l.degree != 3)) {
+            error_msg = "corrupted LRF table";
+            return false;
+        }
+    }
+    return true;
+}
+
+int LRModelFile::GetSensorLRF(int id) const
+{
+    const LRBinSensor &s = sensors[id];
+    return s.group_id >= 0 ? groups[s.group_id].lrf : s.lrf;
+}
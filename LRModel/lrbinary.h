@@ -0,0 +1,161 @@
+#ifndef LRBINARY_H
+#define LRBINARY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Binary LRModel file format, version 2
+//
+// Little-endian, all records have fixed size and 8-byte aligned doubles,
+// so the file can be mapped into memory and used in place.
+//
+//   LRBinHeader
+//   LRBinSensor[n_sensors]     indexed by sensor id
+//   LRBinGroup[n_groups]       indexed by group id
+//   int32_t[n_members]         group members, each group refers to a slice
+//   LRBinLRF[n_lrfs]           LRFs referenced by sensors and groups
+//   double[n_coef]             spline coefficients and polynomials
+//
+// The content is the same as in the JSON representation of LRModel,
+// plus some derived quantities (affine form of the transforms, compression
+// constants, polynomial coefficients of the splines) needed for evaluation.
+//
+// Version 1 had no spline degree in LRBinLRF (the field was reserved and 0),
+// all splines were cubic. Such files are still read, the LRF table is converted.
+
+#define LRBIN_MAGIC "LRMODEL"
+#define LRBIN_VERSION 2
+#define LRBIN_ENDIAN_TAG 0x01020304u
+
+struct LRBinHeader
+{
+    char magic[8];          // LRBIN_MAGIC with terminating 0
+    uint32_t version;
+    uint32_t endian_tag;    // LRBIN_ENDIAN_TAG as written by the host
+    uint32_t n_sensors;
+    uint32_t n_groups;
+    uint32_t n_members;
+    uint32_t n_lrfs;
+    uint64_t n_coef;
+// byte offsets from the beginning of the file
+    uint64_t sensor_offset;
+    uint64_t group_offset;
+    uint64_t member_offset;
+    uint64_t lrf_offset;
+    uint64_t coef_offset;
+    uint64_t file_size;
+};
+
+struct LRBinTransform
+{
+    enum Method {
+        None,
+        Translate,  // p[0], p[1] = dx, dy
+        Rotate,     // p[0] = phi
+        Reflect     // p[0] = phi
+    };
+
+    int32_t method;
+    int32_t reserved;
+    double p[2];
+};
+
+struct LRBinSensor
+{
+    int32_t id;
+    int32_t group_id;       // -1 if not in a group
+    int32_t lrf;            // own LRF (ungrouped sensors only), -1 if none
+    int32_t reserved;
+    double x, y;
+    double gain;
+    LRBinTransform tr;
+// transform in affine form: local = M * world + t
+    double m[4];
+    double t[2];
+};
+
+struct LRBinGroup
+{
+    int32_t id;
+    int32_t lrf;            // -1 if none
+    uint32_t first_member;  // slice of the member table
+    uint32_t n_members;
+    double x, y;
+};
+
+struct LRBinLRF
+{
+    enum Type {
+        Axial = 1
+    };
+    enum Compression {
+        NoCompression,
+        DualSlope
+    };
+
+    int32_t type;
+    int32_t ready;          // spline coefficients are set
+// LRFaxial
+    double x0, y0;
+    double rmin, rmax;
+// compression: parameters as in JSON and derived constants
+    int32_t compress;
+    int32_t degree;         // of the radial spline: 2 or 3
+    double k, r0, lam;
+    double a, b, lam2;
+// radial spline, offsets are in doubles from the start of the coefficient blob
+    double xmin, xmax;
+    int32_t nint;
+    int32_t nbas;
+    uint64_t coef;          // nbas B-spline coefficients
+    uint64_t poly;          // 4*nint polynomial coefficients
+};
+
+static_assert(sizeof(LRBinHeader) == 88, "LRBinHeader layout");
+static_assert(sizeof(LRBinSensor) == 112, "LRBinSensor layout");
+static_assert(sizeof(LRBinGroup) == 32, "LRBinGroup layout");
+static_assert(sizeof(LRBinLRF) == 136, "LRBinLRF layout");
+
+// Read-only memory mapping of a binary LRModel file
+class LRModelFile
+{
+public:
+    LRModelFile(const std::string &fname);
+    ~LRModelFile();
+    LRModelFile(const LRModelFile&) = delete;
+    LRModelFile& operator=(const LRModelFile&) = delete;
+
+    bool IsValid() const {return header != nullptr;}
+    std::string GetError() const {return error_msg;}
+
+    const LRBinHeader &GetHeader() const {return *header;}
+    int GetSensorCount() const {return header->n_sensors;}
+    int GetGroupCount() const {return header->n_groups;}
+    int GetLRFCount() const {return header->n_lrfs;}
+    const LRBinSensor &GetSensor(int id) const {return sensors[id];}
+    const LRBinGroup &GetGroup(int gid) const {return groups[gid];}
+    const LRBinLRF &GetLRF(int i) const {return lrfs[i];}
+    const int32_t *GetMembers(int gid) const {return members + groups[gid].first_member;}
+    const double *GetCoef() const {return coef;}
+// LRF used by the sensor: the group one if the sensor is grouped, -1 if none
+    int GetSensorLRF(int id) const;
+
+protected:
+    bool check();
+
+protected:
+    void *data = nullptr;
+    size_t size = 0;
+    const LRBinHeader *header = nullptr;
+    const LRBinSensor *sensors = nullptr;
+    const LRBinGroup *groups = nullptr;
+    const int32_t *members = nullptr;
+    const LRBinLRF *lrfs = nullptr;
+    const double *coef = nullptr;
+    std::vector <LRBinLRF> lrf_copy;    // LRF table of a version 1 file, converted
+    std::string error_msg;
+};
+
+#endif // LRBINARY_H
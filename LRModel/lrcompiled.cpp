@@ -0,0 +1,315 @@
+#include "lrcompiled.h"
+#include "lrpack.h"
+#include "lrmodel.h"
+#include "lrfaxial.h"
+#include "compress.h"
+#include "transform.h"
+#include "bspline123d.h"
+#include "lrbinary.h"
+#include <map>
+
+CompiledLRModel::CompiledLRModel(LRModel *lrm)
+{
+    this->lrm = lrm;
+    Compile();
+}
+
+// evaluation directly from a mapped binary file, the polynomials are not copied
+CompiledLRModel::CompiledLRModel(const LRModelFile *file)
+{
+    this->file = file;
+    Compile();
+}
+
+CompiledLRModel::~CompiledLRModel()
+{
+    clearTables();
+}
+
+void CompiledLRModel::Compile()
+{
+    if (file)
+        compileFile();
+    else
+        compileModel();
+    tabulate();
+}
+
+void CompiledLRModel::SetTabulation(double step, double tolerance, TabulatedLRF::Grid grid)
+{
+    tab_step = step;
+    tab_tolerance = tolerance;
+    tab_grid = grid;
+}
+
+void CompiledLRModel::compileModel()
+{
+    int n = lrm->GetSensorCount();
+    sensor.assign(n, CompiledSensor());
+    ngeneric = 0;
+    ntabulated = 0;
+    ndepth = 0;
+
+// first pass: parameters and the size of coefficient storage
+    std::vector <int> offset(n, -1);
+    size_t ncoef = 0;
+    for (int id=0; id<n; id++) {
+        CompiledSensor &s = sensor[id];
+        s.x = lrm->GetX(id);
+        s.y = lrm->GetY(id);
+        LRF *lrf = lrm->GetLRF(id);
+        if (!lrf)
+            continue;
+
+        s.gain = lrm->GetGain(id);
+        Transform *tr = lrm->GetTransform(id);
+        if (tr)
+            tr->GetAffine(s.m, s.t);
+        if (lrf->hasDepth()) {
+            zmin = ndepth ? std::min(zmin, lrf->getZmin()) : lrf->getZmin();
+            zmax = ndepth ? std::max(zmax, lrf->getZmax()) : lrf->getZmax();
+            ndepth++;
+        }
+
+// tables put into the model are used directly
+        TabulatedLRF *tab = dynamic_cast <TabulatedLRF*> (lrf);
+        if (tab) {
+            s.kind = CompiledSensor::Tabulated;
+            s.tab = tab;
+            ntabulated++;
+            continue;
+        }
+
+        LRFaxial *axial = dynamic_cast <LRFaxial*> (lrf);
+        DualSlopeCompress *ds = axial ? dynamic_cast <DualSlopeCompress*> (axial->compress) : nullptr;
+        if (!axial || (axial->compress && !ds)) {
+            s.kind = CompiledSensor::Generic;
+            ngeneric++;
+            continue;
+        }
+        if (!axial->isReady() || axial->bsr->isInvalid())
+            continue;
+
+        const Bspline1d *bs = axial->bsr;
+        s.kind = CompiledSensor::Axial;
+        s.x0 = axial->x0;
+        s.y0 = axial->y0;
+        if (ds) {
+            s.compress = true;
+            s.a = ds->a;
+            s.b = ds->b;
+            s.r0 = ds->r0;
+            s.lam2 = ds->lam2;
+        }
+        s.nint = bs->GetNint();
+        s.xl = bs->GetXmin();
+        s.xr = bs->GetXmax();
+        s.scale = bs->GetScale();
+        offset[id] = ncoef;
+        ncoef += s.nint*4;
+    }
+
+// second pass: polynomial coefficients, the storage is not resized after this
+    coef.resize(ncoef);
+    for (int id=0; id<n; id++) {
+        if (offset[id] < 0)
+            continue;
+        const Bspline1d *bs = ((LRFaxial*)lrm->GetLRF(id))->bsr;
+        std::vector <std::vector <double> > poly = bs->GetPoly();
+        double *p = &coef[offset[id]];
+        for (int i=0; i<sensor[id].nint; i++)
+            for (int j=0; j<4; j++)
+                *p++ = poly[i][j];
+        sensor[id].poly = &coef[offset[id]];
+    }
+    coef_base = coef.data();
+}
+
+void CompiledLRModel::compileFile()
+{
+    int n = file->GetSensorCount();
+    sensor.assign(n, CompiledSensor());
+    coef.clear();
+    coef_base = file->GetCoef();
+    ngeneric = 0;
+    ntabulated = 0;
+    ndepth = 0;
+
+    for (int id=0; id<n; id++) {
+        CompiledSensor &s = sensor[id];
+        const LRBinSensor &bs = file->GetSensor(id);
+        s.x = bs.x;
+        s.y = bs.y;
+        int il = file->GetSensorLRF(id);
+        if (il < 0)
+            continue;
+        const LRBinLRF &l = file->GetLRF(il);
+        if (l.type != LRBinLRF::Axial || !l.ready || l.nint < 1)
+            continue;
+
+        s.kind = CompiledSensor::Axial;
+        s.gain = bs.gain;
+        for (int i=0; i<4; i++)
+            s.m[i] = bs.m[i];
+        s.t[0] = bs.t[0];
+        s.t[1] = bs.t[1];
+        s.x0 = l.x0;
+        s.y0 = l.y0;
+        if (l.compress == LRBinLRF::DualSlope) {
+            s.compress = true;
+            s.a = l.a;
+            s.b = l.b;
+            s.r0 = l.r0;
+            s.lam2 = l.lam2;
+        }
+        s.nint = l.nint;
+        s.xl = l.xmin;
+        s.xr = l.xmax;
+        s.scale = l.nint/(l.xmax - l.xmin);
+        s.poly = coef_base + l.poly;
+    }
+}
+
+// ============== Tabulation ===============
+
+void CompiledLRModel::clearTables()
+{
+    for (TabulatedLRF *tab : tables)
+        delete tab;
+    tables.clear();
+}
+
+// one table per distinct LRF: the group LRF is shared by the sensors of the group,
+// in a binary file the LRF records are shared the same way
+void CompiledLRModel::tabulate()
+{
+    clearTables();
+    if (!(tab_step > 0.))
+        return;
+
+    std::map <const void*, TabulatedLRF*> made;
+    for (int id=0; id<(int)sensor.size(); id++) {
+        CompiledSensor &s = sensor[id];
+        if (s.kind != CompiledSensor::Axial && s.kind != CompiledSensor::Generic)
+            continue;
+        if (!file && (lrm->GetLRF(id)->hasDepth() || !lrm->GetLRF(id)->isValid()))
+            continue;
+        const void *key = file ? (const void*)&file->GetLRF(file->GetSensorLRF(id)) : lrm->GetLRF(id);
+        TabulatedLRF *&tab = made[key];
+        if (!tab) {
+            if (file) {
+                LRFaxial axial(file->GetLRF(file->GetSensorLRF(id)), file->GetCoef());
+                tab = new TabulatedLRF(axial, tab_step, tab_tolerance, tab_grid);
+            } else {
+                tab = new TabulatedLRF(*lrm->GetLRF(id), tab_step, tab_tolerance, tab_grid);
+            }
+            tables.push_back(tab);
+        }
+    // the exact evaluation is kept where the table is not good enough
+        if (!tab->isValid() || !tab->isAccurate())
+            continue;
+        if (s.kind == CompiledSensor::Generic)
+            ngeneric--;
+        s.kind = CompiledSensor::Tabulated;
+        s.tab = tab;
+        ntabulated++;
+    }
+}
+
+size_t CompiledLRModel::GetTableMemory() const
+{
+    size_t sum = 0;
+    for (const TabulatedLRF *tab : tables)
+        sum += tab->getMemory();
+    return sum;
+}
+
+bool CompiledLRModel::GetZRange(double *zmin, double *zmax) const
+{
+    *zmin = this->zmin;
+    *zmax = this->zmax;
+    return ndepth > 0;
+}
+
+double CompiledLRModel::evalGeneric(int id, double x, double y, double z, double *gx, double *gy, double *gz) const
+{
+    double pos[3] = {x, y, z};
+    if (!gx)
+        return lrm->Eval(id, pos);
+
+    double grad[3];
+    double val = lrm->EvalGrad(id, pos, grad);
+    *gx = grad[0];
+    *gy = grad[1];
+    if (gz)
+        *gz = grad[2];
+    return val;
+}
+
+void CompiledLRModel::EvalList(int n, const int *ids, double x, double y, double *val) const
+{
+    if (ngeneric == 0 && ntabulated == 0) {
+        for (int k=0; k<n; k++) {
+            const CompiledSensor &s = sensor[ids[k]];
+            val[k] = s.kind == CompiledSensor::Axial ? evalAxial(s, x, y) : 0.;
+        }
+    } else {
+        for (int k=0; k<n; k++)
+            val[k] = Eval(ids[k], x, y);
+    }
+}
+
+void CompiledLRModel::EvalGradList(int n, const int *ids, double x, double y, double *val, double *gx, double *gy) const
+{
+    if (ngeneric == 0 && ntabulated == 0) {
+        for (int k=0; k<n; k++) {
+            const CompiledSensor &s = sensor[ids[k]];
+            if (s.kind == CompiledSensor::Axial)
+                val[k] = evalAxialGrad(s, x, y, &gx[k], &gy[k]);
+            else
+                val[k] = gx[k] = gy[k] = 0.;
+        }
+    } else {
+        for (int k=0; k<n; k++)
+            val[k] = EvalGrad(ids[k], x, y, &gx[k], &gy[k]);
+    }
+}
+
+// only generic LRFs can depend on z
+void CompiledLRModel::EvalList(int n, const int *ids, double x, double y, double z, double *val) const
+{
+    if (ndepth == 0) {
+        EvalList(n, ids, x, y, val);
+        return;
+    }
+    for (int k=0; k<n; k++) {
+        int id = ids[k];
+        val[k] = sensor[id].kind == CompiledSensor::Generic ? evalGeneric(id, x, y, z, nullptr, nullptr) : Eval(id, x, y);
+    }
+}
+
+void CompiledLRModel::EvalGradList(int n, const int *ids, double x, double y, double z,
+                                   double *val, double *gx, double *gy, double *gz) const
+{
+    if (ndepth == 0) {
+        EvalGradList(n, ids, x, y, val, gx, gy);
+        std::fill(gz, gz+n, 0.);
+        return;
+    }
+    for (int k=0; k<n; k++) {
+        int id = ids[k];
+        if (sensor[id].kind == CompiledSensor::Generic) {
+            val[k] = evalGeneric(id, x, y, z, &gx[k], &gy[k], &gz[k]);
+        } else {
+            val[k] = EvalGrad(id, x, y, &gx[k], &gy[k]);
+            gz[k] = 0.;
+        }
+    }
+}
+
+void CompiledLRModel::MakePack(int n, const int *ids, LRSensorPack &pack) const
+{
+    pack.Clear(coef_base);
+    for (int k=0; k<n; k++)
+        pack.Add(sensor[ids[k]]);
+}
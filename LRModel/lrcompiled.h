@@ -0,0 +1,222 @@
+#ifndef LRCOMPILED_H
+#define LRCOMPILED_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "lrftabulated.h"
+
+class LRModel;
+class LRModelFile;
+class LRSensorPack;
+
+// Flat record describing the response of one sensor
+// local = M * world + t, all transforms used in LRModel are affine in (x, y)
+struct CompiledSensor
+{
+    enum Kind {
+        Null,       // no usable LRF, response is 0
+        Axial,      // LRFaxial with optional dual slope compression
+        Generic,    // anything else, evaluated through LRModel (the only kind that depends on z)
+        Tabulated   // LRF replaced by its table (see SetTabulation)
+    };
+
+    int kind = Null;
+    int nint = 0;           // spline intervals
+    double x = 0., y = 0.;  // sensor position
+    double m[4] = {1., 0., 0., 1.}; // 2x2 matrix, row-major
+    double t[2] = {0., 0.};         // translation
+    double gain = 1.;
+    double x0, y0;          // LRF origin in the local frame
+// compression: rho = max(0, b + a*(r-r0) - sqrt((r-r0)^2 + lam2))
+    bool compress = false;
+    double a, b, r0, lam2;
+// radial spline
+    double xl, xr;          // range in rho
+    double scale;           // nint/(xr-xl)
+    const double *poly = nullptr;   // 4 polynomial coefficients per interval
+// table in the local frame (with the LRF origin)
+    const TabulatedLRF *tab = nullptr;
+};
+
+// Read-only snapshot of an LRModel for use in the reconstruction hot loop:
+// per-sensor transforms, LRF parameters and spline polynomials are copied
+// into contiguous arrays, so that evaluation needs no virtual calls or lookups.
+// The snapshot has to be rebuilt (Compile) whenever the model is changed.
+// Alternatively, it can be made from a mapped binary model file (see lrbinary.h).
+// Optionally the LRFs are replaced by TabulatedLRF tables, one per distinct LRF, which
+// are used for the sensors where they meet the tolerance (LRFs depending on z are not tabulated).
+class CompiledLRModel
+{
+public:
+    CompiledLRModel(LRModel *lrm);
+    CompiledLRModel(const LRModelFile *file);
+    CompiledLRModel(const CompiledLRModel&) = delete;
+    CompiledLRModel& operator=(const CompiledLRModel&) = delete;
+    ~CompiledLRModel();
+
+    void Compile();
+// tables with the given step and relative tolerance (see TabulatedLRF) from the next Compile(),
+// step = 0 => exact evaluation
+    void SetTabulation(double step, double tolerance, TabulatedLRF::Grid grid = TabulatedLRF::Auto);
+    int GetSensorCount() const {return sensor.size();}
+    int GetGenericCount() const {return ngeneric;}
+    int GetTabulatedCount() const {return ntabulated;}
+    size_t GetTableMemory() const;
+// MakePack() can be used
+    bool CanPack() const {return ngeneric == 0 && ntabulated == 0;}
+    const CompiledSensor &GetSensor(int id) const {return sensor[id];}
+    const double *GetCoef() const {return coef_base;}
+    double GetX(int id) const {return sensor[id].x;}
+    double GetY(int id) const {return sensor[id].y;}
+// range of z covered by the LRFs depending on it, false if there are none
+    bool GetZRange(double *zmin, double *zmax) const;
+
+    double Eval(int id, double x, double y) const;
+    double EvalGrad(int id, double x, double y, double *gx, double *gy) const;
+// evaluate the sensors listed in ids[0..n-1] at the same position
+    void EvalList(int n, const int *ids, double x, double y, double *val) const;
+    void EvalGradList(int n, const int *ids, double x, double y, double *val, double *gx, double *gy) const;
+// the same at depth z, with the derivative over z in gz
+    void EvalList(int n, const int *ids, double x, double y, double z, double *val) const;
+    void EvalGradList(int n, const int *ids, double x, double y, double z, double *val, double *gx, double *gy, double *gz) const;
+// SIMD-friendly copy of the listed sensors, usable only if CanPack()
+    void MakePack(int n, const int *ids, LRSensorPack &pack) const;
+
+protected:
+    double evalAxial(const CompiledSensor &s, double x, double y) const;
+    double evalAxialGrad(const CompiledSensor &s, double x, double y, double *gx, double *gy) const;
+    double evalTabulated(const CompiledSensor &s, double x, double y) const;
+    double evalTabulatedGrad(const CompiledSensor &s, double x, double y, double *gx, double *gy) const;
+    double evalGeneric(int id, double x, double y, double z, double *gx, double *gy, double *gz = nullptr) const;
+    void compileModel();
+    void compileFile();
+    void tabulate();
+    void clearTables();
+
+protected:
+    LRModel *lrm = nullptr;
+    const LRModelFile *file = nullptr;
+    std::vector <CompiledSensor> sensor;
+    std::vector <double> coef;  // polynomial coefficients of all splines
+    const double *coef_base = nullptr;  // coef or the coefficient blob of the file
+    int ngeneric = 0;
+    int ndepth = 0;             // LRFs depending on z
+    double zmin = 0., zmax = 0.;
+// tabulation
+    double tab_step = 0.;
+    double tab_tolerance = 0.;
+    TabulatedLRF::Grid tab_grid = TabulatedLRF::Auto;
+    std::vector <TabulatedLRF*> tables;
+    int ntabulated = 0;
+};
+
+inline double CompiledLRModel::evalAxial(const CompiledSensor &s, double x, double y) const
+{
+    double lx = s.m[0]*x + s.m[1]*y + s.t[0] - s.x0;
+    double ly = s.m[2]*x + s.m[3]*y + s.t[1] - s.y0;
+    double rho = sqrt(lx*lx + ly*ly);
+    if (s.compress) {
+        double dr = rho - s.r0;
+        rho = std::max(0., s.b + dr*s.a - sqrt(dr*dr + s.lam2));
+    }
+
+// same interval location as BsplineBasis1d::Locate
+    int ix;
+    double xf;
+    if (rho == s.xr) {
+        ix = s.nint - 1;
+        xf = 1.;
+    } else {
+        double xi = (rho - s.xl)*s.scale;
+        if (!(xi >= 0. && xi < s.nint))    // also rejects NaN
+            return 0.;
+        ix = (int)xi;       // truncation is floor here, avoids a libm call
+        xf = xi - ix;
+    }
+    const double *p = s.poly + ix*4;
+    return (p[0] + xf*(p[1] + xf*(p[2] + xf*p[3])))*s.gain;
+}
+
+inline double CompiledLRModel::evalAxialGrad(const CompiledSensor &s, double x, double y, double *gx, double *gy) const
+{
+    *gx = *gy = 0.;
+    double lx = s.m[0]*x + s.m[1]*y + s.t[0] - s.x0;
+    double ly = s.m[2]*x + s.m[3]*y + s.t[1] - s.y0;
+    double r = sqrt(lx*lx + ly*ly);
+    double rho = r, drho = 1.;
+    if (s.compress) {
+        double dr = r - s.r0;
+        double sq = sqrt(dr*dr + s.lam2);
+        rho = std::max(0., s.b + dr*s.a - sq);
+        drho = s.a - dr/sq;
+    }
+
+    int ix;
+    double xf;
+    if (rho == s.xr) {
+        ix = s.nint - 1;
+        xf = 1.;
+    } else {
+        double xi = (rho - s.xl)*s.scale;
+        if (!(xi >= 0. && xi < s.nint))    // also rejects NaN
+            return 0.;
+        ix = (int)xi;       // truncation is floor here, avoids a libm call
+        xf = xi - ix;
+    }
+    const double *p = s.poly + ix*4;
+    double val = (p[0] + xf*(p[1] + xf*(p[2] + xf*p[3])))*s.gain;
+
+// gradient direction is undefined at the origin
+    if (r > 0.) {
+        double drv = (p[1] + xf*(2.*p[2] + xf*3.*p[3]))*s.scale*drho/r*s.gain;
+        double glx = drv*lx, gly = drv*ly;
+    // world gradient is M^T * local gradient
+        *gx = s.m[0]*glx + s.m[2]*gly;
+        *gy = s.m[1]*glx + s.m[3]*gly;
+    }
+    return val;
+}
+
+inline double CompiledLRModel::evalTabulated(const CompiledSensor &s, double x, double y) const
+{
+    double lx = s.m[0]*x + s.m[1]*y + s.t[0];
+    double ly = s.m[2]*x + s.m[3]*y + s.t[1];
+    return s.tab->evalLocal(lx, ly)*s.gain;
+}
+
+inline double CompiledLRModel::evalTabulatedGrad(const CompiledSensor &s, double x, double y, double *gx, double *gy) const
+{
+    double lx = s.m[0]*x + s.m[1]*y + s.t[0];
+    double ly = s.m[2]*x + s.m[3]*y + s.t[1];
+    double glx, gly;
+    double val = s.tab->evalLocalGrad(lx, ly, &glx, &gly)*s.gain;
+    *gx = (s.m[0]*glx + s.m[2]*gly)*s.gain;
+    *gy = (s.m[1]*glx + s.m[3]*gly)*s.gain;
+    return val;
+}
+
+inline double CompiledLRModel::Eval(int id, double x, double y) const
+{
+    const CompiledSensor &s = sensor[id];
+    if (s.kind == CompiledSensor::Axial)
+        return evalAxial(s, x, y);
+    if (s.kind == CompiledSensor::Tabulated)
+        return evalTabulated(s, x, y);
+    return s.kind == CompiledSensor::Generic ? evalGeneric(id, x, y, 0., nullptr, nullptr) : 0.;
+}
+
+inline double CompiledLRModel::EvalGrad(int id, double x, double y, double *gx, double *gy) const
+{
+    const CompiledSensor &s = sensor[id];
+    if (s.kind == CompiledSensor::Axial)
+        return evalAxialGrad(s, x, y, gx, gy);
+    if (s.kind == CompiledSensor::Tabulated)
+        return evalTabulatedGrad(s, x, y, gx, gy);
+    if (s.kind == CompiledSensor::Generic)
+        return evalGeneric(id, x, y, 0., gx, gy);
+    *gx = *gy = 0.;
+    return 0.;
+}
+
+#endif // LRCOMPILED_H
@@ -0,0 +1,47 @@
+#include "lrf.h"
+#include "lrfaxial.h"
+#include "lrfxy.h"
+#include "lrfaxial3d.h"
+#include "lrf3d.h"
+#include "json11.hpp"
+#include "profileHist.h"
+
+LRF* LRF::Factory(const Json &json)
+{
+// files written before the type key was introduced contain only axial LRFs
+    std::string type = json["type"].is_string() ? json["type"].string_value() : "Axial";
+
+    if (type == "Axial")
+        return new LRFaxial(json);
+    else if (type == "XY")
+        return new LRFxy(json);
+    else if (type == "Axial3D")
+        return new LRFaxial3d(json);
+    else if (type == "3D")
+        return new LRF3D(json);
+    else
+        return NULL;
+}
+
+double LRF::histRatio(ProfileHist *h0, ProfileHist *h1)
+{
+    if (!h0 || !h1)
+        return -1;
+
+    int nbins = h0->GetBinsTotal();
+    if (h1->GetBinsTotal() != nbins)
+        return -1;
+
+    double sumxy = 0.;
+    double sumxx = 0.;
+
+    for (int i=0; i<nbins; i++) {
+        if (h0->GetFlatBinEntries(i) && h1->GetFlatBinEntries(i))  { // must have something in both bins
+            double z0 = h0->GetFlatBinMean(i);
+            sumxy += z0*h1->GetFlatBinMean(i);
+            sumxx += z0*z0;
+        }
+    }
+
+    return sumxx > 0. ? sumxy/sumxx : -1;
+}
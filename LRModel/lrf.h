@@ -9,6 +9,8 @@
 typedef std::array <double, 4> LRFdata;
 
 class BSfit;
+class ProfileHist;
+struct LRBinLRF;
 
 class LRF : public LRF_IO
 {
@@ -17,11 +19,14 @@ public:
     virtual ~LRF() {}
 
     virtual LRF* clone() const = 0;
+// LRF of the type given by json["type"] ("Axial" if not present), NULL if the type is unknown
+    static LRF* Factory(const Json &json);
 
     bool inDomain(double *pos) const {return inDomain(pos[0], pos[1], pos[2]);}
     double eval(double *pos) const {return eval(pos[0], pos[1], pos[2]);}
     double evalDrvX(double *pos) const {return evalDrvX(pos[0], pos[1], pos[2]);}
     double evalDrvY(double *pos) const {return evalDrvY(pos[0], pos[1], pos[2]);}
+    double evalGrad(double *pos, double *grad) const {return evalGrad(pos[0], pos[1], pos[2], grad);}
 
     void setBinned(bool val) {binned = val;}
     void setNonNegative(bool val) {non_negative = val;}
@@ -31,10 +36,30 @@ public:
     virtual double eval(double x, double y, double z=0.) const = 0;
     virtual double evalDrvX(double x, double y, double z=0.) const = 0;
     virtual double evalDrvY(double x, double y, double z=0.) const = 0;
+// value and gradient (grad[0..2] = d/dx, d/dy, d/dz) in one go
+// override in derived classes where it can be done faster than separate calls
+    virtual double evalGrad(double x, double y, double z, double *grad) const
+    {
+        grad[0] = evalDrvX(x, y, z);
+        grad[1] = evalDrvY(x, y, z);
+        grad[2] = 0.;
+        return eval(x, y, z);
+    }
 
     virtual bool fitData(const std::vector <LRFdata> &data) = 0;
     virtual void addData(const std::vector <LRFdata> &data) = 0;
+// single data point, same as addData() with one element but without the vector
+    virtual void addPoint(double x, double y, double z, double val)
+        {addData(std::vector <LRFdata> (1, LRFdata({x, y, z, val})));}
     virtual bool doFit() = 0;
+// accumulated fit data (binned or streamed): drop it / add the data accumulated
+// by another LRF of the same type and binning (returns false if that is not possible)
+    virtual void clearData() {}
+    virtual bool mergeData(const LRF */*other*/) {return false;}
+
+// binary I/O: fills the record, appends spline data to blob;
+// returns false if the LRF type has no binary representation
+    virtual bool ToBinary(LRBinLRF &/*rec*/, std::vector <double> &/*blob*/) const {return false;}
 
     virtual std::string type() const = 0;
     virtual bool isValid() const { return valid; }
@@ -47,14 +72,21 @@ public:
     virtual double getYmax() const {return ymax;}
     virtual double getZmin() const {return zmin;}
     virtual double getZmax() const {return zmax;}
+// the response depends on z (depth of interaction)
+    bool hasDepth() const {return getZmax() > getZmin();}
 
+// relative gain of other to this LRF, -1 if it cannot be determined
     virtual double GetRatio(LRF* other) const = 0;
 
 protected:
+// relative gain from the fit histograms of two LRFs of the same type and binning: least squares k
+// in h1 = k*h0 over the bin means filled in both, -1 if it cannot be determined
+    static double histRatio(ProfileHist *h0, ProfileHist *h1);
+
     bool valid = false; // indicates if the LRF can be used for reconstruction
     double xmin, xmax; 	// xrange
     double ymin, ymax; 	// yrange
-    double zmin, zmax; 	// zrange
+    double zmin = 0., zmax = 0.;   // zrange, empty if the LRF does not depend on z
     bool binned = true;
     bool non_negative = false;
 };
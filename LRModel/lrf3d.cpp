@@ -0,0 +1,207 @@
+#include "lrf3d.h"
+#include "bspline123d.h"
+#include "bsfit123.h"
+#include "json11.hpp"
+#include <cmath>
+
+LRF3D::LRF3D(double xmin, double xmax, int nintx, double ymin, double ymax, int ninty,
+             double zmin, double zmax, int nintz)
+{
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->zmin = zmin;
+    this->zmax = zmax;
+    this->nintx = nintx;
+    this->ninty = ninty;
+    this->nintz = nintz;
+    bsr = new Bspline3d(xmin, xmax, nintx, ymin, ymax, ninty, zmin, zmax, nintz);
+}
+
+LRF3D* LRF3D::clone() const
+{
+    LRF3D *copy = new LRF3D(*this);
+    copy->bsr = bsr ? new Bspline3d(*bsr) : nullptr;
+    copy->bsfit = bsfit ? bsfit->clone() : nullptr;
+    return copy;
+}
+
+LRF3D::LRF3D(const Json &json)
+{
+    if (!json["response"]["bspline3"].is_object())
+        return;
+    bsr = new Bspline3d(json["response"]["bspline3"]);
+    if (bsr->isInvalid())
+        return;
+
+    xmin = bsr->GetXmin();
+    xmax = bsr->GetXmax();
+    ymin = bsr->GetYmin();
+    ymax = bsr->GetYmax();
+    zmin = bsr->GetZmin();
+    zmax = bsr->GetZmax();
+    nintx = bsr->GetNintX();
+    ninty = bsr->GetNintY();
+    nintz = bsr->GetNintZ();
+    valid = true;
+}
+
+LRF3D::LRF3D(std::string &json_str) : LRF3D(Json::parse(json_str, json_err)) {}
+
+LRF3D::~LRF3D()
+{
+    delete bsr;
+    delete bsfit;
+}
+
+bool LRF3D::isReady() const
+{
+    return (bsr != 0) && bsr->IsReady();
+}
+
+bool LRF3D::inDomain(double x, double y, double z) const
+{
+    return x >= xmin && x <= xmax && y >= ymin && y <= ymax && z >= zmin && z <= zmax;
+}
+
+double LRF3D::getRmax() const
+{
+    return 0.5*hypot(xmax-xmin, ymax-ymin);
+}
+
+double LRF3D::eval(double x, double y, double z) const
+{
+    return isReady() ? bsr->Eval(x, y, z) : 0.;
+}
+
+double LRF3D::evalDrvX(double x, double y, double z) const
+{
+    return isReady() ? bsr->EvalDrvX(x, y, z) : 0.;
+}
+
+double LRF3D::evalDrvY(double x, double y, double z) const
+{
+    return isReady() ? bsr->EvalDrvY(x, y, z) : 0.;
+}
+
+// one Locate for the value and all three derivatives
+double LRF3D::evalGrad(double x, double y, double z, double *grad) const
+{
+    grad[0] = grad[1] = grad[2] = 0.;
+    if (!isReady())
+        return 0.;
+    return bsr->EvalWithDrv(x, y, z, &grad[0], &grad[1], &grad[2]);
+}
+
+BSfit3D *LRF3D::InitFit()
+{
+    if (!non_negative)
+        return new BSfit3D(bsr);
+
+    ConstrainedFit3D *cf = new ConstrainedFit3D(bsr);
+    cf->ForceNonNegative();
+    return cf;
+}
+
+bool LRF3D::fitData(const std::vector <LRFdata> &data)
+{
+    BSfit3D *F = InitFit();
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1], d[2]))
+            continue;
+        F->AddData(d[0], d[1], d[2], d[3]);
+    }
+
+    bool status = F->BinnedFit();
+
+    if (status) {
+        delete bsr;
+        bsr = F->MakeSpline();
+    }
+
+    delete F;
+    valid = status;
+    return status;
+}
+
+void LRF3D::addData(const std::vector <LRFdata> &data)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1], d[2]))
+            continue;
+        bsfit->AddData(d[0], d[1], d[2], d[3]);
+    }
+}
+
+void LRF3D::addPoint(double x, double y, double z, double val)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    if (inDomain(x, y, z))
+        bsfit->AddData(x, y, z, val);
+}
+
+bool LRF3D::doFit()
+{
+    if (!bsfit)
+        return false;
+
+    if (bsfit->BinnedFit()) {
+        delete bsr;
+        bsr = bsfit->MakeSpline();
+        valid = true;
+        return true;
+    } else {
+        valid = false;
+        return false;
+    }
+}
+
+void LRF3D::clearData()
+{
+    delete bsfit;
+    bsfit = 0;
+}
+
+bool LRF3D::mergeData(const LRF *other_base)
+{
+    const LRF3D *other = dynamic_cast<const LRF3D*>(other_base);
+    if (!other)
+        return false;
+    if (!other->bsfit)
+        return true;    // nothing to add
+    if (!bsfit)
+        bsfit = InitFit();
+
+    return bsfit->MergeData(*other->bsfit);
+}
+
+double LRF3D::GetRatio(LRF* other_base) const
+{
+    LRF3D *other = dynamic_cast<LRF3D*>(other_base);
+    if (!bsfit || !other || !other->bsfit)
+        return -1;
+
+    return histRatio(bsfit->GetHist(), other->bsfit->GetHist());
+}
+
+const Bspline3d *LRF3D::getSpline() const
+{
+    return bsr;
+}
+
+// the box and the intervals are stored with the spline
+void LRF3D::ToJsonObject(Json_object &json) const
+{
+    json["type"] = std::string(type());
+    if (bsr) {
+        Json_object json1;
+        json1["bspline3"] = bsr->GetJsonObject();
+        json["response"] = json1;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef LRF3D_H
+#define LRF3D_H
+
+#include "lrf.h"
+
+class Bspline3d;
+class BSfit3D;
+
+// LRF of arbitrary shape depending on the depth of interaction: cubic tensor-product
+// B-spline over the box [xmin, xmax] x [ymin, ymax] x [zmin, zmax] in the frame of the LRF.
+// The fit data is always binned (3D profile histogram).
+class LRF3D : public LRF
+{
+public:
+    LRF3D(double xmin, double xmax, int nintx, double ymin, double ymax, int ninty,
+          double zmin, double zmax, int nintz);
+    LRF3D(const Json &json);
+    LRF3D(std::string &json_str);
+    ~LRF3D();
+
+    virtual LRF3D* clone() const;
+
+    virtual bool inDomain(double x, double y, double z=0.) const;
+    virtual bool isReady () const;
+// half diagonal of the (x, y) rectangle
+    virtual double getRmax() const;
+    int getNintX() const { return nintx; }
+    int getNintY() const { return ninty; }
+    int getNintZ() const { return nintz; }
+    virtual double eval(double x, double y, double z=0.) const;
+    virtual double evalDrvX(double x, double y, double z=0.) const;
+    virtual double evalDrvY(double x, double y, double z=0.) const;
+    virtual double evalGrad(double x, double y, double z, double *grad) const;
+
+    virtual bool fitData(const std::vector <LRFdata> &data);
+    virtual void addData(const std::vector <LRFdata> &data);
+    virtual void addPoint(double x, double y, double z, double val);
+    virtual bool doFit();
+    virtual void clearData();
+    virtual bool mergeData(const LRF *other);
+
+    const Bspline3d *getSpline() const;
+    virtual std::string type() const { return std::string("3D"); }
+    virtual void ToJsonObject(Json_object &json) const;
+
+    double GetRatio(LRF* other) const;
+
+protected:
+    BSfit3D *InitFit();
+
+protected:
+    int nintx = 0, ninty = 0, nintz = 0;   // intervals
+    Bspline3d *bsr = 0;     // spline describing the response
+    BSfit3D *bsfit = 0;     // object used in fitting
+    std::string json_err;
+};
+
+#endif // LRF3D_H
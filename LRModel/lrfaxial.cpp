@@ -4,25 +4,16 @@
 #include "compress.h"
 #include "json11.hpp"
 #include "profileHist.h"
+#include "lrbinary.h"
 
-LRFaxial::LRFaxial(double rmax, int nint)
-{
-    this->rmax = rmax;
-    this->nint = nint;
-    bsr = new Bspline1d(rmin, rmax, nint);
-    Init();
-}
+// ============== Axial geometry ===============
 
-LRFaxial* LRFaxial::clone() const 
-{ 
-    LRFaxial *copy = new LRFaxial(*this);
-    copy->bsr = bsr ? new Bspline1d(*bsr) : nullptr;
-    copy->compress = compress ? compress->clone() : nullptr;
-    copy->bsfit = bsfit ? bsfit->clone() : nullptr;
-    return copy;
+LRFaxialBase::~LRFaxialBase()
+{
+    delete compress;
 }
 
-void LRFaxial::Init()
+void LRFaxialBase::Init()
 {
     rmin2 = rmin*rmin;
     rmax2 = rmax*rmax;
@@ -30,22 +21,103 @@ void LRFaxial::Init()
     xmax = x0+rmax;
     ymin = y0-rmax;
     ymax = y0+rmax;
-    init_done = true;
 }
 
-void LRFaxial::SetOrigin(double x0, double y0)
+void LRFaxialBase::SetOrigin(double x0, double y0)
 {
     this->x0 = x0;
     this->y0 = y0;
     Init();
 }
 
+double LRFaxialBase::Rho(double r) const
+{
+    return compress ? compress->Rho(r) : r;
+}
+
+double LRFaxialBase::Rho(double x, double y) const
+{
+    return compress ? compress->Rho(R(x, y)) : R(x, y);
+}
+
+double LRFaxialBase::RhoDrvX(double x, double y) const
+{
+    double drdx = (x-x0)/R(x, y);
+    return compress ? compress->RhoDrv(R(x, y))*drdx : drdx;
+}
+
+double LRFaxialBase::RhoDrvY(double x, double y) const
+{
+    double drdy = (y-y0)/R(x, y);
+    return compress ? compress->RhoDrv(R(x, y))*drdy : drdy;
+}
+
+void LRFaxialBase::radialGrad(double x, double y, double r, double drho, double *grad) const
+{
+// gradient direction is undefined at the origin
+    if (r > 0.) {
+        drho *= compress ? compress->RhoDrv(r)/r : 1./r;
+        grad[0] = drho*(x-x0);
+        grad[1] = drho*(y-y0);
+    } else {
+        grad[0] = grad[1] = 0.;
+    }
+}
+
+bool LRFaxialBase::axialFromJson(const Json &json)
+{
+    if (!json["rmax"].is_number())
+        return false;
+// if x0, y0 or rmin key is not present in JSON object it defaults to 0
+// providing compatibility with previous version
+    x0 = json["x0"].number_value();
+    y0 = json["y0"].number_value();
+    rmin = json["rmin"].number_value();
+    rmax = json["rmax"].number_value();
+    if (rmax <= rmin)
+        return false;
+    if (json["compression"].is_object())
+        compress = Compress1d::Factory(json["compression"]);
+
+    Init();
+    return true;
+}
+
+void LRFaxialBase::axialToJson(Json_object &json) const
+{
+    json["type"] = std::string(type());
+    json["rmin"] = rmin;
+    json["rmax"] = rmax;
+    json["x0"] = x0;
+    json["y0"] = y0;
+    if (compress) json["compression"] = compress->GetJsonObject();
+}
+
+// ============== LRFaxial ===============
+
+LRFaxial::LRFaxial(double rmax, int nint)
+{
+    this->rmax = rmax;
+    this->nint = nint;
+    bsr = new Bspline1d(rmin, rmax, nint, degree);
+    Init();
+}
+
+LRFaxial* LRFaxial::clone() const 
+{ 
+    LRFaxial *copy = new LRFaxial(*this);
+    copy->bsr = bsr ? new Bspline1d(*bsr) : nullptr;
+    copy->compress = compress ? compress->clone() : nullptr;
+    copy->bsfit = bsfit ? bsfit->clone() : nullptr;
+    return copy;
+}
+
 void LRFaxial::SetRmin(double val)
 {
     rmin = val;
     rmin2 = rmin*rmin;
     delete bsr;
-    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint);
+    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint, degree);
 }
 
 void LRFaxial::SetRmax(double val)
@@ -53,33 +125,27 @@ void LRFaxial::SetRmax(double val)
     rmax = val;
     rmax2 = rmax*rmax;
     delete bsr;
-    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint);
+    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint, degree);
 }
 
 void LRFaxial::SetCompression(Compress1d *compress)
 {
     this->compress = compress;
     delete bsr;
-    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint);
+    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint, degree);
+}
+
+void LRFaxial::SetSplineDegree(int degree)
+{
+    this->degree = degree;
+    delete bsr;
+    bsr = new Bspline1d(Rho(rmin), Rho(rmax), nint, degree);
 }
 
 LRFaxial::LRFaxial(const Json &json)
 {
-    if (!json["rmax"].is_number())
+    if (!axialFromJson(json))
         return;
-// if x0, y0 or rmin key is not present in JSON object it defaults to 0
-// providing compatibility with previous version
-    x0 = json["x0"].number_value();
-    y0 = json["y0"].number_value();
-    rmin = json["rmin"].number_value();
-    rmax = json["rmax"].number_value();
-    if (rmax <= rmin)
-        return;
-    if (json["compression"].is_object())
-        compress = Compress1d::Factory(json["compression"]);
-
-    Init();
-// up to this point shared with axial3d
 
     if (json["response"]["bspline3"].is_object())
         bsr = new Bspline1d(json["response"]["bspline3"]);
@@ -87,48 +153,53 @@ LRFaxial::LRFaxial(const Json &json)
         return;
 
     nint = bsr->GetNint();
+    degree = bsr->GetDegree();
     valid = true;
 }
 
 LRFaxial::LRFaxial(std::string &json_str) : LRFaxial(Json::parse(json_str, json_err)) {}
 
-LRFaxial::~LRFaxial()
+LRFaxial::LRFaxial(const LRBinLRF &rec, const double *blob)
 {
-    delete bsr;
-    delete compress;
-}
+    if (rec.type != LRBinLRF::Axial || rec.rmax <= rec.rmin)
+        return;
+    x0 = rec.x0;
+    y0 = rec.y0;
+    rmin = rec.rmin;
+    rmax = rec.rmax;
+    if (rec.compress != LRBinLRF::NoCompression)
+        compress = Compress1d::Factory(rec);
 
-bool LRFaxial::isReady() const
-{
-    return (bsr != 0) && bsr->IsReady();
-}
+    Init();
 
-bool LRFaxial::inDomain(double x, double y, double /*z*/) const
-{
-    double r2 = R2(x,y);
-    return (r2 < rmax2) && (r2 > rmin2);
-}
+    degree = rec.degree;
+    bsr = new Bspline1d(rec.xmin, rec.xmax, rec.nint, degree);
+    if (bsr->isInvalid())
+        return;
+    if (rec.ready) {
+        std::vector <double> c(blob + rec.coef, blob + rec.coef + rec.nbas);
+        if (!bsr->SetCoef(c))
+            return;
+    }
 
-double LRFaxial::Rho(double r) const
-{
-    return compress ? compress->Rho(r) : r;
+    nint = rec.nint;
+    valid = true;
 }
 
-double LRFaxial::Rho(double x, double y) const
+LRFaxial::~LRFaxial()
 {
-    return compress ? compress->Rho(R(x, y)) : R(x, y);
+    delete bsr;
+    delete bsfit;
 }
 
-double LRFaxial::RhoDrvX(double x, double y) const
+bool LRFaxial::isReady() const
 {
-    double drdx = (x-x0)/R(x, y);
-    return compress ? compress->RhoDrv(R(x, y))*drdx : drdx;
+    return (bsr != 0) && bsr->IsReady();
 }
 
-double LRFaxial::RhoDrvY(double x, double y) const
+bool LRFaxial::inDomain(double x, double y, double /*z*/) const
 {
-    double drdy = (y-y0)/R(x, y);
-    return compress ? compress->RhoDrv(R(x, y))*drdy : drdy;
+    return inRange(x, y);
 }
 
 double LRFaxial::eval(double x, double y, double /*z*/) const
@@ -146,37 +217,46 @@ double LRFaxial::evalDrvY(double x, double y, double /*z*/) const
     return isReady() ? bsr->EvalDrv(Rho(x, y))*RhoDrvY(x, y) : 0.;
 }
 
-BSfit1D *LRFaxial::InitFit()
+double LRFaxial::evalGrad(double x, double y, double /*z*/, double *grad) const
 {
-    if (!flattop && !non_negative && !non_increasing)
-        return new BSfit1D(bsr);
+    grad[0] = grad[1] = grad[2] = 0.;
+    if (!isReady())
+        return 0.;
+
+    double r = R(x, y);
+    double drv;
+    double val = bsr->EvalWithDrv(Rho(r), &drv);
+    radialGrad(x, y, r, drv, grad);
+    return val;
+}
 
-    ConstrainedFit1D *cf = new ConstrainedFit1D(bsr);
-    if (non_increasing) cf->ForceNonIncreasing();
-    if (non_negative) cf->ForceNonNegative();
-    if (flattop) cf->FixDrvLeft(0.);
-    return cf;
+// not binned fits stream the data into normal equations instead of storing it
+BSfit1D *LRFaxial::InitFit()
+{
+    BSfit1D *F;
+    if (!flattop && !non_negative && !non_increasing) {
+        F = new BSfit1D(bsr);
+    } else {
+        ConstrainedFit1D *cf = new ConstrainedFit1D(bsr);
+        if (non_increasing) cf->ForceNonIncreasing();
+        if (non_negative) cf->ForceNonNegative();
+        if (flattop) cf->FixDrvLeft(0.);
+        F = cf;
+    }
+    F->SetStreaming(!binned);
+    return F;
 }
 
 bool LRFaxial::fitData(const std::vector <LRFdata> &data)
 {
-    std::vector <double> vr, va;
-    bool status;
-
+    BSfit1D *F = InitFit();
     for (auto d : data) {
         if (!inDomain(d[0], d[1]))
             continue;
-        vr.push_back(Rho(d[0], d[1]));
-        va.push_back(d[3]);
+        F->AddData(Rho(d[0], d[1]), d[3]);
     }
 
-    BSfit1D *F = InitFit();
-    if (binned) {
-        F->AddData(vr, va);
-        status = F->BinnedFit();
-    } else {
-        status = F->Fit(vr, va);
-    }
+    bool status = binned ? F->BinnedFit() : F->StreamedFit();
 
     if (status) {
         delete bsr;
@@ -200,12 +280,21 @@ void LRFaxial::addData(const std::vector <LRFdata> &data)
     }
 }
 
+void LRFaxial::addPoint(double x, double y, double /*z*/, double val)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    if (inDomain(x, y))
+        bsfit->AddData(Rho(x, y), val);
+}
+
 bool LRFaxial::doFit()
 {
     if (!bsfit)
         return false;
 
-    if (bsfit->BinnedFit()) {
+    if (bsfit->IsStreaming() ? bsfit->StreamedFit() : bsfit->BinnedFit()) {
         delete bsr;
         bsr = bsfit->MakeSpline();
         valid = true;
@@ -216,31 +305,32 @@ bool LRFaxial::doFit()
     }
 }
 
-double LRFaxial::GetRatio(LRF* other_base) const
+void LRFaxial::clearData()
 {
-    LRFaxial *other = dynamic_cast<LRFaxial*>(other_base);
-    if (!other || !(other->bsfit))
-        return -1;
-    
-    ProfileHist *h0 = bsfit->GetHist();
-    ProfileHist *h1 = other->bsfit->GetHist();
+    delete bsfit;
+    bsfit = 0;
+}
 
-    int nbins = h0->GetBinsTotal();
-    if (h1->GetBinsTotal() != nbins)
-        return -1;
+bool LRFaxial::mergeData(const LRF *other_base)
+{
+    const LRFaxial *other = dynamic_cast<const LRFaxial*>(other_base);
+    if (!other)
+        return false;
+    if (!other->bsfit)
+        return true;    // nothing to add
+    if (!bsfit)
+        bsfit = InitFit();
 
-    double sumxy = 0.;
-    double sumxx = 0.;
+    return bsfit->MergeData(*other->bsfit);
+}
 
-    for (int i=0; i<nbins; i++) {
-        if (h0->GetFlatBinEntries(i) && h1->GetFlatBinEntries(i))  { // must have something in both bins
-            double z0 = h0->GetFlatBinMean(i);
-            sumxy += z0*h1->GetFlatBinMean(i);
-            sumxx += z0*z0;
-        }
-    }
+double LRFaxial::GetRatio(LRF* other_base) const
+{
+    LRFaxial *other = dynamic_cast<LRFaxial*>(other_base);
+    if (!bsfit || !other || !other->bsfit)
+        return -1;
 
-    return sumxx > 0. ? sumxy/sumxx : -1;
+    return histRatio(bsfit->GetHist(), other->bsfit->GetHist());
 }
 
 /* double LRFaxial::fitRData(int npts, const double *r, const double *data)
@@ -273,14 +363,38 @@ const Bspline1d *LRFaxial::getSpline() const
 
 void LRFaxial::ToJsonObject(Json_object &json) const
 {
-    json["type"] = std::string(type());
-    json["rmax"] = rmax;
-    json["x0"] = x0;
-    json["y0"] = y0;
+    axialToJson(json);
     if (bsr) {
         Json_object json1;
         json1["bspline3"] = bsr->GetJsonObject();
         json["response"] = json1;
     }
-    if (compress) json["compression"] = compress->GetJsonObject();
+}
+
+bool LRFaxial::ToBinary(LRBinLRF &rec, std::vector <double> &blob) const
+{
+    rec.type = LRBinLRF::Axial;
+    rec.x0 = x0;
+    rec.y0 = y0;
+    rec.rmin = rmin;
+    rec.rmax = rmax;
+    rec.compress = LRBinLRF::NoCompression;
+    if (compress)
+        compress->ToBinary(rec);
+    if (!bsr)
+        return false;
+
+    rec.ready = bsr->IsReady() ? 1 : 0;
+    rec.xmin = bsr->GetXmin();
+    rec.xmax = bsr->GetXmax();
+    rec.nint = bsr->GetNint();
+    rec.degree = bsr->GetDegree();
+    std::vector <double> c = bsr->GetCoef();
+    rec.nbas = c.size();
+    rec.coef = blob.size();
+    blob.insert(blob.end(), c.begin(), c.end());
+    rec.poly = blob.size();
+    for (auto &p : bsr->GetPoly())
+        blob.insert(blob.end(), p.begin(), p.end());
+    return true;
 }
@@ -7,70 +7,99 @@
 class Bspline1d;
 class BSfit1D;
 class Compress1d;
+struct LRBinLRF;
 
-class LRFaxial : public LRF
+// Common part of the axial LRFs: the response depends on the distance r from the axis at (x0, y0)
+// through rho(r) = r, or the compressed distance if compression is set, in the range rmin < r < rmax
+class LRFaxialBase : public LRF
 {
+public:
+    virtual ~LRFaxialBase();
+
+    virtual double getRmax() const { return rmax; }
+    void SetOrigin(double x0, double y0);
+
+// calculation of radius + provision for compression
+    double R(double x, double y) const {return sqrt((x-x0)*(x-x0)+(y-y0)*(y-y0));}
+    double R2(double x, double y) const {return (x-x0)*(x-x0)+(y-y0)*(y-y0);}
+    double Rho(double r) const;
+    double Rho(double x, double y) const;
+    double RhoDrvX(double x, double y) const;
+    double RhoDrvY(double x, double y) const;
+
+protected:
+    void Init();
+    bool inRange(double x, double y) const {double r2 = R2(x, y); return (r2 < rmax2) && (r2 > rmin2);}
+// d/drho at (x, y), r = R(x, y), converted to grad[0..1] = d/dx, d/dy
+    void radialGrad(double x, double y, double r, double drho, double *grad) const;
+// JSON keys shared by the axial types; false if the range is missing or empty
+    bool axialFromJson(const Json &json);
+    void axialToJson(Json_object &json) const;
+
+protected:
+    double x0 = 0., y0 = 0.;  // center
+    double rmin = 0.;    // domain
+    double rmax = 0.;	// domain
+    double rmin2;   // domain
+    double rmax2;	// domain
+    Compress1d *compress = 0; // optional compression
+};
+
+class LRFaxial : public LRFaxialBase
+{
+friend class CompiledLRModel;
+friend class TabulatedLRF;
 public:
     LRFaxial(double rmax, int nint);
     LRFaxial(const Json &json);
     LRFaxial(std::string &json_str);
+    LRFaxial(const LRBinLRF &rec, const double *blob);
     ~LRFaxial();
 
     virtual LRFaxial* clone() const;
 
     virtual bool inDomain(double x, double y, double z=0.) const;
     virtual bool isReady () const;
-    virtual double getRmax() const { return rmax; }
     int getNint() const { return nint; }
     virtual double eval(double x, double y, double z=0.) const;
     virtual double evalDrvX(double x, double y, double z=0.) const;
     virtual double evalDrvY(double x, double y, double z=0.) const;
+    virtual double evalGrad(double x, double y, double z, double *grad) const;
 //    double fitRData(int npts, const double *r, const double *data);
 
     virtual bool fitData(const std::vector <LRFdata> &data);
     virtual void addData(const std::vector <LRFdata> &data);
+    virtual void addPoint(double x, double y, double z, double val);
     virtual bool doFit();
+    virtual void clearData();
+    virtual bool mergeData(const LRF *other);
 
     const Bspline1d *getSpline() const;
     virtual std::string type() const { return std::string("Axial"); }
     virtual void ToJsonObject(Json_object &json) const;
+    virtual bool ToBinary(LRBinLRF &rec, std::vector <double> &blob) const;
 
-    void SetOrigin(double x0, double y0);
     void SetRmin(double rmin);
     void SetRmax(double rmax);
     void SetCompression(Compress1d *compress);
+    void SetSplineDegree(int degree);   // 3 (default) or 2: quadratic is cheaper to fit and evaluate
 
     void SetFlatTop(bool val) {flattop = val;}
     void SetNonIncreasing(bool val) {non_increasing = val;}
 
-// calculation of radius + provision for compression
-    double R(double x, double y) const {return sqrt((x-x0)*(x-x0)+(y-y0)*(y-y0));}
-    double R2(double x, double y) const {return (x-x0)*(x-x0)+(y-y0)*(y-y0);}
-    double Rho(double r) const;
-    double Rho(double x, double y) const;
-    double RhoDrvX(double x, double y) const;
-    double RhoDrvY(double x, double y) const;
-
 // relative gain calculation
     double GetRatio(LRF* other) const;    
 
 protected:
-    void Init();
     BSfit1D *InitFit();
 
 protected:
-    double x0 = 0., y0 = 0.;  // center
-    double rmin = 0.;    // domain
-    double rmax = 0.;	// domain
-    double rmin2;   // domain
-    double rmax2;	// domain
     int nint;		// intervals
+    int degree = 3;     // of the radial spline
     bool flattop = false;   // set to true if you want to have zero derivative at the origin
     bool non_increasing = false;
     Bspline1d *bsr = 0; 	// spline describing radial dependence
-    Compress1d *compress = 0; // optional compression
     BSfit1D *bsfit = 0;     // object used in fitting
-    bool init_done = false;
     std::string json_err;
 };
 
@@ -0,0 +1,208 @@
+#include "lrfaxial3d.h"
+#include "bspline123d.h"
+#include "bsfit123.h"
+#include "compress.h"
+#include "json11.hpp"
+
+LRFaxial3d::LRFaxial3d(double rmax, int nint, double zmin, double zmax, int nintz)
+{
+    this->rmax = rmax;
+    this->nint = nint;
+    this->zmin = zmin;
+    this->zmax = zmax;
+    this->nintz = nintz;
+    bsr = new Bspline2d(rmin, rmax, nint, zmin, zmax, nintz);
+    Init();
+}
+
+LRFaxial3d* LRFaxial3d::clone() const
+{
+    LRFaxial3d *copy = new LRFaxial3d(*this);
+    copy->bsr = bsr ? new Bspline2d(*bsr) : nullptr;
+    copy->compress = compress ? compress->clone() : nullptr;
+    copy->bsfit = bsfit ? bsfit->clone() : nullptr;
+    return copy;
+}
+
+void LRFaxial3d::SetCompression(Compress1d *compress)
+{
+    this->compress = compress;
+    delete bsr;
+    bsr = new Bspline2d(Rho(rmin), Rho(rmax), nint, zmin, zmax, nintz);
+}
+
+// the same keys as in LRFaxial, the z range is stored with the spline
+LRFaxial3d::LRFaxial3d(const Json &json)
+{
+    if (!axialFromJson(json))
+        return;
+
+    if (json["response"]["bspline3"].is_object())
+        bsr = new Bspline2d(json["response"]["bspline3"]);
+    if (!bsr || bsr->isInvalid())
+        return;
+
+    nint = bsr->GetNintX();
+    nintz = bsr->GetNintY();
+    zmin = bsr->GetYmin();
+    zmax = bsr->GetYmax();
+    valid = true;
+}
+
+LRFaxial3d::LRFaxial3d(std::string &json_str) : LRFaxial3d(Json::parse(json_str, json_err)) {}
+
+LRFaxial3d::~LRFaxial3d()
+{
+    delete bsr;
+    delete bsfit;
+}
+
+bool LRFaxial3d::isReady() const
+{
+    return (bsr != 0) && bsr->IsReady();
+}
+
+bool LRFaxial3d::inDomain(double x, double y, double z) const
+{
+    return inRange(x, y) && z >= zmin && z <= zmax;
+}
+
+double LRFaxial3d::eval(double x, double y, double z) const
+{
+    return isReady() ? bsr->Eval(Rho(x, y), z) : 0.;
+}
+
+double LRFaxial3d::evalDrvX(double x, double y, double z) const
+{
+    return isReady() ? bsr->EvalDrvX(Rho(x, y), z)*RhoDrvX(x, y) : 0.;
+}
+
+double LRFaxial3d::evalDrvY(double x, double y, double z) const
+{
+    return isReady() ? bsr->EvalDrvX(Rho(x, y), z)*RhoDrvY(x, y) : 0.;
+}
+
+// one Locate for the value and the derivatives over rho and z
+double LRFaxial3d::evalGrad(double x, double y, double z, double *grad) const
+{
+    grad[0] = grad[1] = grad[2] = 0.;
+    if (!isReady())
+        return 0.;
+
+    double r = R(x, y);
+    double drv;
+    double val = bsr->EvalWithDrv(Rho(r), z, &drv, &grad[2]);
+    radialGrad(x, y, r, drv, grad);
+    return val;
+}
+
+BSfit2D *LRFaxial3d::InitFit()
+{
+    if (!non_negative)
+        return new BSfit2D(bsr);
+
+    ConstrainedFit2D *cf = new ConstrainedFit2D(bsr);
+    cf->ForceNonNegative();
+    return cf;
+}
+
+bool LRFaxial3d::fitData(const std::vector <LRFdata> &data)
+{
+    BSfit2D *F = InitFit();
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1], d[2]))
+            continue;
+        F->AddData(Rho(d[0], d[1]), d[2], d[3]);
+    }
+
+    bool status = F->BinnedFit();
+
+    if (status) {
+        delete bsr;
+        bsr = F->MakeSpline();
+    }
+
+    delete F;
+    valid = status;
+    return status;
+}
+
+void LRFaxial3d::addData(const std::vector <LRFdata> &data)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1], d[2]))
+            continue;
+        bsfit->AddData(Rho(d[0], d[1]), d[2], d[3]);
+    }
+}
+
+void LRFaxial3d::addPoint(double x, double y, double z, double val)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    if (inDomain(x, y, z))
+        bsfit->AddData(Rho(x, y), z, val);
+}
+
+bool LRFaxial3d::doFit()
+{
+    if (!bsfit)
+        return false;
+
+    if (bsfit->BinnedFit()) {
+        delete bsr;
+        bsr = bsfit->MakeSpline();
+        valid = true;
+        return true;
+    } else {
+        valid = false;
+        return false;
+    }
+}
+
+void LRFaxial3d::clearData()
+{
+    delete bsfit;
+    bsfit = 0;
+}
+
+bool LRFaxial3d::mergeData(const LRF *other_base)
+{
+    const LRFaxial3d *other = dynamic_cast<const LRFaxial3d*>(other_base);
+    if (!other)
+        return false;
+    if (!other->bsfit)
+        return true;    // nothing to add
+    if (!bsfit)
+        bsfit = InitFit();
+
+    return bsfit->MergeData(*other->bsfit);
+}
+
+double LRFaxial3d::GetRatio(LRF* other_base) const
+{
+    LRFaxial3d *other = dynamic_cast<LRFaxial3d*>(other_base);
+    if (!bsfit || !other || !other->bsfit)
+        return -1;
+
+    return histRatio(bsfit->GetHist(), other->bsfit->GetHist());
+}
+
+const Bspline2d *LRFaxial3d::getSpline() const
+{
+    return bsr;
+}
+
+void LRFaxial3d::ToJsonObject(Json_object &json) const
+{
+    axialToJson(json);
+    if (bsr) {
+        Json_object json1;
+        json1["bspline3"] = bsr->GetJsonObject();
+        json["response"] = json1;
+    }
+}
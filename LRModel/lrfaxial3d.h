@@ -0,0 +1,57 @@
+#ifndef LRFAXIAL3D_H
+#define LRFAXIAL3D_H
+
+#include "lrfaxial.h"
+
+class Bspline2d;
+class BSfit2D;
+
+// Axial LRF depending on the depth of interaction: cubic tensor-product B-spline
+// in (rho, z), where rho is the (optionally compressed) distance from the axis.
+// The fit data is always binned (2D profile histogram in rho and z).
+class LRFaxial3d : public LRFaxialBase
+{
+public:
+    LRFaxial3d(double rmax, int nint, double zmin, double zmax, int nintz);
+    LRFaxial3d(const Json &json);
+    LRFaxial3d(std::string &json_str);
+    ~LRFaxial3d();
+
+    virtual LRFaxial3d* clone() const;
+
+    virtual bool inDomain(double x, double y, double z=0.) const;
+    virtual bool isReady () const;
+    int getNint() const { return nint; }
+    int getNintZ() const { return nintz; }
+    virtual double eval(double x, double y, double z=0.) const;
+    virtual double evalDrvX(double x, double y, double z=0.) const;
+    virtual double evalDrvY(double x, double y, double z=0.) const;
+    virtual double evalGrad(double x, double y, double z, double *grad) const;
+
+    virtual bool fitData(const std::vector <LRFdata> &data);
+    virtual void addData(const std::vector <LRFdata> &data);
+    virtual void addPoint(double x, double y, double z, double val);
+    virtual bool doFit();
+    virtual void clearData();
+    virtual bool mergeData(const LRF *other);
+
+    const Bspline2d *getSpline() const;
+    virtual std::string type() const { return std::string("Axial3D"); }
+    virtual void ToJsonObject(Json_object &json) const;
+
+    void SetCompression(Compress1d *compress);
+
+    double GetRatio(LRF* other) const;
+
+protected:
+    BSfit2D *InitFit();
+
+protected:
+    int nint = 0;       // intervals in rho
+    int nintz = 0;      // intervals in z
+    Bspline2d *bsr = 0; 	// spline describing the response in (rho, z)
+    BSfit2D *bsfit = 0;     // object used in fitting
+    std::string json_err;
+};
+
+#endif // LRFAXIAL3D_H
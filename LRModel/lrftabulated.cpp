@@ -0,0 +1,212 @@
+#include "lrftabulated.h"
+#include "lrfaxial.h"
+#include <cmath>
+
+// largest table made by the refinement of the step
+static const size_t MaxTableSize = 1 << 22;    // doubles
+
+TabulatedLRF::TabulatedLRF(const LRF &src, double step, double tolerance, Grid grid)
+{
+    this->src = src.clone();
+    const LRFaxial *axial = dynamic_cast <const LRFaxial*> (&src);
+    if (grid == Auto || (grid == Radial && !axial))
+        grid = axial ? Radial : XY;
+    this->grid = grid;
+    step0 = step > 0. ? step : 1.;
+    this->tolerance = tolerance;
+    if (axial) {
+        x0 = axial->x0;
+        y0 = axial->y0;
+    }
+    sample();
+}
+
+TabulatedLRF::~TabulatedLRF()
+{
+    delete src;
+}
+
+TabulatedLRF* TabulatedLRF::clone() const
+{
+    TabulatedLRF *copy = new TabulatedLRF(*this);
+    copy->src = src->clone();
+    return copy;
+}
+
+// ============== Sampling ===============
+
+void TabulatedLRF::sample()
+{
+    step = step0;
+    while (true) {
+        if (grid == Radial) {
+            sampleRadial(step);
+            maxerr = checkRadial();
+        } else {
+            sampleXY(step);
+            maxerr = checkXY();
+        }
+        size_t next = grid == Radial ? poly.size()*2 : node.size()*4;
+        if (isAccurate() || next > MaxTableSize)
+            break;
+        step *= 0.5;
+    }
+    xmin = src->getXmin();
+    xmax = src->getXmax();
+    ymin = src->getYmin();
+    ymax = src->getYmax();
+// a table of an unfitted source (or one whose last fit failed) is not valid either
+    valid = src->isValid();
+}
+
+void TabulatedLRF::sampleRadial(double step)
+{
+    rmax = src->getRmax();
+    nint = std::max(1, (int)ceil(rmax/step));
+    rscale = nint/rmax;
+    double h = rmax/nint;
+
+// value and slope (per interval) at the nodes, sampled along +x from the origin;
+// the last node is taken just inside rmax, where the source can already be out of range
+    std::vector <double> f(nint+1), d(nint+1);
+    double grad[3];
+    fmax = 0.;
+    for (int i=0; i<=nint; i++) {
+        double r = i < nint ? i*h : rmax*(1. - 1e-12);
+        f[i] = src->evalGrad(x0 + r, y0, 0., grad);
+        d[i] = grad[0]*h;
+        fmax = std::max(fmax, fabs(f[i]));
+    }
+// the slope at the origin from a sample close to it
+    double eps = h*1e-4;
+    d[0] = (src->eval(x0 + eps, y0) - f[0])/eps*h;
+
+    poly.resize(nint*4);
+    for (int i=0; i<nint; i++) {
+        double *p = &poly[i*4];
+        p[0] = f[i];
+        p[1] = d[i];
+        p[2] = 3.*(f[i+1] - f[i]) - 2.*d[i] - d[i+1];
+        p[3] = 2.*(f[i] - f[i+1]) + d[i] + d[i+1];
+    }
+    node.clear();
+}
+
+void TabulatedLRF::sampleXY(double step)
+{
+    double x1 = src->getXmin(), x2 = src->getXmax();
+    double y1 = src->getYmin(), y2 = src->getYmax();
+    nx = std::max(1, (int)ceil((x2 - x1)/step));
+    ny = std::max(1, (int)ceil((y2 - y1)/step));
+    gx0 = x1;
+    gy0 = y1;
+    hx = x2 > x1 ? (x2 - x1)/nx : step;
+    hy = y2 > y1 ? (y2 - y1)/ny : step;
+
+// the cross derivative by central differences of df/dx
+    double h = 1e-3*hy;
+    double grad[3], gp[3], gm[3];
+    node.resize((size_t)(nx+1)*(ny+1)*4);
+    fmax = 0.;
+    for (int j=0; j<=ny; j++)
+        for (int i=0; i<=nx; i++) {
+            double x = gx0 + i*hx, y = gy0 + j*hy;
+            double *q = &node[(j*(nx+1) + i)*4];
+            q[0] = src->evalGrad(x, y, 0., grad);
+            q[1] = grad[0]*hx;
+            q[2] = grad[1]*hy;
+            src->evalGrad(x, y + h, 0., gp);
+            src->evalGrad(x, y - h, 0., gm);
+            q[3] = (gp[0] - gm[0])/(2.*h)*hx*hy;
+            fmax = std::max(fmax, fabs(q[0]));
+    }
+    poly.clear();
+}
+
+// ============== Accuracy ===============
+
+// largest deviation from the source at 3 points inside each interval
+double TabulatedLRF::checkRadial() const
+{
+    double err = 0.;
+    double h = rmax/nint;
+    for (int i=0; i<nint; i++)
+        for (double t : {0.25, 0.5, 0.75}) {
+            double x = x0 + (i + t)*h;
+            err = std::max(err, fabs(evalLocal(x, y0) - src->eval(x, y0)));
+    }
+    return err;
+}
+
+// largest deviation from the source at the center and the edge midpoints of each cell,
+// cells crossing the border of the domain are skipped (the source can be discontinuous there)
+double TabulatedLRF::checkXY() const
+{
+    double err = 0.;
+    for (int j=0; j<ny; j++)
+        for (int i=0; i<nx; i++) {
+            double x = gx0 + i*hx, y = gy0 + j*hy;
+            if (!src->inDomain(x, y) || !src->inDomain(x + hx, y) ||
+                !src->inDomain(x, y + hy) || !src->inDomain(x + hx, y + hy))
+                continue;
+            double pts[3][2] = {{x + 0.5*hx, y + 0.5*hy}, {x + 0.5*hx, y}, {x, y + 0.5*hy}};
+            for (auto &p : pts)
+                err = std::max(err, fabs(evalLocal(p[0], p[1]) - src->eval(p[0], p[1])));
+    }
+    return err;
+}
+
+// ============== Evaluation ===============
+
+double TabulatedLRF::eval(double x, double y, double /*z*/) const
+{
+    return evalLocal(x, y);
+}
+
+double TabulatedLRF::evalDrvX(double x, double y, double /*z*/) const
+{
+    double gx, gy;
+    evalLocalGrad(x, y, &gx, &gy);
+    return gx;
+}
+
+double TabulatedLRF::evalDrvY(double x, double y, double /*z*/) const
+{
+    double gx, gy;
+    evalLocalGrad(x, y, &gx, &gy);
+    return gy;
+}
+
+double TabulatedLRF::evalGrad(double x, double y, double /*z*/, double *grad) const
+{
+    grad[2] = 0.;
+    return evalLocalGrad(x, y, &grad[0], &grad[1]);
+}
+
+// ============== Fitting ===============
+
+bool TabulatedLRF::fitData(const std::vector <LRFdata> &data)
+{
+    bool ok = src->fitData(data);
+    sample();
+    return ok;
+}
+
+bool TabulatedLRF::doFit()
+{
+    bool ok = src->doFit();
+    sample();
+    return ok;
+}
+
+bool TabulatedLRF::mergeData(const LRF *other)
+{
+    const TabulatedLRF *tab = dynamic_cast <const TabulatedLRF*> (other);
+    return src->mergeData(tab ? tab->src : other);
+}
+
+double TabulatedLRF::GetRatio(LRF* other) const
+{
+    TabulatedLRF *tab = dynamic_cast <TabulatedLRF*> (other);
+    return src->GetRatio(tab ? tab->src : other);
+}
@@ -0,0 +1,175 @@
+#ifndef LRFTABULATED_H
+#define LRFTABULATED_H
+
+#include "lrf.h"
+#include <algorithm>
+#include <cmath>
+
+// Cache of another LRF sampled on a uniform grid and evaluated by cubic Hermite interpolation,
+// with no compression, spline interval search or transcendental functions:
+//   Radial - LRFaxial only: grid in the distance r from the origin (one sqrt per lookup). The value
+//            and df/dr are sampled at the nodes and turned into a cubic polynomial per interval.
+//   XY     - any LRF: grid over its x and y range with f, df/dx, df/dy and d2f/dxdy at the nodes,
+//            bicubic Hermite interpolation inside the cells (no sqrt).
+// With tolerance > 0 the step is halved until the largest deviation from the source, checked
+// between the nodes inside its domain, is within tolerance*max|f| or the table gets too large.
+// The source LRF is kept: fitting and I/O are passed to it and the table is resampled after a fit.
+class TabulatedLRF : public LRF
+{
+public:
+    enum Grid {
+        Auto,       // Radial for LRFaxial, XY otherwise
+        Radial,
+        XY
+    };
+
+public:
+    TabulatedLRF(const LRF &src, double step, double tolerance = 0., Grid grid = Auto);
+    ~TabulatedLRF();
+
+    virtual TabulatedLRF* clone() const;
+
+    virtual bool inDomain(double x, double y, double z=0.) const {return src->inDomain(x, y, z);}
+    virtual double getRmax() const {return src->getRmax();}
+    virtual double eval(double x, double y, double z=0.) const;
+    virtual double evalDrvX(double x, double y, double z=0.) const;
+    virtual double evalDrvY(double x, double y, double z=0.) const;
+    virtual double evalGrad(double x, double y, double z, double *grad) const;
+
+    virtual bool fitData(const std::vector <LRFdata> &data);
+    virtual void addData(const std::vector <LRFdata> &data) {src->addData(data);}
+    virtual void addPoint(double x, double y, double z, double val) {src->addPoint(x, y, z, val);}
+    virtual bool doFit();
+    virtual void clearData() {src->clearData();}
+    virtual bool mergeData(const LRF *other);
+
+    virtual std::string type() const { return std::string("Tabulated"); }
+    virtual void ToJsonObject(Json_object &json) const {src->ToJsonObject(json);}
+    virtual bool ToBinary(LRBinLRF &rec, std::vector <double> &blob) const {return src->ToBinary(rec, blob);}
+    virtual double GetRatio(LRF* other) const;
+
+    const LRF *getSource() const {return src;}
+    Grid getGrid() const {return grid;}
+    double getStep() const {return step;}
+    double getMaxError() const {return maxerr;}     // absolute
+    double getMaxValue() const {return fmax;}
+    bool isAccurate() const {return tolerance <= 0. || maxerr <= tolerance*fmax;}
+    size_t getMemory() const {return (poly.size() + node.size())*sizeof(double);}
+
+// same as eval() and evalGrad() without the virtual call, (x, y) in the frame of the LRF
+    double evalLocal(double x, double y) const;
+    double evalLocalGrad(double x, double y, double *gx, double *gy) const;
+
+protected:
+    void sample();
+    void sampleRadial(double step);
+    void sampleXY(double step);
+    double checkRadial() const;
+    double checkXY() const;
+
+protected:
+    LRF *src;
+    Grid grid;
+    double step0;           // requested step
+    double step;            // step used
+    double tolerance;
+    double maxerr = 0.;
+    double fmax = 0.;
+// Radial
+    double x0 = 0., y0 = 0.;    // origin
+    double rmax = 0.;
+    double rscale = 1.;         // nint/rmax
+    int nint = 0;
+    std::vector <double> poly;  // 4 polynomial coefficients per interval
+// XY
+    double gx0 = 0., gy0 = 0.;  // first node
+    double hx = 1., hy = 1.;    // cell size
+    int nx = 0, ny = 0;         // cells
+    std::vector <double> node;  // f, fx*hx, fy*hy, fxy*hx*hy per node, nx+1 nodes per row
+};
+
+// ============== Lookup ===============
+
+inline double TabulatedLRF::evalLocal(double x, double y) const
+{
+    if (grid == Radial) {
+        double xi = sqrt((x-x0)*(x-x0) + (y-y0)*(y-y0))*rscale;
+        if (!(xi <= nint))
+            return 0.;
+        int i = std::min((int)xi, nint-1);
+        double t = xi - i;
+        const double *p = &poly[i*4];
+        return p[0] + t*(p[1] + t*(p[2] + t*p[3]));
+    }
+
+    double xi = (x-gx0)/hx, yi = (y-gy0)/hy;
+    if (!(xi >= 0. && xi <= nx && yi >= 0. && yi <= ny))
+        return 0.;
+    int i = std::min((int)xi, nx-1), j = std::min((int)yi, ny-1);
+    double tx = xi - i, ty = yi - j;
+// Hermite basis: value at 0, slope at 0, value at 1, slope at 1
+    double bx[4] = {(1.+2.*tx)*(1.-tx)*(1.-tx), tx*(1.-tx)*(1.-tx), tx*tx*(3.-2.*tx), tx*tx*(tx-1.)};
+    double by[4] = {(1.+2.*ty)*(1.-ty)*(1.-ty), ty*(1.-ty)*(1.-ty), ty*ty*(3.-2.*ty), ty*ty*(ty-1.)};
+    const double *n00 = &node[(j*(nx+1) + i)*4];
+    const double *n10 = n00 + 4;
+    const double *n01 = n00 + (nx+1)*4;
+    const double *n11 = n01 + 4;
+    double f0 = bx[0]*(by[0]*n00[0] + by[1]*n00[2]) + bx[1]*(by[0]*n00[1] + by[1]*n00[3])
+              + bx[2]*(by[0]*n10[0] + by[1]*n10[2]) + bx[3]*(by[0]*n10[1] + by[1]*n10[3]);
+    double f1 = bx[0]*(by[2]*n01[0] + by[3]*n01[2]) + bx[1]*(by[2]*n01[1] + by[3]*n01[3])
+              + bx[2]*(by[2]*n11[0] + by[3]*n11[2]) + bx[3]*(by[2]*n11[1] + by[3]*n11[3]);
+    return f0 + f1;
+}
+
+inline double TabulatedLRF::evalLocalGrad(double x, double y, double *gx, double *gy) const
+{
+    *gx = *gy = 0.;
+    if (grid == Radial) {
+        double dx = x-x0, dy = y-y0;
+        double r = sqrt(dx*dx + dy*dy);
+        double xi = r*rscale;
+        if (!(xi <= nint))
+            return 0.;
+        int i = std::min((int)xi, nint-1);
+        double t = xi - i;
+        const double *p = &poly[i*4];
+    // gradient direction is undefined at the origin
+        if (r > 0.) {
+            double drv = (p[1] + t*(2.*p[2] + t*3.*p[3]))*rscale/r;
+            *gx = drv*dx;
+            *gy = drv*dy;
+        }
+        return p[0] + t*(p[1] + t*(p[2] + t*p[3]));
+    }
+
+    double xi = (x-gx0)/hx, yi = (y-gy0)/hy;
+    if (!(xi >= 0. && xi <= nx && yi >= 0. && yi <= ny))
+        return 0.;
+    int i = std::min((int)xi, nx-1), j = std::min((int)yi, ny-1);
+    double tx = xi - i, ty = yi - j;
+    double bx[4] = {(1.+2.*tx)*(1.-tx)*(1.-tx), tx*(1.-tx)*(1.-tx), tx*tx*(3.-2.*tx), tx*tx*(tx-1.)};
+    double by[4] = {(1.+2.*ty)*(1.-ty)*(1.-ty), ty*(1.-ty)*(1.-ty), ty*ty*(3.-2.*ty), ty*ty*(ty-1.)};
+// derivatives of the basis, per unit cell
+    double dx[4] = {6.*tx*(tx-1.), (1.-tx)*(1.-3.*tx), 6.*tx*(1.-tx), tx*(3.*tx-2.)};
+    double dy[4] = {6.*ty*(ty-1.), (1.-ty)*(1.-3.*ty), 6.*ty*(1.-ty), ty*(3.*ty-2.)};
+    const double *n[4] = {&node[(j*(nx+1) + i)*4], nullptr, nullptr, nullptr};
+    n[1] = n[0] + 4;            // (i+1, j)
+    n[2] = n[0] + (nx+1)*4;     // (i, j+1)
+    n[3] = n[2] + 4;            // (i+1, j+1)
+    double f = 0., fx = 0., fy = 0.;
+    for (int c=0; c<4; c++) {
+        int a = (c&1)*2, b = (c>>1)*2;  // basis index of the corner: 0 or 2
+        const double *q = n[c];
+    // along y: value and x-slope of the corner contribution
+        double vy = by[b]*q[0] + by[b+1]*q[2], sy = by[b]*q[1] + by[b+1]*q[3];
+        double dvy = dy[b]*q[0] + dy[b+1]*q[2], dsy = dy[b]*q[1] + dy[b+1]*q[3];
+        f += bx[a]*vy + bx[a+1]*sy;
+        fx += dx[a]*vy + dx[a+1]*sy;
+        fy += bx[a]*dvy + bx[a+1]*dsy;
+    }
+    *gx = fx/hx;
+    *gy = fy/hy;
+    return f;
+}
+
+#endif // LRFTABULATED_H
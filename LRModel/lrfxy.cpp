@@ -0,0 +1,203 @@
+#include "lrfxy.h"
+#include "bspline123d.h"
+#include "bsfit123.h"
+#include "json11.hpp"
+#include <cmath>
+
+LRFxy::LRFxy(double xmin, double xmax, int nintx, double ymin, double ymax, int ninty)
+{
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->nintx = nintx;
+    this->ninty = ninty;
+    zmin = zmax = 0.;
+    bsr = new Bspline2d(xmin, xmax, nintx, ymin, ymax, ninty);
+}
+
+LRFxy* LRFxy::clone() const
+{
+    LRFxy *copy = new LRFxy(*this);
+    copy->bsr = bsr ? new Bspline2d(*bsr) : nullptr;
+    copy->bsfit = bsfit ? bsfit->clone() : nullptr;
+    return copy;
+}
+
+LRFxy::LRFxy(const Json &json)
+{
+    if (!json["response"]["bspline3"].is_object())
+        return;
+    bsr = new Bspline2d(json["response"]["bspline3"]);
+    if (bsr->isInvalid())
+        return;
+
+    xmin = bsr->GetXmin();
+    xmax = bsr->GetXmax();
+    ymin = bsr->GetYmin();
+    ymax = bsr->GetYmax();
+    zmin = zmax = 0.;
+    nintx = bsr->GetNintX();
+    ninty = bsr->GetNintY();
+    valid = true;
+}
+
+LRFxy::LRFxy(std::string &json_str) : LRFxy(Json::parse(json_str, json_err)) {}
+
+LRFxy::~LRFxy()
+{
+    delete bsr;
+    delete bsfit;
+}
+
+bool LRFxy::isReady() const
+{
+    return (bsr != 0) && bsr->IsReady();
+}
+
+bool LRFxy::inDomain(double x, double y, double /*z*/) const
+{
+    return x >= xmin && x <= xmax && y >= ymin && y <= ymax;
+}
+
+double LRFxy::getRmax() const
+{
+    return 0.5*hypot(xmax-xmin, ymax-ymin);
+}
+
+double LRFxy::eval(double x, double y, double /*z*/) const
+{
+    return isReady() ? bsr->Eval(x, y) : 0.;
+}
+
+double LRFxy::evalDrvX(double x, double y, double /*z*/) const
+{
+    return isReady() ? bsr->EvalDrvX(x, y) : 0.;
+}
+
+double LRFxy::evalDrvY(double x, double y, double /*z*/) const
+{
+    return isReady() ? bsr->EvalDrvY(x, y) : 0.;
+}
+
+// one Locate for the value and both derivatives
+double LRFxy::evalGrad(double x, double y, double /*z*/, double *grad) const
+{
+    grad[0] = grad[1] = grad[2] = 0.;
+    if (!isReady())
+        return 0.;
+    return bsr->EvalWithDrv(x, y, &grad[0], &grad[1]);
+}
+
+BSfit2D *LRFxy::InitFit()
+{
+    if (!non_negative && !top_down)
+        return new BSfit2D(bsr);
+
+    ConstrainedFit2D *cf = new ConstrainedFit2D(bsr);
+    if (non_negative) cf->ForceNonNegative();
+    if (top_down) cf->ForceTopDown(x0, y0);
+    return cf;
+}
+
+bool LRFxy::fitData(const std::vector <LRFdata> &data)
+{
+    BSfit2D *F = InitFit();
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1]))
+            continue;
+        F->AddData(d[0], d[1], d[3]);
+    }
+
+    bool status = F->BinnedFit();
+
+    if (status) {
+        delete bsr;
+        bsr = F->MakeSpline();
+    }
+
+    delete F;
+    valid = status;
+    return status;
+}
+
+void LRFxy::addData(const std::vector <LRFdata> &data)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    for (auto d : data) {
+        if (!inDomain(d[0], d[1]))
+            continue;
+        bsfit->AddData(d[0], d[1], d[3]);
+    }
+}
+
+void LRFxy::addPoint(double x, double y, double /*z*/, double val)
+{
+    if (!bsfit)
+        bsfit = InitFit();
+
+    if (inDomain(x, y))
+        bsfit->AddData(x, y, val);
+}
+
+bool LRFxy::doFit()
+{
+    if (!bsfit)
+        return false;
+
+    if (bsfit->BinnedFit()) {
+        delete bsr;
+        bsr = bsfit->MakeSpline();
+        valid = true;
+        return true;
+    } else {
+        valid = false;
+        return false;
+    }
+}
+
+void LRFxy::clearData()
+{
+    delete bsfit;
+    bsfit = 0;
+}
+
+bool LRFxy::mergeData(const LRF *other_base)
+{
+    const LRFxy *other = dynamic_cast<const LRFxy*>(other_base);
+    if (!other)
+        return false;
+    if (!other->bsfit)
+        return true;    // nothing to add
+    if (!bsfit)
+        bsfit = InitFit();
+
+    return bsfit->MergeData(*other->bsfit);
+}
+
+double LRFxy::GetRatio(LRF* other_base) const
+{
+    LRFxy *other = dynamic_cast<LRFxy*>(other_base);
+    if (!bsfit || !other || !other->bsfit)
+        return -1;
+
+    return histRatio(bsfit->GetHist(), other->bsfit->GetHist());
+}
+
+const Bspline2d *LRFxy::getSpline() const
+{
+    return bsr;
+}
+
+// the rectangle and the intervals are stored with the spline
+void LRFxy::ToJsonObject(Json_object &json) const
+{
+    json["type"] = std::string(type());
+    if (bsr) {
+        Json_object json1;
+        json1["bspline3"] = bsr->GetJsonObject();
+        json["response"] = json1;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef LRFXY_H
+#define LRFXY_H
+
+#include "lrf.h"
+
+class Bspline2d;
+class BSfit2D;
+
+// LRF of arbitrary shape: cubic tensor-product B-spline over the rectangle
+// [xmin, xmax] x [ymin, ymax] in the frame of the LRF, for sensors with no axial symmetry
+// (edge sensors, light guides). The fit data is always binned (2D profile histogram).
+class LRFxy : public LRF
+{
+public:
+    LRFxy(double xmin, double xmax, int nintx, double ymin, double ymax, int ninty);
+    LRFxy(const Json &json);
+    LRFxy(std::string &json_str);
+    ~LRFxy();
+
+    virtual LRFxy* clone() const;
+
+    virtual bool inDomain(double x, double y, double z=0.) const;
+    virtual bool isReady () const;
+// half diagonal of the rectangle
+    virtual double getRmax() const;
+    int getNintX() const { return nintx; }
+    int getNintY() const { return ninty; }
+    virtual double eval(double x, double y, double z=0.) const;
+    virtual double evalDrvX(double x, double y, double z=0.) const;
+    virtual double evalDrvY(double x, double y, double z=0.) const;
+    virtual double evalGrad(double x, double y, double z, double *grad) const;
+
+    virtual bool fitData(const std::vector <LRFdata> &data);
+    virtual void addData(const std::vector <LRFdata> &data);
+    virtual void addPoint(double x, double y, double z, double val);
+    virtual bool doFit();
+    virtual void clearData();
+    virtual bool mergeData(const LRF *other);
+
+    const Bspline2d *getSpline() const;
+    virtual std::string type() const { return std::string("XY"); }
+    virtual void ToJsonObject(Json_object &json) const;
+
+// maximum at (x0, y0), decreasing from there in every direction
+    void SetTopDown(double x0, double y0) {top_down = true; this->x0 = x0; this->y0 = y0;}
+
+    double GetRatio(LRF* other) const;
+
+protected:
+    BSfit2D *InitFit();
+
+protected:
+    int nintx = 0, ninty = 0;   // intervals
+    bool top_down = false;
+    double x0 = 0., y0 = 0.;    // top for top_down
+    Bspline2d *bsr = 0;     // spline describing the response
+    BSfit2D *bsfit = 0;     // object used in fitting
+    std::string json_err;
+};
+
+#endif // LRFXY_H
@@ -4,7 +4,14 @@
 #include "transform.h"
 #include "profileHist.h"
 #include <cmath>
+#include <cstring>
+#include <fstream>
 #include "json11.hpp"
+#include "lrbinary.h"
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
 //#include <complex>
 
 double LRSensor::GetRadius() const
@@ -98,13 +105,27 @@ int LRModel::CreateGroup()
 
 bool LRModel::DissolveGroup(int gid)
 {
+    if (!GroupExists(gid))
+        return false;
+
     std::set <int> members = GroupMembers(gid);
+    if (members.empty())
+        eraseGroup(gid);
     for (int i : members)
-        RemoveFromGroup(i);
+        RemoveFromGroup(i); // the group is erased together with its last member
+    return true;
+}
 
+// group ids must coincide with vector elements: renumber the groups after gid
+void LRModel::eraseGroup(int gid)
+{
     delete Group.at(gid).glrf;
     Group.erase(Group.begin()+gid);
-    return true;
+    for (int i=gid; i<(int)Group.size(); i++)
+        Group[i].id = i;
+    for (LRSensor &s : Sensor)
+        if (s.group_id > gid)
+            s.group_id--;
 }
 
 bool LRModel::AddToGroup(int id, int gid, Transform *tr)
@@ -130,20 +151,18 @@ bool LRModel::RemoveFromGroup(int id, UngroupPolicy policy)
     delete Sensor.at(id).lrf;
     switch (policy) {
         case KeepLRF:
-            Sensor.at(id).lrf = Group.at(gid).glrf->clone();
+            Sensor.at(id).lrf = Group.at(gid).glrf ? Group.at(gid).glrf->clone() : 0;
             break;
         case ResetLRF:
-            Sensor.at(id).lrf = DefaultLRF->clone();
+            Sensor.at(id).lrf = DefaultLRF ? DefaultLRF->clone() : 0;
             SetTransform(id, 0);
             SetGain(id, 1.0);
             break;
     }
 
     GroupMembers(gid).erase(id);
-    if (GroupMembers(gid).size() == 0) {
-        delete Group.at(gid).glrf;
-        Group.erase(Group.begin()+gid);
-    }
+    if (GroupMembers(gid).size() == 0)
+        eraseGroup(gid);
     return true;
 }
 
@@ -198,22 +217,34 @@ double LRModel::Eval(int id, double *pos_world)
 
 double LRModel::EvalDrvX(int id, double *pos_world)
 {
-    double x = pos_world[0];
-    double y = pos_world[1];
-    double z = pos_world[2];
-    if (GetTransform(id))
-        GetTransform(id)->DoTransform(&x, &y, &z);
-    return GetLRF(id)->evalDrvX(x, y, z)*GetGain(id);
+    double grad[3];
+    EvalGrad(id, pos_world, grad);
+    return grad[0];
 }
 
 double LRModel::EvalDrvY(int id, double *pos_world)
+{
+    double grad[3];
+    EvalGrad(id, pos_world, grad);
+    return grad[1];
+}
+
+// value and gradient in world coordinates
+double LRModel::EvalGrad(int id, double *pos_world, double *grad_world)
 {
     double x = pos_world[0];
     double y = pos_world[1];
     double z = pos_world[2];
-    if (GetTransform(id))
-        GetTransform(id)->DoTransform(&x, &y, &z);
-    return GetLRF(id)->evalDrvY(x, y, z)*GetGain(id);
+    Transform *tr = GetTransform(id);
+    if (tr)
+        tr->DoTransform(&x, &y, &z);
+    double gain = GetGain(id);
+    double val = GetLRF(id)->evalGrad(x, y, z, grad_world)*gain;
+    if (tr)
+        tr->DoGradTransform(&grad_world[0], &grad_world[1], &grad_world[2]);
+    for (int i=0; i<3; i++)
+        grad_world[i] *= gain;
+    return val;
 }
 
 bool LRModel::FitNotBinnedData(int id, const std::vector <LRFdata> &data)
@@ -250,6 +281,74 @@ void LRModel::AddFitData(int id, const std::vector <LRFdata> &data)
         GetLRF(id)->addData(trdata);
 }
 
+std::vector <LRF*> LRModel::fitTargets()
+{
+    std::vector <LRF*> target(Sensor.size(), nullptr);
+    for (int id=0; id<(int)Sensor.size(); id++) {
+        int gid = Sensor[id].group_id;
+        target[id] = gid >= 0 ? Group[gid].glrf : Sensor[id].lrf;
+    }
+    return target;
+}
+
+static const int FloodBlock = 256;  // events per block in AddFloodEvents() and FitAll()
+
+// Flood data are taken in blocks of events small enough to stay in cache; within a block
+// the loop runs over sensors, so each sensor's transform and LRF serve many points in a row.
+// The position is transformed once per sensor and goes straight into the fit histograms.
+void LRModel::addFloodPoints(LRF *lrf, int id, int n, const double *const *signal,
+                             const double *x, const double *y, const double *z)
+{
+    Transform *tr = Sensor[id].tr;
+    double gain = Sensor[id].gain;
+    for (int i=0; i<n; i++) {
+// separate scalars: reading back a pos[3] array written by DoTransform() gets vectorized
+// into a 16-byte load which stalls on store forwarding
+        double px = x[i], py = y[i], pz = z ? z[i] : 0.;
+        if (tr)
+            tr->DoTransform(&px, &py, &pz);
+        lrf->addPoint(px, py, pz, signal[i][id] / gain);
+    }
+}
+
+void LRModel::AddFloodEvents(const std::vector <std::vector <double> > &events,
+                             const std::vector <std::array <double, 2> > &truth_xy)
+{
+    std::vector <LRF*> target = fitTargets();
+    int nevents = std::min(events.size(), truth_xy.size());
+    const double *signal[FloodBlock];
+    double x[FloodBlock], y[FloodBlock];
+
+    for (int ev=0; ev<nevents; ) {
+        int n = 0;
+        for (; ev<nevents && n<FloodBlock; ev++) {
+            if (events[ev].size() < Sensor.size())    // short event: skipped
+                continue;
+            signal[n] = events[ev].data();
+            x[n] = truth_xy[ev][0];
+            y[n++] = truth_xy[ev][1];
+        }
+        for (int id=0; id<(int)Sensor.size(); id++)
+            if (target[id])
+                addFloodPoints(target[id], id, n, signal, x, y, nullptr);
+    }
+}
+
+void LRModel::AddFloodEvents(int nevents, const double *signals, int evt_stride, const double *x, const double *y)
+{
+    std::vector <LRF*> target = fitTargets();
+    const double *signal[FloodBlock];
+
+    for (int first=0; first<nevents; first+=FloodBlock) {
+        int n = std::min(FloodBlock, nevents-first);
+        for (int i=0; i<n; i++)
+            signal[i] = signals + (size_t)(first+i)*evt_stride;
+        for (int id=0; id<(int)Sensor.size(); id++)
+            if (target[id])
+                addFloodPoints(target[id], id, n, signal, x+first, y+first, nullptr);
+    }
+}
+
 bool LRModel::FitSensor(int id)
 {
     return GetLRF(id)->doFit();
@@ -262,7 +361,111 @@ bool LRModel::FitGroup(int gid)
 
 void LRModel::ClearAllFitData()
 {
+    for (LRSensor &s : Sensor)
+        if (s.lrf)
+            s.lrf->clearData();
+    for (LRGroup &g : Group)
+        if (g.glrf)
+            g.glrf->clearData();
+}
+
+// runs job(0) ... job(n-1) in nthreads threads, the calling thread included
+static void RunParallel(int n, int nthreads, const std::function<void(int)> &job)
+{
+    std::atomic <int> next(0);
+    auto work = [&]() {
+        for (int i = next++; i < n; i = next++)
+            job(i);
+    };
+
+    std::vector <std::thread> threads;
+    for (int i=1; i<nthreads && i<n; i++)
+        threads.push_back(std::thread(work));
+    work();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+bool LRModel::FitAll(const std::vector <LRFdata> &pos, const std::vector <std::vector <double> > &data, int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (nthreads <= 0)
+        nthreads = 1;
+
+// fit targets: groups and ungrouped sensors having an LRF
+    struct Target {
+        LRF *lrf;
+        std::vector <int> members;
+    };
+    std::vector <Target> targets;
+    for (LRGroup &g : Group)
+        if (g.glrf && !g.members.empty())
+            targets.push_back(Target{g.glrf, std::vector <int> (g.members.begin(), g.members.end())});
+    for (LRSensor &s : Sensor)
+        if (s.group_id < 0 && s.lrf)
+            targets.push_back(Target{s.lrf, std::vector <int> (1, s.id)});
+    if (targets.empty())
+        return false;
+
+// Members of a target are split into slices only if there are fewer targets than threads.
+// With one slice per target the histogram is filled in the same order as by AddFloodEvents(),
+// so the result is identical to the serial path; otherwise the bin sums can differ in rounding.
+    int nslices = (nthreads + targets.size() - 1) / targets.size();
+    struct Slice {
+        int target;
+        int first, last;
+        LRF *part;
+    };
+    std::vector <Slice> slices;
+    std::vector <int> first_slice;
+    for (int t=0; t<(int)targets.size(); t++) {
+        first_slice.push_back(slices.size());
+        int nm = targets[t].members.size();
+        int ns = std::min(nslices, nm);
+        for (int k=0; k<ns; k++)
+            slices.push_back(Slice{t, nm*k/ns, nm*(k+1)/ns, nullptr});
+    }
+    first_slice.push_back(slices.size());
+
+// fill thread-local histograms
+    RunParallel(slices.size(), nthreads, [&](int i) {
+        Slice &sl = slices[i];
+        const Target &tg = targets[sl.target];
+        sl.part = tg.lrf->clone();
+        sl.part->clearData();
+
+        const double *signal[FloodBlock];
+        double x[FloodBlock], y[FloodBlock], z[FloodBlock];
+        int nevents = std::min(pos.size(), data.size());
+        for (int first=0; first<nevents; first+=FloodBlock) {
+            int n = std::min(FloodBlock, nevents-first);
+            for (int j=0; j<n; j++) {
+                signal[j] = data[first+j].data();
+                x[j] = pos[first+j][0];
+                y[j] = pos[first+j][1];
+                z[j] = pos[first+j][2];
+            }
+            for (int m=sl.first; m<sl.last; m++)
+                addFloodPoints(sl.part, tg.members[m], n, signal, x, y, z);
+        }
+    });
+
+// merge per target (in slice order) and fit
+    std::vector <char> ok(targets.size());
+    RunParallel(targets.size(), nthreads, [&](int t) {
+        bool good = true;
+        for (int i=first_slice[t]; i<first_slice[t+1]; i++) {
+            good = targets[t].lrf->mergeData(slices[i].part) && good;
+            delete slices[i].part;
+        }
+        ok[t] = good && targets[t].lrf->doFit();
+    });
 
+    for (char good : ok)
+        if (!good)
+            return false;
+    return true;
 }
 
 void LRModel::MakeGroupsCommon()
@@ -393,7 +596,7 @@ Json::object LRModel::SensorGetJsonObject(int id) const
     json["y"] = s.y;
     json["gain"] = s.gain;
     if (s.tr) json["transform"] = s.tr->GetJsonObject();
-    if (s.group_id != -1 && s.lrf) json["LRF"] = s.lrf->GetJsonObject();
+    if (s.group_id == -1 && s.lrf) json["LRF"] = s.lrf->GetJsonObject();
     return json;
 }
 
@@ -409,7 +612,7 @@ void LRModel::ReadSensor(const Json &json)
     if (json["transform"].is_object())
         s.tr = Transform::Factory(json["transform"]);
     if (json["LRF"].is_object())
-        s.lrf = new LRFaxial(json["LRF"]);
+        s.lrf = LRF::Factory(json["LRF"]);
 }
 
 Json::object LRModel::GroupGetJsonObject(int gid) const
@@ -429,15 +632,16 @@ void LRModel::ReadGroup(const Json &json)
     int id = json["id"].int_value();
     LRGroup &g = Group.at(id);
     g.id = id;
-    g.x = json["x"].number_value();
-    g.y = json["y"].number_value();
+// GroupGetJsonObject() writes x0, y0; x, y are accepted for older files
+    g.x = json[json["x0"].is_number() ? "x0" : "x"].number_value();
+    g.y = json[json["y0"].is_number() ? "y0" : "y"].number_value();
     if (json["members"].is_array()) {
         Json::array members = json["members"].array_items();
         for (unsigned int i=0; i<members.size(); i++)
             g.members.insert(members[i].int_value());
     }
     if (json["LRF"].is_object())
-        g.glrf = new LRFaxial(json["LRF"]);
+        g.glrf = LRF::Factory(json["LRF"]);
 }
 
 void LRModel::ToJsonObject(Json_object &json) const
@@ -491,6 +695,123 @@ LRModel::LRModel(const Json &json)
 
 LRModel::LRModel(std::string &json_str) : LRModel(Json::parse(json_str, json_err)) {}
 
+// Binary format, see lrbinary.h
+
+bool LRModel::SaveBinary(const std::string &fname) const
+{
+    LRBinHeader h;
+    memset(&h, 0, sizeof(h));
+    std::vector <LRBinSensor> sensors(Sensor.size());
+    std::vector <LRBinGroup> groups(Group.size());
+    std::vector <int32_t> members;
+    std::vector <LRBinLRF> lrfs;
+    std::vector <double> blob;
+
+    auto addLRF = [&](const LRF *lrf) -> int {
+        LRBinLRF rec;
+        memset(&rec, 0, sizeof(rec));
+        if (!lrf->ToBinary(rec, blob))
+            return -2;
+        lrfs.push_back(rec);
+        return lrfs.size()-1;
+    };
+
+    for (size_t i=0; i<Sensor.size(); i++) {
+        const LRSensor &s = Sensor[i];
+        LRBinSensor &r = sensors[i];
+        memset(&r, 0, sizeof(r));
+        r.id = s.id;
+        r.group_id = s.group_id;
+        r.x = s.x;
+        r.y = s.y;
+        r.gain = s.gain;
+        r.m[0] = r.m[3] = 1.;
+        if (s.tr) {
+            s.tr->ToBinary(r.tr);
+            s.tr->GetAffine(r.m, r.t);
+        }
+        r.lrf = (s.group_id == -1 && s.lrf) ? addLRF(s.lrf) : -1;
+        if (r.lrf == -2)
+            return false;
+    }
+    for (size_t i=0; i<Group.size(); i++) {
+        const LRGroup &g = Group[i];
+        LRBinGroup &r = groups[i];
+        memset(&r, 0, sizeof(r));
+        r.id = g.id;
+        r.x = g.x;
+        r.y = g.y;
+        r.first_member = members.size();
+        r.n_members = g.members.size();
+        members.insert(members.end(), g.members.begin(), g.members.end());
+        r.lrf = g.glrf ? addLRF(g.glrf) : -1;
+        if (r.lrf == -2)
+            return false;
+    }
+
+    auto align8 = [](uint64_t n) {return (n+7)/8*8;};
+    strncpy(h.magic, LRBIN_MAGIC, sizeof(h.magic));
+    h.version = LRBIN_VERSION;
+    h.endian_tag = LRBIN_ENDIAN_TAG;
+    h.n_sensors = sensors.size();
+    h.n_groups = groups.size();
+    h.n_members = members.size();
+    h.n_lrfs = lrfs.size();
+    h.n_coef = blob.size();
+    h.sensor_offset = sizeof(h);
+    h.group_offset = h.sensor_offset + sensors.size()*sizeof(LRBinSensor);
+    h.member_offset = h.group_offset + groups.size()*sizeof(LRBinGroup);
+    h.lrf_offset = align8(h.member_offset + members.size()*sizeof(int32_t));
+    h.coef_offset = h.lrf_offset + lrfs.size()*sizeof(LRBinLRF);
+    h.file_size = h.coef_offset + blob.size()*sizeof(double);
+
+    std::ofstream f(fname, std::ios::binary);
+    if (!f.good())
+        return false;
+    const char zero[8] = {0};
+    f.write((const char*)&h, sizeof(h));
+    f.write((const char*)sensors.data(), sensors.size()*sizeof(LRBinSensor));
+    f.write((const char*)groups.data(), groups.size()*sizeof(LRBinGroup));
+    f.write((const char*)members.data(), members.size()*sizeof(int32_t));
+    f.write(zero, h.lrf_offset - (h.member_offset + members.size()*sizeof(int32_t)));
+    f.write((const char*)lrfs.data(), lrfs.size()*sizeof(LRBinLRF));
+    f.write((const char*)blob.data(), blob.size()*sizeof(double));
+    return f.good();
+}
+
+LRModel::LRModel(const LRModelFile &file)
+{
+    if (!file.IsValid())
+        return;
+    Sensor.resize(file.GetSensorCount());
+    Group.resize(file.GetGroupCount());
+    const double *blob = file.GetCoef();
+
+    for (int i=0; i<file.GetSensorCount(); i++) {
+        const LRBinSensor &r = file.GetSensor(i);
+        LRSensor &s = Sensor[i];
+        s.id = r.id;
+        s.group_id = r.group_id;
+        s.x = r.x;
+        s.y = r.y;
+        s.gain = r.gain;
+        s.tr = Transform::Factory(r.tr);
+        if (r.lrf >= 0)
+            s.lrf = new LRFaxial(file.GetLRF(r.lrf), blob);
+    }
+    for (int i=0; i<file.GetGroupCount(); i++) {
+        const LRBinGroup &r = file.GetGroup(i);
+        LRGroup &g = Group[i];
+        g.id = r.id;
+        g.x = r.x;
+        g.y = r.y;
+        const int32_t *m = file.GetMembers(i);
+        g.members.insert(m, m + r.n_members);
+        if (r.lrf >= 0)
+            g.glrf = new LRFaxial(file.GetLRF(r.lrf), blob);
+    }
+}
+
 // Utility
 double LRModel::GetMaxR(int id, const std::vector <LRFdata> &data) const
 {
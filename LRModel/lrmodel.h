@@ -9,6 +9,7 @@
 #include "profileHist.h"
 
 class Transform;
+class LRModelFile;
 
 class LRSensor
 {
@@ -129,15 +130,28 @@ public:
     double EvalLocal(int id, double *pos_local) { return GetLRF(id)->eval(pos_local)*GetGain(id); }
     double EvalDrvX(int id, double *pos_world);
     double EvalDrvY(int id, double *pos_world);
+    double EvalGrad(int id, double *pos_world, double *grad_world);
 
 // Fitting
     // direct (not binned)
     bool FitNotBinnedData(int id, const std::vector <LRFdata> &data);
     // binned
     void AddFitData(int id, const std::vector <LRFdata> &data);
+    // whole flood at once, one pass over the events: events[i][id] is the signal of sensor id
+    // in event i, truth_xy[i] its position. Same as AddFitData() for all sensors.
+    // Events with fewer than GetSensorCount() signals are skipped.
+    void AddFloodEvents(const std::vector <std::vector <double> > &events,
+                        const std::vector <std::array <double, 2> > &truth_xy);
+    // the same with signals of event i at signals[i*evt_stride], evt_stride >= GetSensorCount() is required
+    void AddFloodEvents(int nevents, const double *signals, int evt_stride, const double *x, const double *y);
     bool FitSensor(int id);
     bool FitGroup(int gid);
     void ClearAllFitData();
+    // all binned fits at once: pos[i] is the position of event i (pos[i][3] is not used),
+    // data[i][id] the signal of sensor id in that event. The histograms are filled and
+    // the LRFs of groups and ungrouped sensors are fitted in nthreads threads
+    // (0 => hardware concurrency). Returns false if any of the fits failed.
+    bool FitAll(const std::vector <LRFdata> &pos, const std::vector <std::vector <double> > &data, int nthreads = 0);
 
 // Save and Load
     Json_object SensorGetJsonObject(int id) const;
@@ -150,11 +164,22 @@ public:
     void ReadGroup(const Json &json);
     LRModel(const Json &json);
     LRModel(std::string &json_str);
+// binary format, see lrbinary.h; fails if some LRF type has no binary form
+    bool SaveBinary(const std::string &fname) const;
+    LRModel(const LRModelFile &file);
 
 // Utility
     double GetMaxR(int id, const std::vector <LRFdata> &data) const;
     double GetGroupMaxR(int gid, const std::vector <LRFdata> &data) const;
 
+protected:
+    void eraseGroup(int gid);
+// LRF receiving the binned fit data of each sensor (group LRF for grouped sensors), can be null
+    std::vector <LRF*> fitTargets();
+// adds n flood points to lrf for sensor id: signal[i][id] at (x[i], y[i], z[i]), z can be null
+    void addFloodPoints(LRF *lrf, int id, int n, const double *const *signal,
+                        const double *x, const double *y, const double *z);
+
 protected:
     std::vector <LRSensor> Sensor;
     std::vector <LRGroup> Group;
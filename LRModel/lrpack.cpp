@@ -0,0 +1,303 @@
+#include "lrpack.h"
+#include "lrcompiled.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LRPACK_X86
+#include <immintrin.h>
+#endif
+
+// ============== Filling ===============
+
+void LRSensorPack::Clear(const double *coef_base)
+{
+    coef = coef_base;
+    n = npad = 0;
+    for (auto *v : {&m0, &m1, &m2, &m3, &tx, &ty, &gain, &cmp, &a, &b, &r0, &lam2, &xl, &xr, &scale, &nint})
+        v->clear();
+    poly.clear();
+}
+
+void LRSensorPack::Add(const CompiledSensor &s)
+{
+// grow by 8 dummy sensors: zero range, so the response is always 0
+    if (n == npad) {
+        npad += 8;
+        for (auto *v : {&m0, &m1, &m2, &m3, &tx, &ty, &gain, &cmp, &a, &b, &r0, &xl, &scale, &nint})
+            v->resize(npad, 0.);
+        lam2.resize(npad, 1.);
+        xr.resize(npad, -1.);
+        poly.resize(npad, 0);
+    }
+
+    if (s.kind == CompiledSensor::Axial) {
+        m0[n] = s.m[0]; m1[n] = s.m[1];
+        m2[n] = s.m[2]; m3[n] = s.m[3];
+        tx[n] = s.t[0] - s.x0;
+        ty[n] = s.t[1] - s.y0;
+        gain[n] = s.gain;
+        if (s.compress) {
+            cmp[n] = 1.;
+            a[n] = s.a;
+            b[n] = s.b;
+            r0[n] = s.r0;
+            lam2[n] = s.lam2;
+        }
+        xl[n] = s.xl;
+        xr[n] = s.xr;
+        scale[n] = s.scale;
+        nint[n] = s.nint;
+        poly[n] = s.poly - coef;
+    }
+    n++;
+}
+
+// ============== Kernels ===============
+// All kernels follow CompiledLRModel::evalAxialGrad() lane by lane
+
+static void EvalScalar(const LRSensorPack::Arrays &p, int first, int last, double x, double y,
+                       double *val, double *gx, double *gy)
+{
+    for (int i=first; i<last; i++) {
+        double lx = p.m0[i]*x + p.m1[i]*y + p.tx[i];
+        double ly = p.m2[i]*x + p.m3[i]*y + p.ty[i];
+        double r = sqrt(lx*lx + ly*ly);
+        double rho = r, drho = 1.;
+        if (p.cmp[i] != 0.) {
+            double dr = r - p.r0[i];
+            double sq = sqrt(dr*dr + p.lam2[i]);
+            rho = std::max(0., p.b[i] + dr*p.a[i] - sq);
+            drho = p.a[i] - dr/sq;
+        }
+
+        int ix;
+        double xf;
+        double xi = (rho - p.xl[i])*p.scale[i];
+        if (rho == p.xr[i]) {
+            ix = p.nint[i] - 1;
+            xf = 1.;
+        } else if (xi >= 0. && xi < p.nint[i]) {
+            ix = (int)xi;
+            xf = xi - ix;
+        } else {
+            val[i] = 0.;
+            if (gx)
+                gx[i] = gy[i] = 0.;
+            continue;
+        }
+
+        const double *c = p.coef + p.poly[i] + ix*4;
+        val[i] = (c[0] + xf*(c[1] + xf*(c[2] + xf*c[3])))*p.gain[i];
+        if (!gx)
+            continue;
+        double drv = r > 0. ? (c[1] + xf*(2.*c[2] + xf*3.*c[3]))*p.scale[i]*drho/r*p.gain[i] : 0.;
+        double glx = drv*lx, gly = drv*ly;
+        gx[i] = p.m0[i]*glx + p.m2[i]*gly;
+        gy[i] = p.m1[i]*glx + p.m3[i]*gly;
+    }
+}
+
+#ifdef LRPACK_X86
+
+__attribute__((target("avx2,fma")))
+static void EvalAVX2(const LRSensorPack::Arrays &p, int first, int last, double x, double y,
+                     double *val, double *gx, double *gy)
+{
+    const __m256d vx = _mm256_set1_pd(x);
+    const __m256d vy = _mm256_set1_pd(y);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.);
+    const __m256d two = _mm256_set1_pd(2.);
+    const __m256d three = _mm256_set1_pd(3.);
+
+    for (int i=first; i<last; i+=4) {
+        __m256d m0 = _mm256_loadu_pd(p.m0+i), m1 = _mm256_loadu_pd(p.m1+i);
+        __m256d m2 = _mm256_loadu_pd(p.m2+i), m3 = _mm256_loadu_pd(p.m3+i);
+        __m256d lx = _mm256_fmadd_pd(m0, vx, _mm256_fmadd_pd(m1, vy, _mm256_loadu_pd(p.tx+i)));
+        __m256d ly = _mm256_fmadd_pd(m2, vx, _mm256_fmadd_pd(m3, vy, _mm256_loadu_pd(p.ty+i)));
+        __m256d r = _mm256_sqrt_pd(_mm256_fmadd_pd(lx, lx, _mm256_mul_pd(ly, ly)));
+
+    // dual slope compression, blended in where cmp != 0
+        __m256d va = _mm256_loadu_pd(p.a+i);
+        __m256d dr = _mm256_sub_pd(r, _mm256_loadu_pd(p.r0+i));
+        __m256d sq = _mm256_sqrt_pd(_mm256_fmadd_pd(dr, dr, _mm256_loadu_pd(p.lam2+i)));
+        __m256d rhoc = _mm256_max_pd(zero, _mm256_sub_pd(_mm256_fmadd_pd(dr, va, _mm256_loadu_pd(p.b+i)), sq));
+        __m256d cmask = _mm256_cmp_pd(_mm256_loadu_pd(p.cmp+i), zero, _CMP_NEQ_OQ);
+        __m256d rho = _mm256_blendv_pd(r, rhoc, cmask);
+
+    // interval location
+        __m256d vnint = _mm256_loadu_pd(p.nint+i);
+        __m256d xi = _mm256_mul_pd(_mm256_sub_pd(rho, _mm256_loadu_pd(p.xl+i)), _mm256_loadu_pd(p.scale+i));
+        __m256d edge = _mm256_cmp_pd(rho, _mm256_loadu_pd(p.xr+i), _CMP_EQ_OQ);
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(xi, zero, _CMP_GE_OQ), _mm256_cmp_pd(xi, vnint, _CMP_LT_OQ));
+        __m256d valid = _mm256_or_pd(inside, edge);
+        xi = _mm256_blendv_pd(xi, vnint, edge);
+        xi = _mm256_and_pd(xi, valid);
+        __m256d fix = _mm256_min_pd(_mm256_round_pd(xi, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), _mm256_sub_pd(vnint, one));
+        __m256d xf = _mm256_sub_pd(xi, fix);
+
+        __m128i idx = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(p.poly+i)), _mm_slli_epi32(_mm256_cvttpd_epi32(fix), 2));
+        __m256d c0 = _mm256_mask_i32gather_pd(zero, p.coef, idx, valid, 8);
+        __m256d c1 = _mm256_mask_i32gather_pd(zero, p.coef+1, idx, valid, 8);
+        __m256d c2 = _mm256_mask_i32gather_pd(zero, p.coef+2, idx, valid, 8);
+        __m256d c3 = _mm256_mask_i32gather_pd(zero, p.coef+3, idx, valid, 8);
+
+        __m256d vgain = _mm256_loadu_pd(p.gain+i);
+        __m256d v = _mm256_fmadd_pd(xf, _mm256_fmadd_pd(xf, _mm256_fmadd_pd(xf, c3, c2), c1), c0);
+        v = _mm256_mul_pd(v, vgain);
+
+        double tmp[3][4];
+        bool tail = i + 4 > last;
+        _mm256_storeu_pd(tail ? tmp[0] : val+i, v);
+        if (gx) {
+            __m256d drhoc = _mm256_sub_pd(va, _mm256_div_pd(dr, sq));
+            __m256d drho = _mm256_blendv_pd(one, drhoc, cmask);
+            __m256d rpos = _mm256_cmp_pd(r, zero, _CMP_GT_OQ);
+            __m256d invr = _mm256_and_pd(_mm256_div_pd(one, r), rpos);
+            __m256d d = _mm256_fmadd_pd(xf, _mm256_fmadd_pd(xf, _mm256_mul_pd(three, c3), _mm256_mul_pd(two, c2)), c1);
+            d = _mm256_mul_pd(_mm256_mul_pd(d, _mm256_loadu_pd(p.scale+i)), _mm256_mul_pd(drho, invr));
+            d = _mm256_mul_pd(d, vgain);
+            __m256d glx = _mm256_mul_pd(d, lx), gly = _mm256_mul_pd(d, ly);
+            _mm256_storeu_pd(tail ? tmp[1] : gx+i, _mm256_fmadd_pd(m0, glx, _mm256_mul_pd(m2, gly)));
+            _mm256_storeu_pd(tail ? tmp[2] : gy+i, _mm256_fmadd_pd(m1, glx, _mm256_mul_pd(m3, gly)));
+        }
+        if (tail)
+            for (int k=0; k<last-i; k++) {
+                val[i+k] = tmp[0][k];
+                if (gx) {
+                    gx[i+k] = tmp[1][k];
+                    gy[i+k] = tmp[2][k];
+                }
+            }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void EvalAVX512(const LRSensorPack::Arrays &p, int first, int last, double x, double y,
+                       double *val, double *gx, double *gy)
+{
+    const __m512d vx = _mm512_set1_pd(x);
+    const __m512d vy = _mm512_set1_pd(y);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.);
+    const __m512d two = _mm512_set1_pd(2.);
+    const __m512d three = _mm512_set1_pd(3.);
+// the zero-masked forms are used with all lanes set where the plain intrinsics would
+// pass an undefined vector through, which gcc reports as maybe-uninitialized
+    const __mmask8 all = 0xFF;
+
+    for (int i=first; i<last; i+=8) {
+        __m512d m0 = _mm512_loadu_pd(p.m0+i), m1 = _mm512_loadu_pd(p.m1+i);
+        __m512d m2 = _mm512_loadu_pd(p.m2+i), m3 = _mm512_loadu_pd(p.m3+i);
+        __m512d lx = _mm512_fmadd_pd(m0, vx, _mm512_fmadd_pd(m1, vy, _mm512_loadu_pd(p.tx+i)));
+        __m512d ly = _mm512_fmadd_pd(m2, vx, _mm512_fmadd_pd(m3, vy, _mm512_loadu_pd(p.ty+i)));
+        __m512d r = _mm512_maskz_sqrt_pd(all, _mm512_fmadd_pd(lx, lx, _mm512_mul_pd(ly, ly)));
+
+    // dual slope compression, blended in where cmp != 0
+        __m512d va = _mm512_loadu_pd(p.a+i);
+        __m512d dr = _mm512_sub_pd(r, _mm512_loadu_pd(p.r0+i));
+        __m512d sq = _mm512_maskz_sqrt_pd(all, _mm512_fmadd_pd(dr, dr, _mm512_loadu_pd(p.lam2+i)));
+        __m512d rhoc = _mm512_maskz_max_pd(all, zero, _mm512_sub_pd(_mm512_fmadd_pd(dr, va, _mm512_loadu_pd(p.b+i)), sq));
+        __mmask8 cmask = _mm512_cmp_pd_mask(_mm512_loadu_pd(p.cmp+i), zero, _CMP_NEQ_OQ);
+        __m512d rho = _mm512_mask_blend_pd(cmask, r, rhoc);
+
+    // interval location
+        __m512d vnint = _mm512_loadu_pd(p.nint+i);
+        __m512d xi = _mm512_mul_pd(_mm512_sub_pd(rho, _mm512_loadu_pd(p.xl+i)), _mm512_loadu_pd(p.scale+i));
+        __mmask8 edge = _mm512_cmp_pd_mask(rho, _mm512_loadu_pd(p.xr+i), _CMP_EQ_OQ);
+        __mmask8 inside = _mm512_cmp_pd_mask(xi, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(xi, vnint, _CMP_LT_OQ);
+        __mmask8 valid = inside | edge;
+        xi = _mm512_mask_blend_pd(edge, xi, vnint);
+        xi = _mm512_maskz_mov_pd(valid, xi);
+        __m512d fix = _mm512_maskz_min_pd(all, _mm512_maskz_roundscale_pd(all, xi, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC),
+                                          _mm512_sub_pd(vnint, one));
+        __m512d xf = _mm512_sub_pd(xi, fix);
+
+        __m256i idx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(p.poly+i)), _mm256_slli_epi32(_mm512_maskz_cvttpd_epi32(all, fix), 2));
+        __m512d c0 = _mm512_mask_i32gather_pd(zero, valid, idx, p.coef, 8);
+        __m512d c1 = _mm512_mask_i32gather_pd(zero, valid, idx, p.coef+1, 8);
+        __m512d c2 = _mm512_mask_i32gather_pd(zero, valid, idx, p.coef+2, 8);
+        __m512d c3 = _mm512_mask_i32gather_pd(zero, valid, idx, p.coef+3, 8);
+
+        __m512d vgain = _mm512_loadu_pd(p.gain+i);
+        __m512d v = _mm512_fmadd_pd(xf, _mm512_fmadd_pd(xf, _mm512_fmadd_pd(xf, c3, c2), c1), c0);
+        v = _mm512_mul_pd(v, vgain);
+
+        __mmask8 store = last - i >= 8 ? 0xFF : (__mmask8)((1u << (last - i)) - 1);
+        _mm512_mask_storeu_pd(val+i, store, v);
+        if (gx) {
+            __m512d drhoc = _mm512_sub_pd(va, _mm512_div_pd(dr, sq));
+            __m512d drho = _mm512_mask_blend_pd(cmask, one, drhoc);
+            __mmask8 rpos = _mm512_cmp_pd_mask(r, zero, _CMP_GT_OQ);
+            __m512d invr = _mm512_maskz_div_pd(rpos, one, r);
+            __m512d d = _mm512_fmadd_pd(xf, _mm512_fmadd_pd(xf, _mm512_mul_pd(three, c3), _mm512_mul_pd(two, c2)), c1);
+            d = _mm512_mul_pd(_mm512_mul_pd(d, _mm512_loadu_pd(p.scale+i)), _mm512_mul_pd(drho, invr));
+            d = _mm512_mul_pd(d, vgain);
+            __m512d glx = _mm512_mul_pd(d, lx), gly = _mm512_mul_pd(d, ly);
+            _mm512_mask_storeu_pd(gx+i, store, _mm512_fmadd_pd(m0, glx, _mm512_mul_pd(m2, gly)));
+            _mm512_mask_storeu_pd(gy+i, store, _mm512_fmadd_pd(m1, glx, _mm512_mul_pd(m3, gly)));
+        }
+    }
+}
+
+#endif // LRPACK_X86
+
+// ============== Dispatch ===============
+
+typedef void (*PackKernel)(const LRSensorPack::Arrays&, int, int, double, double, double*, double*, double*);
+
+static LRSensorPack::Kernel BestKernel()
+{
+#ifdef LRPACK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return LRSensorPack::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return LRSensorPack::AVX2;
+#endif
+    return LRSensorPack::Scalar;
+}
+
+static LRSensorPack::Kernel ActiveKernel = BestKernel();
+
+void LRSensorPack::SetKernel(Kernel k)
+{
+    Kernel best = BestKernel();
+    ActiveKernel = (k == Auto || k > best) ? best : k;
+}
+
+LRSensorPack::Kernel LRSensorPack::GetKernel()
+{
+    return ActiveKernel;
+}
+
+const char *LRSensorPack::GetKernelName(Kernel k)
+{
+    switch (k) {
+    case Scalar: return "scalar";
+    case AVX2: return "avx2";
+    case AVX512: return "avx512";
+    default: return "auto";
+    }
+}
+
+void LRSensorPack::Eval(double x, double y, double *val, double *gx, double *gy) const
+{
+    if (n == 0)
+        return;
+    Arrays p = {m0.data(), m1.data(), m2.data(), m3.data(), tx.data(), ty.data(), gain.data(),
+                cmp.data(), a.data(), b.data(), r0.data(), lam2.data(),
+                xl.data(), xr.data(), scale.data(), nint.data(), poly.data(), coef};
+    if (!gy)
+        gx = nullptr;
+
+    PackKernel kernel = EvalScalar;
+#ifdef LRPACK_X86
+    if (ActiveKernel == AVX512)
+        kernel = EvalAVX512;
+    else if (ActiveKernel == AVX2)
+        kernel = EvalAVX2;
+#endif
+    kernel(p, 0, n, x, y, val, gx, gy);
+}
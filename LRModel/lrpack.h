@@ -0,0 +1,62 @@
+#ifndef LRPACK_H
+#define LRPACK_H
+
+#include <vector>
+#include <cstdint>
+
+struct CompiledSensor;
+
+// Structure-of-arrays copy of a list of axial sensors taken from CompiledLRModel,
+// laid out for evaluation of 4 (AVX2) or 8 (AVX-512) sensors at once.
+// The arrays are padded to a multiple of 8 with dummy sensors returning 0.
+// Spline polynomials are not copied: poly holds offsets into the coefficient
+// storage of the CompiledLRModel the pack was made from.
+class LRSensorPack
+{
+public:
+    enum Kernel {
+        Auto,       // best one supported by the CPU
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+// raw view of the arrays passed to the kernels
+    struct Arrays
+    {
+        const double *m0, *m1, *m2, *m3, *tx, *ty, *gain;
+        const double *cmp, *a, *b, *r0, *lam2;
+        const double *xl, *xr, *scale, *nint;
+        const int32_t *poly;
+        const double *coef;
+    };
+
+public:
+    void Clear(const double *coef_base);
+    void Add(const CompiledSensor &s);
+    int GetCount() const {return n;}
+
+// val[i], gx[i], gy[i]: response of the i-th added sensor and its derivatives,
+// pass gx = gy = nullptr if only the values are needed
+    void Eval(double x, double y, double *val, double *gx = nullptr, double *gy = nullptr) const;
+
+// kernel selection is global; unsupported requests fall back to the best available
+    static void SetKernel(Kernel k);
+    static Kernel GetKernel();
+    static const char *GetKernelName(Kernel k);
+
+protected:
+    int n = 0;
+    int npad = 0;
+    const double *coef = nullptr;
+// transform with the LRF origin folded in: local = M*world + t
+    std::vector <double> m0, m1, m2, m3, tx, ty;
+    std::vector <double> gain;
+// compression parameters, cmp = 1 if compression is used
+    std::vector <double> cmp, a, b, r0, lam2;
+// spline range
+    std::vector <double> xl, xr, scale, nint;
+    std::vector <int32_t> poly;
+};
+
+#endif // LRPACK_H
@@ -0,0 +1,229 @@
+#include "responsemap.h"
+#include "lrcompiled.h"
+#include "lrpack.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESPMAP_X86
+#include <immintrin.h>
+#endif
+
+ResponseMap::ResponseMap(const CompiledLRModel &clrm, double step, double margin)
+{
+    nsensors = clrm.GetSensorCount();
+    this->step = step;
+    if (nsensors == 0 || !(step > 0.))
+        return;
+
+    double xmin = clrm.GetX(0), xmax = xmin;
+    double ymin = clrm.GetY(0), ymax = ymin;
+    sx.resize(nsensors);
+    sy.resize(nsensors);
+    for (int i=0; i<nsensors; i++) {
+        sx[i] = clrm.GetX(i);
+        sy[i] = clrm.GetY(i);
+        xmin = std::min(xmin, sx[i]);
+        xmax = std::max(xmax, sx[i]);
+        ymin = std::min(ymin, sy[i]);
+        ymax = std::max(ymax, sy[i]);
+    }
+    x0 = xmin - margin;
+    y0 = ymin - margin;
+    nx = (int)floor((xmax + margin - x0)/step) + 1;
+    ny = (int)floor((ymax + margin - y0)/step) + 1;
+    size_t nnodes = (size_t)nx*ny;
+
+    resp.assign(nnodes*nsensors, 0.f);
+    norm.assign(nnodes, 0.);
+    std::vector <double> f(nsensors);
+    for (int iy=0; iy<ny; iy++)
+        for (int ix=0; ix<nx; ix++) {
+            int n = node(ix, iy);
+            double x = x0 + ix*step, y = y0 + iy*step;
+            double sum2 = 0.;
+            for (int i=0; i<nsensors; i++) {
+                f[i] = clrm.Eval(i, x, y);
+                sum2 += f[i]*f[i];
+            }
+            if (!(sum2 > 0.))
+                continue;
+            norm[n] = sqrt(sum2);
+            for (int i=0; i<nsensors; i++)
+                resp[i*nnodes + n] = f[i]/norm[n];
+    }
+}
+
+size_t ResponseMap::GetMemory() const
+{
+    return resp.size()*sizeof(float) + (norm.size() + sx.size() + sy.size())*sizeof(double);
+}
+
+// ============== Kernels ===============
+
+// for nodes j = 0..n-1: s1[j] = sum(a[k]*r[k][j]), s2[j] = sum(r[k][j]^2) over k = 0..m-1
+static void ScanScalar(const float *const *r, const float *a, int m, int n, float *s1, float *s2)
+{
+    for (int j=0; j<n; j++)
+        s1[j] = s2[j] = 0.f;
+    for (int k=0; k<m; k++) {
+        const float *rk = r[k];
+        for (int j=0; j<n; j++) {
+            s1[j] += a[k]*rk[j];
+            s2[j] += rk[j]*rk[j];
+        }
+    }
+}
+
+#ifdef RESPMAP_X86
+
+// 32 nodes at a time, the sums stay in registers over all sensors
+__attribute__((target("avx2,fma")))
+static void ScanAVX2(const float *const *r, const float *a, int m, int n, float *s1, float *s2)
+{
+    int j = 0;
+    for (; j+32<=n; j+=32) {
+        __m256 p0 = _mm256_setzero_ps(), p1 = p0, p2 = p0, p3 = p0;
+        __m256 q0 = p0, q1 = p0, q2 = p0, q3 = p0;
+        for (int k=0; k<m; k++) {
+            const float *rk = r[k] + j;
+            __m256 va = _mm256_set1_ps(a[k]);
+            __m256 r0 = _mm256_loadu_ps(rk), r1 = _mm256_loadu_ps(rk+8);
+            __m256 r2 = _mm256_loadu_ps(rk+16), r3 = _mm256_loadu_ps(rk+24);
+            p0 = _mm256_fmadd_ps(va, r0, p0);
+            p1 = _mm256_fmadd_ps(va, r1, p1);
+            p2 = _mm256_fmadd_ps(va, r2, p2);
+            p3 = _mm256_fmadd_ps(va, r3, p3);
+            q0 = _mm256_fmadd_ps(r0, r0, q0);
+            q1 = _mm256_fmadd_ps(r1, r1, q1);
+            q2 = _mm256_fmadd_ps(r2, r2, q2);
+            q3 = _mm256_fmadd_ps(r3, r3, q3);
+        }
+        _mm256_storeu_ps(s1+j, p0);
+        _mm256_storeu_ps(s1+j+8, p1);
+        _mm256_storeu_ps(s1+j+16, p2);
+        _mm256_storeu_ps(s1+j+24, p3);
+        _mm256_storeu_ps(s2+j, q0);
+        _mm256_storeu_ps(s2+j+8, q1);
+        _mm256_storeu_ps(s2+j+16, q2);
+        _mm256_storeu_ps(s2+j+24, q3);
+    }
+    for (; j+8<=n; j+=8) {
+        __m256 p = _mm256_setzero_ps(), q = p;
+        for (int k=0; k<m; k++) {
+            __m256 rj = _mm256_loadu_ps(r[k] + j);
+            p = _mm256_fmadd_ps(_mm256_set1_ps(a[k]), rj, p);
+            q = _mm256_fmadd_ps(rj, rj, q);
+        }
+        _mm256_storeu_ps(s1+j, p);
+        _mm256_storeu_ps(s2+j, q);
+    }
+    for (; j<n; j++) {
+        float p = 0.f, q = 0.f;
+        for (int k=0; k<m; k++) {
+            p += a[k]*r[k][j];
+            q += r[k][j]*r[k][j];
+        }
+        s1[j] = p;
+        s2[j] = q;
+    }
+}
+
+#endif // RESPMAP_X86
+
+typedef void (*ScanKernel)(const float *const*, const float*, int, int, float*, float*);
+
+// the kernel follows the global choice of LRSensorPack
+static ScanKernel GetScanKernel()
+{
+#ifdef RESPMAP_X86
+    if (LRSensorPack::GetKernel() >= LRSensorPack::AVX2)
+        return ScanAVX2;
+#endif
+    return ScanScalar;
+}
+
+// ============== Search ===============
+
+bool ResponseMap::FindBest(const double *a, const char *use, double &x, double &y, double &e) const
+{
+    if (resp.empty())
+        return false;
+
+    int maxid = -1;
+    for (int i=0; i<nsensors; i++)
+        if (use[i] && (maxid < 0 || a[i] > a[maxid]))
+            maxid = i;
+    if (maxid < 0)
+        return false;
+
+// window of the scanned nodes
+    int ix0 = 0, ix1 = nx-1, iy0 = 0, iy1 = ny-1;
+    if (radius > 0.) {
+        ix0 = std::max(ix0, (int)ceil((sx[maxid] - radius - x0)/step));
+        ix1 = std::min(ix1, (int)floor((sx[maxid] + radius - x0)/step));
+        iy0 = std::max(iy0, (int)ceil((sy[maxid] - radius - y0)/step));
+        iy1 = std::min(iy1, (int)floor((sy[maxid] + radius - y0)/step));
+    }
+    int w = ix1 - ix0 + 1, h = iy1 - iy0 + 1;
+    if (w <= 0 || h <= 0)
+        return false;
+
+// s1 = a.r and s2 = r.r over the used sensors for each node of the window,
+// rows are scanned separately unless the window spans the whole width of the map
+    std::vector <float> s1((size_t)w*h), s2((size_t)w*h);
+    std::vector <const float*> r;
+    std::vector <float> af;
+    size_t nnodes = (size_t)nx*ny;
+    for (int i=0; i<nsensors; i++)
+        if (use[i]) {
+            r.push_back(&resp[i*nnodes] + node(ix0, iy0));
+            af.push_back(a[i]);
+        }
+    int m = r.size();
+    ScanKernel scan = GetScanKernel();
+    if (w == nx) {
+        scan(r.data(), af.data(), m, w*h, s1.data(), s2.data());
+    } else {
+        for (int iy=0; iy<h; iy++) {
+            scan(r.data(), af.data(), m, w, &s1[iy*w], &s2[iy*w]);
+            for (int k=0; k<m; k++)
+                r[k] += nx;
+        }
+    }
+
+    auto score = [&](int k) {
+        return s1[k] > 0.f && s2[k] > 0.f ? (double)s1[k]*s1[k]/s2[k] : 0.;
+    };
+    int best = -1;
+    double best_score = 0.;
+    for (int k=0; k<w*h; k++) {
+        double sk = score(k);
+        if (sk > best_score) {
+            best_score = sk;
+            best = k;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    int bx = best%w, by = best/w;
+    x = x0 + (ix0 + bx)*step;
+    y = y0 + (iy0 + by)*step;
+    e = s1[best]/(s2[best]*norm[node(ix0 + bx, iy0 + by)]);
+
+// vertex of the parabola through the neighbours, if both are in the window
+    if (bx > 0 && bx < w-1) {
+        double sl = score(best-1), sr = score(best+1);
+        double d2 = sl - 2.*best_score + sr;
+        if (sl > 0. && sr > 0. && d2 < 0.)
+            x += 0.5*step*(sl - sr)/d2;
+    }
+    if (by > 0 && by < h-1) {
+        double sl = score(best-w), sr = score(best+w);
+        double d2 = sl - 2.*best_score + sr;
+        if (sl > 0. && sr > 0. && d2 < 0.)
+            y += 0.5*step*(sl - sr)/d2;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef RESPONSEMAP_H
+#define RESPONSEMAP_H
+
+#include <vector>
+#include <cstddef>
+
+class CompiledLRModel;
+
+// Coarse grid of the expected responses of all sensors, used for the initial guess of the
+// reconstruction. The response vector of each node is stored normalized to unit length,
+// as float and sensor by sensor (all nodes of a sensor are contiguous), so the memory is
+// sensors * nodes * 4 bytes plus a double per node.
+// An event is matched to the node with the largest cosine between its signals and the
+// response, taking only the used sensors: (a.r)^2 / (r.r) over them, which is the best
+// least squares fit of the signals by the node response with a free scale. Both sums are
+// accumulated for a row of nodes at once, one used sensor at a time (SIMD over the nodes).
+// The position is then refined by a parabola through the neighbour nodes along x and y.
+// The map is read-only after construction and can be shared by several reconstructors.
+class ResponseMap
+{
+public:
+// grid with the given step over the bounding box of the sensors extended by margin
+    ResponseMap(const CompiledLRModel &clrm, double step, double margin = 0.);
+
+// only nodes within radius from the strongest used sensor are scanned, 0 => all nodes
+    void SetSearchRadius(double val) {radius = val;}
+    int GetSensorCount() const {return nsensors;}
+    int GetNodeCount() const {return nx*ny;}
+    size_t GetMemory() const;
+
+// a[i]: signal of sensor i, used only if use[i] != 0;
+// returns the position and the energy (scale of the LRFs) of the best match,
+// false if no node responds to the used sensors
+    bool FindBest(const double *a, const char *use, double &x, double &y, double &e) const;
+
+protected:
+    int node(int ix, int iy) const {return ix + iy*nx;}
+
+protected:
+    int nsensors = 0;
+    int nx = 0, ny = 0;
+    double x0 = 0., y0 = 0.;    // first node
+    double step = 1.;
+    double radius = 0.;
+    std::vector <float> resp;   // nx*ny values per sensor
+    std::vector <double> norm;  // length of the response vector before normalization, 0 => no response
+    std::vector <double> sx, sy;    // sensor positions
+};
+
+#endif // RESPONSEMAP_H
@@ -1,5 +1,6 @@
 #include "transform.h"
 #include "json11.hpp"
+#include "lrbinary.h"
 
 Transform* Transform::Factory(const Json &json)
 {
@@ -25,6 +26,37 @@ Transform* Transform::Factory(const Json &json)
     }
 }
 
+Transform* Transform::Factory(const LRBinTransform &rec)
+{
+    switch (rec.method) {
+    case LRBinTransform::Translate:
+        return new TranslateLRF(rec.p[0], rec.p[1]);
+    case LRBinTransform::Rotate:
+        return new RotateLRF(rec.p[0]);
+    case LRBinTransform::Reflect:
+        return new ReflectLRF(rec.p[0]);
+    default:
+        return NULL;
+    }
+}
+
+// recovered from the images of (0,0), (1,0) and (0,1)
+void Transform::GetAffine(double *m, double *t) const
+{
+    double px[3] = {0., 1., 0.};
+    double py[3] = {0., 0., 1.};
+    for (int i=0; i<3; i++) {
+        double z = 0.;
+        DoTransform(&px[i], &py[i], &z);
+    }
+    t[0] = px[0];
+    t[1] = py[0];
+    m[0] = px[1] - px[0];
+    m[1] = px[2] - px[0];
+    m[2] = py[1] - py[0];
+    m[3] = py[2] - py[0];
+}
+
 // ============== Translate ===============
 
 TranslateLRF::TranslateLRF(double dx, double dy)
@@ -55,6 +87,11 @@ void TranslateLRF::DoInvTransform(double *x, double *y, double *z) const
     *y -= dy;
 }
 
+void TranslateLRF::DoGradTransform(double *, double *, double *) const
+{
+// translation doesn't change the gradient
+}
+
 void TranslateLRF::ToJsonObject(Json_object &json) const
 {
     json["method"] = "translate";
@@ -62,6 +99,13 @@ void TranslateLRF::ToJsonObject(Json_object &json) const
     json["dy"] = dy;
 }
 
+void TranslateLRF::ToBinary(LRBinTransform &rec) const
+{
+    rec.method = LRBinTransform::Translate;
+    rec.p[0] = dx;
+    rec.p[1] = dy;
+}
+
 // ============== Rotate ===============
 
 RotateLRF::RotateLRF(double phi)
@@ -106,12 +150,27 @@ void RotateLRF::DoInvTransform(double *x, double *y, double *z) const
     *y = pos_world(1);
 }
 
+// world gradient is A^T * local gradient, and A^T = B
+void RotateLRF::DoGradTransform(double *gx, double *gy, double *) const
+{
+    Vector2d grad_world, grad_local(*gx, *gy);
+    grad_world = B * grad_local;
+    *gx = grad_world(0);
+    *gy = grad_world(1);
+}
+
 void RotateLRF::ToJsonObject(Json_object &json) const
 {
     json["method"] = "rotate";
     json["phi"] = phi;
 }
 
+void RotateLRF::ToBinary(LRBinTransform &rec) const
+{
+    rec.method = LRBinTransform::Rotate;
+    rec.p[0] = phi;
+}
+
 // ============== Reflect ===============
 
 ReflectLRF::ReflectLRF(double phi)
@@ -154,12 +213,27 @@ void ReflectLRF::DoInvTransform(double *x, double *y, double *z) const
     *y = pos_world(1);
 }
 
+// reflection matrix is symmetric, so A^T = A
+void ReflectLRF::DoGradTransform(double *gx, double *gy, double *) const
+{
+    Vector2d grad_world, grad_local(*gx, *gy);
+    grad_world = A * grad_local;
+    *gx = grad_world(0);
+    *gy = grad_world(1);
+}
+
 void ReflectLRF::ToJsonObject(Json_object &json) const
 {
     json["method"] = "reflect";
     json["phi"] = phi;
 }
 
+void ReflectLRF::ToBinary(LRBinTransform &rec) const
+{
+    rec.method = LRBinTransform::Reflect;
+    rec.p[0] = phi;
+}
+
 
 
 
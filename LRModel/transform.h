@@ -8,6 +8,8 @@
 using Eigen::Matrix2d;
 using Eigen::Vector2d;
 
+struct LRBinTransform;
+
 class Transform : public LRF_IO
 {
 public:
@@ -16,9 +18,15 @@ public:
     virtual Transform* clone() const = 0;
     virtual void DoTransform(double *x, double *y, double *z) const = 0;
     virtual void DoInvTransform(double *x, double *y, double *z) const = 0;
+// converts gradient from local (LRF) to world frame
+    virtual void DoGradTransform(double *gx, double *gy, double *gz) const = 0;
     virtual void ToJsonObject(Json_object &json) const = 0;
+    virtual void ToBinary(LRBinTransform &rec) const = 0;
+// all transforms are affine in (x, y): local = M * world + t, M is row-major
+    void GetAffine(double *m, double *t) const;
 
     static Transform* Factory(const Json &json);
+    static Transform* Factory(const LRBinTransform &rec);
 
 protected:
     bool fValid = false;
@@ -34,7 +42,9 @@ public:
     TranslateLRF* clone() const {return new TranslateLRF(*this);}
     virtual void DoTransform(double *x, double *y, double *z) const;
     virtual void DoInvTransform(double *x, double *y, double *z) const;
+    virtual void DoGradTransform(double *gx, double *gy, double *gz) const;
     virtual void ToJsonObject(Json_object &json) const;
+    virtual void ToBinary(LRBinTransform &rec) const;
 
 private:
     double dx;
@@ -50,7 +60,9 @@ public:
     void Init();
     virtual void DoTransform(double *x, double *y, double *z) const;
     virtual void DoInvTransform(double *x, double *y, double *z) const;
+    virtual void DoGradTransform(double *gx, double *gy, double *gz) const;
     virtual void ToJsonObject(Json_object &json) const;
+    virtual void ToBinary(LRBinTransform &rec) const;
 private:
     double phi;
 
@@ -72,7 +84,9 @@ public:
     void Init();
     virtual void DoTransform(double *x, double *y, double *z) const;
     virtual void DoInvTransform(double *x, double *y, double *z) const;
+    virtual void DoGradTransform(double *gx, double *gy, double *gz) const;
     virtual void ToJsonObject(Json_object &json) const;
+    virtual void ToBinary(LRBinTransform &rec) const;
 
 private:
     double phi;
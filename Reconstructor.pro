@@ -3,11 +3,12 @@ CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
 CONFIG += c++11
-QMAKE_CXXFLAGS += -march=native -O2
+QMAKE_CXXFLAGS += -O2
 
 INCLUDEPATH += lib
 INCLUDEPATH += spline123
 INCLUDEPATH += LRModel
+INCLUDEPATH += EventIO
 INCLUDEPATH += /usr/include/eigen3
 INCLUDEPATH += $$system(root-config --incdir)
 
@@ -15,19 +16,40 @@ LIBS += $$system(root-config --libs) -lGeom -lGeomPainter -lGeomBuilder -lMinuit
 
 SOURCES += \
     LRModel/lrmodel.cpp \
+    LRModel/lrf.cpp \
     LRModel/lrfaxial.cpp \
+    LRModel/lrfxy.cpp \
+    LRModel/lrfaxial3d.cpp \
+    LRModel/lrf3d.cpp \
+    LRModel/lrftabulated.cpp \
+    LRModel/lrcompiled.cpp \
+    LRModel/lrpack.cpp \
+    LRModel/responsemap.cpp \
+    LRModel/lrbinary.cpp \
     LRModel/transform.cpp \
     LRModel/compress.cpp \
     LRModel/lrfio.cpp \
     spline123/bsfit123.cpp \
     spline123/profileHist.cpp \
     spline123/bspline123d.cpp \
+    spline123/sparseqp.cpp \
     lib/json11.cpp \
+    EventIO/eventsource.cpp \
+    sensorgrid.cpp \
     reconstructor.cpp \
+    parallelreconstructor.cpp \
     example1.cpp
 
 HEADERS += \
     LRModel/lrfaxial.h \
+    LRModel/lrfxy.h \
+    LRModel/lrfaxial3d.h \
+    LRModel/lrf3d.h \
+    LRModel/lrftabulated.h \
+    LRModel/lrcompiled.h \
+    LRModel/lrpack.h \
+    LRModel/responsemap.h \
+    LRModel/lrbinary.h \
     LRModel/lrmodel.h \
     LRModel/compress.h \
     LRModel/lrf.h \
@@ -36,6 +58,11 @@ HEADERS += \
     spline123/bsfit123.h \
     spline123/profileHist.h \
     spline123/bspline123d.h \
+    spline123/bskernel.h \
+    spline123/sparseqp.h \
     lib/json11.hpp \
     lib/eiquadprog.hpp \
-    reconstructor.h
+    EventIO/eventsource.h \
+    sensorgrid.h \
+    reconstructor.h \
+    parallelreconstructor.h
@@ -0,0 +1,681 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstring>
+#include <cmath>
+#include "lrmodel.h"
+#include "lrfaxial.h"
+#include "compress.h"
+#include "reconstructor.h"
+#include "lrpack.h"
+#include "lrbinary.h"
+#include "lrcompiled.h"
+#include "responsemap.h"
+#include "bspline123d.h"
+#include "bsfit123.h"
+#include "parallelreconstructor.h"
+#include "eventsource.h"
+#include "json11.hpp"
+
+// Benchmark: reconstruction speed with numeric vs analytic gradient
+// on the 8x8 array and the Simulation_10k flood (same setup as example1)
+//
+// usage: benchmark                 the Simulation_10k flood benchmarks
+//        benchmark suite [quick]   synthetic array suite (see RunSuite), no input files needed
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// rows: a0 ... a63, photons, x, y
+static bool LoadFlood(const std::string &fname, std::vector <std::vector <double> > &Data)
+{
+    TextEventSource src(fname, 64);
+    EventChunk chunk(1000, 64);
+    while (src.ReadChunk(chunk)) {
+        for (int i=0; i<chunk.nevents; i++) {
+            std::vector <double> evt(chunk.GetSignals(i), chunk.GetSignals(i)+64);
+            evt.push_back(chunk.photons[i]);
+            evt.push_back(chunk.x[i]);
+            evt.push_back(chunk.y[i]);
+            Data.push_back(evt);
+        }
+    }
+    return src.IsValid();
+}
+
+// LRFs are set up but not fitted, d0 gets the event positions
+static LRModel *MakeSquare8x8(std::vector <std::vector <double> > &Data, std::vector <LRFdata> &d0)
+{
+    LRModel *lrm = new LRModel(64);
+    double step = 4.21;
+    double shift = step*3.5;
+    for (int i=0; i<64; i++) {
+        double y = -(i/8 * step - shift);
+        double x = i%8 * step - shift;
+        lrm->AddSensor(i, x, y);
+    }
+    lrm->MakeGroupsSquare();
+
+    LRFaxial *mylrf = new LRFaxial(42., 10);
+    mylrf->SetCompression(new DualSlopeCompress(10., 7., 4.));
+    mylrf->setNonNegative(true);
+    mylrf->SetNonIncreasing(true);
+    mylrf->SetFlatTop(true);
+    for (int i=0; i<lrm->GetGroupCount(); i++) {
+        lrm->SetGroupLRF(i, mylrf->clone());
+        ((LRFaxial*)(lrm->GetGroupLRF(i)))->SetOrigin(lrm->GetGroupX(i), lrm->GetGroupY(i));
+    }
+    delete mylrf;
+
+    d0.clear();
+    for (auto &q : Data)
+        d0.push_back(LRFdata({q[65], q[66], 0, q[0]}));
+    for (int i=0; i<lrm->GetGroupCount(); i++) {
+        LRFaxial *lrf = dynamic_cast<LRFaxial*> (lrm->GetGroupLRF(i));
+        lrf->SetRmax(lrm->GetGroupMaxR(i, d0));
+    }
+    return lrm;
+}
+
+// serial fit as in example1
+static void FitSerial(LRModel *lrm, std::vector <std::vector <double> > &Data, std::vector <LRFdata> &d0)
+{
+    for (int j=0; j<64; j++) {
+        for (int i=0; i<d0.size(); i++)
+            d0[i][3] = Data[i][j];
+        lrm->AddFitData(j, d0);
+    }
+    for (int i=0; i<lrm->GetGroupCount(); i++)
+        lrm->FitGroup(i);
+}
+
+static void BenchFitting(std::vector <std::vector <double> > &Data)
+{
+    std::vector <LRFdata> d0;
+    LRModel *lrm = MakeSquare8x8(Data, d0);
+    double t0 = Now();
+    FitSerial(lrm, Data, d0);
+    std::cout << "  serial: " << (Now()-t0)*1e3 << " ms" << std::endl;
+    delete lrm;
+
+    lrm = MakeSquare8x8(Data, d0);
+    std::vector <std::array <double, 2> > truth_xy;
+    for (auto &q : Data)
+        truth_xy.push_back({q[65], q[66]});
+    t0 = Now();
+    lrm->AddFloodEvents(Data, truth_xy);
+    for (int i=0; i<lrm->GetGroupCount(); i++)
+        lrm->FitGroup(i);
+    std::cout << "  AddFloodEvents: " << (Now()-t0)*1e3 << " ms" << std::endl;
+    delete lrm;
+
+    for (int nt : {1, 2, 4, 8}) {
+        lrm = MakeSquare8x8(Data, d0);
+        t0 = Now();
+        bool ok = lrm->FitAll(d0, Data, nt);
+        std::cout << "  FitAll, " << nt << " threads: " << (Now()-t0)*1e3 << " ms"
+                  << (ok ? "" : " (failed)") << std::endl;
+        delete lrm;
+    }
+}
+
+static void BenchGradient(LRModel *lrm, std::vector <std::vector <double> > &Data,
+                          Reconstructor::Method method, bool analytic, bool profile = false,
+                          Reconstructor::Engine engine = Reconstructor::Minuit,
+                          const ResponseMap *map = nullptr, double tab_step = 0.)
+{
+    Reconstructor reco(lrm);
+    reco.setLRFTabulation(tab_step);
+    reco.setEngine(engine);
+    reco.setResponseMap(map);
+    reco.setMethod(method);
+    reco.setAnalyticGradient(analytic);
+    reco.setProfileEnergy(profile);
+    reco.InitMinimizer();
+    reco.setCogRelCutoff(0.1);
+    reco.setEnergyCalibration(0.005);
+
+    std::vector <bool> sat(64, false);
+    long ncalls = 0;
+    int nok = 0;
+    double sum2 = 0.;
+
+    double t0 = Now();
+    for (auto &d : Data) {
+        reco.ProcessEvent(d, sat);
+        ncalls += reco.getNCalls();
+        if (reco.getRecStatus())
+            continue;
+        nok++;
+        double dx = reco.getRecX() - d[65];
+        double dy = reco.getRecY() - d[66];
+        sum2 += dx*dx + dy*dy;
+    }
+    double dt = Now() - t0;
+
+    std::cout << (method == Reconstructor::ML ? "ML" : "LS") << "  "
+              << (engine == Reconstructor::LevMar ? "LM      " : "Minuit2 ")
+              << (analytic ? "analytic" : "numeric ") << "  "
+              << (profile ? "(x, y)    " : "(x, y, e) ")
+              << (map ? "map " : "CoG ")
+              << "events/s: " << Data.size()/dt << "  "
+              << "calls/event: " << (double)ncalls/Data.size() << "  "
+              << "ok: " << nok << "/" << Data.size() << "  "
+              << "rms(r): " << (nok ? sqrt(sum2/nok) : 0.) << std::endl;
+}
+
+// large square array, every sensor has its own copy of the LRF
+static LRModel *MakeLarge(LRModel *src, int n)
+{
+    int side = ceil(sqrt(n));
+    LRModel *lrm = new LRModel(n);
+    for (int i=0; i<n; i++) {
+        double x = (i%side)*4.21;
+        double y = (i/side)*4.21;
+        lrm->AddSensor(i, x, y);
+        LRFaxial *lrf = (LRFaxial*)src->GetGroupLRF(0)->clone();
+        lrf->SetOrigin(x, y);
+        lrm->SetLRF(i, lrf);
+    }
+    return lrm;
+}
+
+// model loading: JSON text vs mapped binary file, both up to a compiled model
+static void BenchStartup(LRModel *src, int n)
+{
+    LRModel *big = MakeLarge(src, n);
+    {
+        std::ofstream f("bench_model.json");
+        f << big->GetJsonString();
+    }
+    big->SaveBinary("bench_model.lrb");
+    delete big;
+
+    double t0 = Now();
+    std::ifstream f("bench_model.json");
+    std::string json_str((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    LRModel *m = new LRModel(json_str);
+    CompiledLRModel *cm = new CompiledLRModel(m);
+    double t1 = Now();
+    LRModelFile *file = new LRModelFile("bench_model.lrb");
+    CompiledLRModel *cf = new CompiledLRModel(file);
+    double t2 = Now();
+
+    double pos[2] = {10., 10.};
+    std::cout << n << " sensors:  JSON " << (t1-t0)*1e3 << " ms  binary " << (t2-t1)*1e3 << " ms"
+              << "  (same response: " << (cm->Eval(0, pos[0], pos[1]) == cf->Eval(0, pos[0], pos[1]) ? "yes" : "no")
+              << ")" << std::endl;
+    delete cm;
+    delete m;
+    delete cf;
+    delete file;
+}
+
+// event ingestion: line-by-line istringstream vs the text and binary event sources
+static void BenchEventIO(const std::string &fname)
+{
+    double t0 = Now();
+    std::ifstream f(fname);
+    std::string line;
+    long nval = 0;
+    while (std::getline(f, line)) {
+        std::istringstream iss(line);
+        double val;
+        while (iss >> val)
+            nval++;
+    }
+    double t1 = Now();
+
+    TextEventSource src(fname, 64);
+    EventChunk chunk(1000, 64);
+    long ntext = 0;
+    while (src.ReadChunk(chunk))
+        ntext += chunk.nevents;
+    double t2 = Now();
+
+    {
+        BinaryEventWriter w("bench_events.bin", 64, EventFileHeader::Float32, true);
+        src.Rewind();
+        while (src.ReadChunk(chunk))
+            w.Write(chunk);
+    }
+    double t3 = Now();
+    BinaryEventSource bin("bench_events.bin");
+    long nbin = 0;
+    while (bin.ReadChunk(chunk))
+        nbin += chunk.nevents;
+    double t4 = Now();
+
+    std::cout << "istringstream: " << (t1-t0)*1e3 << " ms (" << nval << " values)  "
+              << "text source: " << (t2-t1)*1e3 << " ms (" << ntext << " events)  "
+              << "binary source: " << (t4-t3)*1e3 << " ms (" << nbin << " events)" << std::endl;
+}
+
+// constant-memory reconstruction: chunks from a binary source go to ProcessBatch
+static void BenchStreaming(LRModel *lrm)
+{
+    Reconstructor reco(lrm);
+    reco.setAnalyticGradient(true);
+    reco.InitMinimizer();
+    reco.setCogRelCutoff(0.1);
+    reco.setEnergyCalibration(0.005);
+
+    BinaryEventSource src("bench_events.bin");
+    EventChunk chunk(256, 64);
+    std::vector <int> status(chunk.capacity);
+    std::vector <double> x(chunk.capacity), y(chunk.capacity);
+    RecBatchOutput out;
+    out.status = status.data();
+    out.x = x.data();
+    out.y = y.data();
+
+    long n = 0, nok = 0;
+    double t0 = Now();
+    while (src.ReadChunk(chunk)) {
+        nok += reco.ProcessBatch(chunk.nevents, chunk.signal.data(), 64, 1, nullptr, out);
+        n += chunk.nevents;
+    }
+    double dt = Now() - t0;
+    std::cout << "streamed " << n << " events, ok: " << nok << ", events/s: " << n/dt << std::endl;
+}
+
+// Synthetic array suite: square and hexagonal arrays, 19 to 1000+ sensors.
+// Flood events are generated from an analytic response, LRFs are fitted to them and
+// the fitted model is used to time the building blocks of the reconstruction:
+//   spline / LRF / LRModel evaluation, cost function, full LS and ML reconstruction,
+//   binned and constrained spline fits, JSON save/load and thread scaling.
+// The results are reproducible (fixed seed).
+
+static volatile double sink;    // keeps the timed calls from being optimized away
+
+// runs op(i) for i = 0 ... n-1, returns ns per call
+template <class Op> static double TimeOp(int n, Op op)
+{
+    double sum = 0.;
+    double t0 = Now();
+    for (int i=0; i<n; i++)
+        sum += op(i);
+    double dt = Now() - t0;
+    sink = sum;
+    return dt/n*1e9;
+}
+
+struct ArraySpec
+{
+    std::string name;
+    bool hex;
+    int size;       // square: sensors per side, hexagonal: number of rings around the central one
+};
+
+const double Pitch = 4.21;
+const double Height = 5.;       // light source to sensor plane distance in the synthetic response
+const double Photons = 2000.;   // mean total number of detected photons
+
+// solid-angle-like response of a sensor at distance r, integral over the plane is 1
+static double Response(double r)
+{
+    return Height/(2*M_PI*pow(r*r + Height*Height, 1.5));
+}
+
+static LRModel *MakeArray(const ArraySpec &spec)
+{
+    std::vector <double> vx, vy;
+    if (spec.hex) {
+        int n = spec.size;
+        for (int q=-n; q<=n; q++)
+            for (int r=-n; r<=n; r++)
+                if (abs(q+r) <= n) {
+                    vx.push_back(Pitch*(q + r*0.5));
+                    vy.push_back(Pitch*r*sqrt(3.)/2.);
+                }
+    } else {
+        double shift = Pitch*(spec.size-1)/2.;
+        for (int i=0; i<spec.size*spec.size; i++) {
+            vx.push_back(i%spec.size*Pitch - shift);
+            vy.push_back(i/spec.size*Pitch - shift);
+        }
+    }
+
+    LRModel *lrm = new LRModel(vx.size());
+    for (int i=0; i<(int)vx.size(); i++)
+        lrm->AddSensor(i, vx[i], vy[i]);
+    if (spec.hex)
+        lrm->MakeGroupsHexagon();
+    else
+        lrm->MakeGroupsSquare();
+    return lrm;
+}
+
+// flood events uniformly distributed over the area covered by the sensors
+// (closer than one pitch to the nearest one): rows of nsensors signals
+static void MakeEvents(LRModel *lrm, int nevents, unsigned int seed,
+                       std::vector <std::vector <double> > &events, std::vector <std::array <double, 2> > &xy)
+{
+    std::mt19937 gen(seed);
+    int n = lrm->GetSensorCount();
+    double xmin = 1e10, xmax = -1e10, ymin = 1e10, ymax = -1e10;
+    for (int id=0; id<n; id++) {
+        xmin = std::min(xmin, lrm->GetX(id));
+        xmax = std::max(xmax, lrm->GetX(id));
+        ymin = std::min(ymin, lrm->GetY(id));
+        ymax = std::max(ymax, lrm->GetY(id));
+    }
+    std::uniform_real_distribution <double> ux(xmin, xmax), uy(ymin, ymax);
+
+    events.assign(nevents, std::vector <double> (n));
+    xy.resize(nevents);
+    for (int i=0; i<nevents; i++) {
+        double x, y, dmin;
+        do {
+            x = ux(gen);
+            y = uy(gen);
+            dmin = 1e10;
+            for (int id=0; id<n; id++)
+                dmin = std::min(dmin, hypot(x-lrm->GetX(id), y-lrm->GetY(id)));
+        } while (dmin > Pitch);
+        xy[i] = {x, y};
+        for (int id=0; id<n; id++) {
+            double mean = Photons*Pitch*Pitch*Response(hypot(x-lrm->GetX(id), y-lrm->GetY(id)));
+            std::poisson_distribution <int> pois(mean);
+            events[i][id] = pois(gen);
+        }
+    }
+}
+
+// same LRF setup as in example1, fitted to the flood
+static void FitModel(LRModel *lrm, const std::vector <std::vector <double> > &events,
+                     const std::vector <std::array <double, 2> > &xy)
+{
+    LRFaxial *proto = new LRFaxial(42., 10);
+    proto->SetCompression(new DualSlopeCompress(10., 7., 4.));
+    proto->setNonNegative(true);
+    proto->SetNonIncreasing(true);
+    proto->SetFlatTop(true);
+
+    std::vector <LRFdata> pos;
+    for (auto &p : xy)
+        pos.push_back(LRFdata({p[0], p[1], 0., 0.}));
+
+    for (int gid=0; gid<lrm->GetGroupCount(); gid++) {
+        LRFaxial *lrf = proto->clone();
+        lrf->SetOrigin(lrm->GetGroupX(gid), lrm->GetGroupY(gid));
+        lrf->SetRmax(lrm->GetGroupMaxR(gid, pos));
+        lrm->SetGroupLRF(gid, lrf);
+    }
+// sensors left without a group (e.g. the central one) get their own LRF
+    for (int id=0; id<lrm->GetSensorCount(); id++) {
+        if (lrm->GetGroup(id) >= 0)
+            continue;
+        LRFaxial *lrf = proto->clone();
+        lrf->SetOrigin(lrm->GetX(id), lrm->GetY(id));
+        lrf->SetRmax(lrm->GetMaxR(id, pos));
+        lrm->SetLRF(id, lrf);
+    }
+    delete proto;
+
+    lrm->FitAll(pos, events);
+}
+
+static void BenchReconstruction(LRModel *lrm, const std::vector <std::vector <double> > &events,
+                                const std::vector <std::array <double, 2> > &xy,
+                                Reconstructor::Method method, double ecal)
+{
+    Reconstructor reco(lrm);
+    reco.setMethod(method);
+    reco.setAnalyticGradient(true);
+    reco.InitMinimizer();
+    reco.setCogRelCutoff(0.1);
+    reco.setEnergyCalibration(ecal);
+
+    std::vector <bool> sat(lrm->GetSensorCount(), false);
+    long ncalls = 0;
+    int nok = 0;
+    double sum2 = 0.;
+
+    double t0 = Now();
+    for (int i=0; i<(int)events.size(); i++) {
+        reco.ProcessEvent(events[i], sat);
+        ncalls += reco.getNCalls();
+        if (reco.getRecStatus())
+            continue;
+        nok++;
+        double dx = reco.getRecX() - xy[i][0];
+        double dy = reco.getRecY() - xy[i][1];
+        sum2 += dx*dx + dy*dy;
+    }
+    double dt = Now() - t0;
+
+// cost function alone, at the last reconstructed position
+    double x = reco.getRecX(), y = reco.getRecY(), e = reco.getRecE();
+    double ns = TimeOp(20000, [&](int i) {
+        return method == Reconstructor::LS ? reco.getChi2(x+i*1e-6, y, 0., e) : reco.getLogLH(x+i*1e-6, y, 0., e);
+    });
+
+    std::cout << "  " << (method == Reconstructor::ML ? "ML" : "LS") << " ProcessEvent: "
+              << events.size()/dt << " events/s, " << (double)ncalls/events.size() << " calls/event, "
+              << "ok " << nok << "/" << events.size() << ", rms(r) " << (nok ? sqrt(sum2/nok) : 0.)
+              << "; " << (method == Reconstructor::ML ? "getLogLH " : "getChi2 ") << ns << " ns" << std::endl;
+}
+
+static void BenchThreads(LRModel *lrm, const std::vector <std::vector <double> > &events, double ecal)
+{
+    int nmax = std::max(1u, std::thread::hardware_concurrency());
+    std::vector <int> counts;
+    for (int nt=1; nt<nmax; nt*=2)
+        counts.push_back(nt);
+    counts.push_back(nmax);
+
+    std::vector <bool> sat(lrm->GetSensorCount(), false);
+    std::vector <RecResult> result;
+    double rate1 = 0.;
+
+    std::cout << "  threads:";
+    for (int nt : counts) {
+        ParallelReconstructor prec(lrm, nt);
+        prec.Configure([ecal](Reconstructor *r) {
+            r->setAnalyticGradient(true);
+            r->setCogRelCutoff(0.1);
+            r->setEnergyCalibration(ecal);
+        });
+        prec.InitMinimizer();
+        double t0 = Now();
+        prec.ProcessEvents(events, sat, result);
+        double rate = events.size()/(Now()-t0);
+        if (nt == 1)
+            rate1 = rate;
+        std::cout << "  " << nt << ": " << rate << " ev/s (x" << rate/rate1 << ")";
+    }
+    std::cout << std::endl;
+}
+
+// spline fits on the flood data of the first group, i.e. what FitGroup() spends its time on
+static void BenchFits(LRModel *lrm, const std::vector <std::vector <double> > &events,
+                      const std::vector <std::array <double, 2> > &xy)
+{
+    LRFaxial *lrf = dynamic_cast <LRFaxial*> (lrm->GetLRF(0));
+    if (!lrf)
+        return;
+    std::vector <double> vr, va;
+    for (int i=0; i<(int)events.size(); i++) {
+        if (!lrf->inDomain(xy[i][0], xy[i][1]))
+            continue;
+        vr.push_back(lrf->Rho(xy[i][0], xy[i][1]));
+        va.push_back(events[i][0]);
+    }
+    Bspline1d bs(*lrf->getSpline());
+
+    BSfit1D plain(&bs);
+    plain.AddData(vr, va);
+    double t_plain = TimeOp(200, [&](int) {return plain.BinnedFit() ? 1. : 0.;});
+
+    ConstrainedFit1D cf(&bs);
+    cf.ForceNonNegative();
+    cf.ForceNonIncreasing();
+    cf.FixDrvLeft(0.);
+    cf.AddData(vr, va);
+    double t_cf = TimeOp(200, [&](int) {return cf.BinnedFit() ? 1. : 0.;});
+// the linear system stays in place after BinnedFit(), so it can be solved again on its own
+    double t_solve = TimeOp(200, [&](int) {return cf.SolveLinSystem() ? 1. : 0.;});
+
+    std::cout << "  BSfit1D::BinnedFit " << t_plain*1e-3 << " us, ConstrainedFit1D::BinnedFit "
+              << t_cf*1e-3 << " us, ConstrainedFit1D::SolveLinSystem " << t_solve*1e-3 << " us" << std::endl;
+}
+
+static void BenchEval(LRModel *lrm)
+{
+    int n = lrm->GetSensorCount();
+    LRFaxial *lrf = dynamic_cast <LRFaxial*> (lrm->GetLRF(0));
+    const Bspline1d *bs = lrf->getSpline();
+    double rmax = lrf->getRmax();
+    double xmax = bs->GetXmax();
+    const int N = 1000000;
+
+    double t_bs = TimeOp(N, [&](int i) {return bs->Eval(xmax*(i%1000)*1e-3);});
+    double t_lrf = TimeOp(N, [&](int i) {return lrf->eval(rmax*(i%1000)*1e-3, 1.);});
+    double t_lrm = TimeOp(N, [&](int i) {
+        double pos[3] = {(i%100)*0.1, (i%77)*0.1, 0.};
+        return lrm->Eval(i%n, pos);
+    });
+
+    std::cout << "  Bspline1d::Eval " << t_bs << " ns, LRFaxial::eval " << t_lrf
+              << " ns, LRModel::Eval " << t_lrm << " ns" << std::endl;
+}
+
+static void BenchJson(LRModel *lrm)
+{
+    std::string json_str;
+    double t_save = TimeOp(5, [&](int) {json_str = lrm->GetJsonString(); return json_str.size();});
+    double t_load = TimeOp(5, [&](int) {
+        std::string s = json_str;
+        LRModel m(s);
+        return m.GetSensorCount();
+    });
+    std::cout << "  JSON save " << t_save*1e-6 << " ms, load " << t_load*1e-6 << " ms ("
+              << json_str.size()/1024 << " kB)" << std::endl;
+}
+
+static int RunSuite(bool quick)
+{
+    std::vector <ArraySpec> specs;
+    specs.push_back(ArraySpec{"hex", true, 2});         // 19
+    specs.push_back(ArraySpec{"square", false, 8});     // 64
+    specs.push_back(ArraySpec{"hex", true, 6});         // 127
+    if (!quick) {
+        specs.push_back(ArraySpec{"square", false, 16});    // 256
+        specs.push_back(ArraySpec{"hex", true, 18});        // 1027
+        specs.push_back(ArraySpec{"square", false, 32});    // 1024
+    }
+
+    for (const ArraySpec &spec : specs) {
+        LRModel *lrm = MakeArray(spec);
+        int n = lrm->GetSensorCount();
+        std::cout << spec.name << " array, " << n << " sensors, " << lrm->GetGroupCount() << " groups" << std::endl;
+
+        std::vector <std::vector <double> > events;
+        std::vector <std::array <double, 2> > xy;
+        MakeEvents(lrm, 20000, 1, events, xy);
+        double t0 = Now();
+        FitModel(lrm, events, xy);
+        std::cout << "  calibration (FitAll, 20000 events): " << (Now()-t0)*1e3 << " ms" << std::endl;
+
+// energy scale: sum signal of an average event corresponds to E = 1
+        double sum = 0.;
+        for (auto &e : events)
+            for (double a : e)
+                sum += a;
+        double ecal = events.size()/sum;
+
+        MakeEvents(lrm, quick ? 500 : 2000, 2, events, xy);
+        BenchEval(lrm);
+        BenchFits(lrm, events, xy);
+        BenchReconstruction(lrm, events, xy, Reconstructor::LS, ecal);
+        BenchReconstruction(lrm, events, xy, Reconstructor::ML, ecal);
+        BenchThreads(lrm, events, ecal);
+        BenchJson(lrm);
+        delete lrm;
+    }
+    return 0;
+}
+
+static int RunFlood()
+{
+    std::vector <std::vector <double> > Data;
+    if (!LoadFlood("Simulation_10k.txt", Data)) {
+        std::cout << "Unpack data/Simulation_10k.txt.zip into work directory first" << std::endl;
+        return 1;
+    }
+
+    std::cout << "LRF fitting" << std::endl;
+    BenchFitting(Data);
+
+    std::vector <LRFdata> d0;
+    LRModel *lrm = MakeSquare8x8(Data, d0);
+    lrm->FitAll(d0, Data);
+
+    LRSensorPack::Kernel best = LRSensorPack::GetKernel();
+    std::cout << "Minuit2 gradient: numeric vs analytic, "
+              << LRSensorPack::GetKernelName(best) << " LRF kernel" << std::endl;
+    for (auto method : {Reconstructor::LS, Reconstructor::ML}) {
+        BenchGradient(lrm, Data, method, false);
+        BenchGradient(lrm, Data, method, true);
+    }
+
+    std::cout << "Energy: free parameter vs profiled out" << std::endl;
+    for (auto method : {Reconstructor::LS, Reconstructor::ML})
+        for (bool analytic : {false, true}) {
+            BenchGradient(lrm, Data, method, analytic, false);
+            BenchGradient(lrm, Data, method, analytic, true);
+        }
+
+    std::cout << "Minimizer: Minuit2 vs built-in Levenberg-Marquardt" << std::endl;
+    for (auto method : {Reconstructor::LS, Reconstructor::ML}) {
+        BenchGradient(lrm, Data, method, true, false, Reconstructor::Minuit);
+        BenchGradient(lrm, Data, method, true, false, Reconstructor::LevMar);
+    }
+
+    CompiledLRModel clrm(lrm);
+    ResponseMap map(clrm, 2., 4.);
+    std::cout << "Initial guess: CoG vs response map (" << map.GetNodeCount() << " nodes, "
+              << map.GetMemory()/1024 << " kB)" << std::endl;
+    for (auto engine : {Reconstructor::Minuit, Reconstructor::LevMar}) {
+        BenchGradient(lrm, Data, Reconstructor::LS, true, false, engine);
+        BenchGradient(lrm, Data, Reconstructor::LS, true, false, engine, &map);
+    }
+
+    std::cout << "LRF kernels (LS, analytic gradient)" << std::endl;
+    for (auto k : {LRSensorPack::Scalar, LRSensorPack::AVX2, LRSensorPack::AVX512}) {
+        if (k > best)
+            break;
+        LRSensorPack::SetKernel(k);
+        std::cout << LRSensorPack::GetKernelName(k) << ": ";
+        BenchGradient(lrm, Data, Reconstructor::LS, true);
+    }
+    LRSensorPack::SetKernel(LRSensorPack::Auto);
+    std::cout << "tabulated: ";
+    BenchGradient(lrm, Data, Reconstructor::LS, true, false, Reconstructor::Minuit, nullptr, 0.5);
+
+    std::cout << "Event ingestion" << std::endl;
+    BenchEventIO("Simulation_10k.txt");
+    BenchStreaming(lrm);
+
+    std::cout << "Model startup time" << std::endl;
+    for (int n : {64, 1000, 10000})
+        BenchStartup(lrm, n);
+
+    delete lrm;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "suite") == 0)
+        return RunSuite(argc > 2 && strcmp(argv[2], "quick") == 0);
+    return RunFlood();
+}
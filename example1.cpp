@@ -10,6 +10,7 @@
 #include "bspline123d.h"
 #include "bsfit123.h"
 #include "reconstructor.h"
+#include "eventsource.h"
 #include <cmath>
 
 int main()
@@ -59,20 +60,20 @@ int main()
     // format: a0, ... a63, nPhotons, x, y
     std::vector <std::vector <double> > Data;
 
-    std::ifstream f("Simulation_10k.txt");
-    if (!f.good()) {
+    TextEventSource src("Simulation_10k.txt", 64);
+    if (!src.IsValid()) {
         std::cout << "Unpack data/Simulation_10k.txt.zip into work directory first" << std::endl;
         return 1;
     }
-    std::string line;
-    while (std::getline(f, line)) {
-        std::vector <double> evt;
-        std::istringstream iss(line); //put line into stringstream
-        double val;
-        while(iss >> val) //read word by word
-            evt.push_back(val);
-        Data.push_back(evt);
-        evt.clear();
+    EventChunk chunk(1000, 64); // events are read 1000 at a time
+    while (src.ReadChunk(chunk)) {
+        for (int i=0; i<chunk.nevents; i++) {
+            std::vector <double> evt(chunk.GetSignals(i), chunk.GetSignals(i)+64);
+            evt.push_back(chunk.photons[i]);
+            evt.push_back(chunk.x[i]);
+            evt.push_back(chunk.y[i]);
+            Data.push_back(evt);
+        }
     }
 
 // 5. Fit the LRFs to the flood data
@@ -88,12 +89,11 @@ int main()
 //        std::cout << lrm.GetGroupMaxR(i, d0) << std::endl;
     }
 
-    for (int j=0; j<64; j++) {
-        for (int i=0; i<d0.size(); i++) {
-            d0[i][3] = Data[i][j];
-        }
-        lrm.AddFitData(j, d0);
-    }
+// one pass over the events, Data rows start with the 64 signals
+    std::vector <std::array <double, 2> > truth_xy;
+    for (auto &q : Data)
+        truth_xy.push_back({q[65], q[66]});
+    lrm.AddFloodEvents(Data, truth_xy);
 
     for (int i=0; i<lrm.GetGroupCount(); i++)
         lrm.FitGroup(i);
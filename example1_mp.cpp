@@ -10,8 +10,9 @@
 #include "bspline123d.h"
 #include "bsfit123.h"
 #include "reconstructor.h"
+#include "eventsource.h"
+#include "parallelreconstructor.h"
 #include <cmath>
-#include "omp.h"
 
 int main()
 {
@@ -60,20 +61,20 @@ int main()
     // format: a0, ... a63, nPhotons, x, y
     std::vector <std::vector <double> > Data;
 
-    std::ifstream f("Simulation_10k.txt");
-    if (!f.good()) {
+    TextEventSource src("Simulation_10k.txt", 64);
+    if (!src.IsValid()) {
         std::cout << "Unpack data/Simulation_10k.txt.zip into work directory first" << std::endl;
         return 1;
     }
-    std::string line;
-    while (std::getline(f, line)) {
-        std::vector <double> evt;
-        std::istringstream iss(line); //put line into stringstream
-        double val;
-        while(iss >> val) //read word by word
-            evt.push_back(val);
-        Data.push_back(evt);
-        evt.clear();
+    EventChunk chunk(1000, 64); // events are read 1000 at a time
+    while (src.ReadChunk(chunk)) {
+        for (int i=0; i<chunk.nevents; i++) {
+            std::vector <double> evt(chunk.GetSignals(i), chunk.GetSignals(i)+64);
+            evt.push_back(chunk.photons[i]);
+            evt.push_back(chunk.x[i]);
+            evt.push_back(chunk.y[i]);
+            Data.push_back(evt);
+        }
     }
 
 // 5. Fit the LRFs to the flood data
@@ -89,15 +90,8 @@ int main()
 //        std::cout << lrm.GetGroupMaxR(i, d0) << std::endl;
     }
 
-    for (int j=0; j<64; j++) {
-        for (int i=0; i<d0.size(); i++) {
-            d0[i][3] = Data[i][j];
-        }
-        lrm.AddFitData(j, d0);
-    }
-
-    for (int i=0; i<lrm.GetGroupCount(); i++)
-        lrm.FitGroup(i);
+// fill the histograms and fit the groups in parallel, Data rows start with the 64 signals
+    lrm.FitAll(d0, Data);
 
     std::cout << std::endl << "--------------------------------------------------" << std::endl << std::endl;
 
@@ -139,46 +133,25 @@ int main()
     datafile << lrm.GetJsonString();
     datafile.close();
 
-// 8. OpenMP multithreading
-    const int Nthr = 3; // number of threads
-    std::vector <int> status;
-    std::vector <std::array <double, 4> > Result;
-    status.resize(Data.size());
-    Result.resize(Data.size());
-    Reconstructor* recomp[Nthr];
-    int jmin[Nthr], jmax[Nthr];
-    int chunk = Data.size()/Nthr;
-    for (int i=0; i<Nthr; i++) {
-        jmin[i] = i*chunk;
-        jmax[i] = (i+1)*chunk;
-        std::cout << jmin[i] << ", " << jmax[i] << std::endl;
-    }
-    jmax[Nthr-1] = Data.size();
-
-    #pragma omp parallel for
-    for (int i=0; i<Nthr; i++) {
-        recomp[i] = new Reconstructor(&lrm);
-        recomp[i]->InitMinimizer();
-        recomp[i]->setCogRelCutoff(0.1);
-        recomp[i]->setEnergyCalibration(0.005);
-
-        for (int j=jmin[i]; j<jmax[i]; j++) {
-            recomp[i]->ProcessEvent(Data[j], sat);
-            status[j] = recomp[i]->getRecStatus();
-            Result[j][0] = Data[j][65];
-            Result[j][1] = recomp[i]->getRecX();
-            Result[j][2] = Data[j][66];
-            Result[j][3] = recomp[i]->getRecY();
-        }
-    }
+// 8. Multithreading: events are distributed dynamically over all available cores
+    ParallelReconstructor precon(&lrm);
+    precon.Configure([](Reconstructor *r) {
+        r->setCogRelCutoff(0.1);
+        r->setEnergyCalibration(0.005);
+    });
+    precon.InitMinimizer();
+    std::cout << "Reconstructing with " << precon.GetThreadCount() << " threads" << std::endl;
+
+    std::vector <RecResult> Result;
+    precon.ProcessEvents(Data, sat, Result);
 
     std::ofstream recfile_mp;
     recfile_mp.open ("reconstruction_mp.txt", std::ios_base::app);
     for (int i=0; i<Result.size(); i++) {
-        auto r = Result[i];
-        if (status[i])
+        RecResult &r = Result[i];
+        if (r.status)
             continue;
-        recfile_mp << r[0] << " " << r[1] << " " << r[2] << " " << r[3] << std::endl;
+        recfile_mp << Data[i][65] << " " << r.x << " " << Data[i][66] << " " << r.y << std::endl;
     }
     recfile_mp.close();
 
@@ -0,0 +1,117 @@
+#include "parallelreconstructor.h"
+#include "reconstructor.h"
+#include "lrmodel.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+ParallelReconstructor::ParallelReconstructor(LRModel *lrm, int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (nthreads <= 0)
+        nthreads = 1;
+
+    for (int i=0; i<nthreads; i++)
+        workers.push_back(new Reconstructor(lrm));
+}
+
+ParallelReconstructor::~ParallelReconstructor()
+{
+    for (Reconstructor *r : workers)
+        delete r;
+}
+
+void ParallelReconstructor::Configure(const std::function<void(Reconstructor*)> &setup)
+{
+    for (Reconstructor *r : workers)
+        setup(r);
+}
+
+// the workers are initialized one after another in the calling thread
+bool ParallelReconstructor::InitMinimizer()
+{
+    bool ok = true;
+    for (Reconstructor *r : workers)
+        ok = r->InitMinimizer() && ok;
+    return ok;
+}
+
+int ParallelReconstructor::dispatch(int nevents, const std::function<int(Reconstructor*, int, int)> &job)
+{
+    std::atomic <int> next(0);
+    std::atomic <int> nok(0);
+
+    auto work = [&](Reconstructor *r) {
+        int good = 0;
+        while (true) {
+            int first = next.fetch_add(chunk);
+            if (first >= nevents)
+                break;
+            good += job(r, first, std::min(first + chunk, nevents));
+        }
+        nok += good;
+    };
+
+    std::vector <std::thread> threads;
+    for (unsigned int i=1; i<workers.size(); i++)
+        threads.push_back(std::thread(work, workers[i]));
+    work(workers[0]); // the calling thread is a worker too
+    for (std::thread &t : threads)
+        t.join();
+
+    return nok;
+}
+
+int ParallelReconstructor::ProcessEvents(const std::vector <std::vector <double> > &data,
+                                         const std::vector <bool> &sat, std::vector <RecResult> &result)
+{
+    int nevents = data.size();
+    result.resize(nevents);
+
+    return dispatch(nevents, [&](Reconstructor *r, int first, int last) {
+        int good = 0;
+        for (int i=first; i<last; i++) {
+            RecResult &res = result[i];
+            bool ok = r->ProcessEvent(data[i], sat);
+            good += ok ? 1 : 0;
+            res.status = r->getRecStatus();
+            res.dof = r->getDof();
+            if (ok) {
+                res.x = r->getRecX();
+                res.y = r->getRecY();
+                res.e = r->getRecE();
+                res.z = r->getRecZ();
+                res.min = r->getRecMin();
+                res.cov_xx = r->getCovXX();
+                res.cov_yy = r->getCovYY();
+                res.cov_xy = r->getCovXY();
+                res.cov_ee = r->getCovEE();
+                res.cov_xe = r->getCovXE();
+                res.cov_ye = r->getCovYE();
+                res.cov_zz = r->getCovZZ();
+                res.cov_xz = r->getCovXZ();
+                res.cov_yz = r->getCovYZ();
+            }
+        }
+        return good;
+    });
+}
+
+int ParallelReconstructor::ProcessBatch(int nevents, const double *signals, int evt_stride, int sensor_stride,
+                                        const uint64_t *satmask, const RecBatchOutput &out)
+{
+    if (workers.empty()) {
+        if (out.status)
+            std::fill(out.status, out.status + nevents, -1);
+        if (out.dof)
+            std::fill(out.dof, out.dof + nevents, 0);
+        return 0;
+    }
+    int nwords = workers[0]->getSatMaskWords();
+
+    return dispatch(nevents, [&](Reconstructor *r, int first, int last) {
+        return r->ProcessBatch(last - first, signals + (size_t)first*evt_stride, evt_stride, sensor_stride,
+                               satmask ? satmask + (size_t)first*nwords : nullptr, out.Offset(first));
+    });
+}
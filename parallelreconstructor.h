@@ -0,0 +1,69 @@
+#ifndef PARALLELRECONSTRUCTOR_H
+#define PARALLELRECONSTRUCTOR_H
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+class LRModel;
+class Reconstructor;
+struct RecBatchOutput;
+
+struct RecResult
+{
+    int status;
+    double x;
+    double y;
+    double e;
+    double z;
+    double min;
+    int dof;
+    double cov_xx;
+    double cov_yy;
+    double cov_xy;
+    double cov_ee;
+    double cov_xe;
+    double cov_ye;
+    double cov_zz;
+    double cov_xz;
+    double cov_yz;
+};
+
+// Spreads event batches over a number of worker threads, each owning its
+// Reconstructor. The workers share one LRModel, which is only read during
+// reconstruction and must not be modified while ProcessEvents() is running.
+// Events are handed out in chunks from a shared counter, so faster threads
+// simply take more chunks.
+class ParallelReconstructor
+{
+public:
+    ParallelReconstructor(LRModel *lrm, int nthreads = 0); // 0 => hardware concurrency
+    ~ParallelReconstructor();
+    ParallelReconstructor(const ParallelReconstructor&) = delete;
+    ParallelReconstructor& operator=(const ParallelReconstructor&) = delete;
+
+// apply the same settings to all workers, e.g.
+// prec.Configure([](Reconstructor *r) {r->setCogRelCutoff(0.1);});
+    void Configure(const std::function<void(Reconstructor*)> &setup);
+    bool InitMinimizer();
+
+    int ProcessEvents(const std::vector <std::vector <double> > &data, const std::vector <bool> &sat,
+                      std::vector <RecResult> &result);
+// same layout conventions as Reconstructor::ProcessBatch()
+    int ProcessBatch(int nevents, const double *signals, int evt_stride, int sensor_stride,
+                     const uint64_t *satmask, const RecBatchOutput &out);
+
+    int GetThreadCount() const {return workers.size();}
+    Reconstructor *GetWorker(int i) {return workers.at(i);}
+    void SetChunkSize(int val) {chunk = val > 0 ? val : 1;}
+
+protected:
+// runs job(worker, first, last) over [0, nevents) in chunks, sums the returned counts
+    int dispatch(int nevents, const std::function<int(Reconstructor*, int, int)> &job);
+
+protected:
+    std::vector <Reconstructor*> workers;
+    int chunk = 64;     // events taken by a worker at a time
+};
+
+#endif // PARALLELRECONSTRUCTOR_H
@@ -1,29 +1,83 @@
 #include "reconstructor.h"
 #include "lrmodel.h"
+#include "lrcompiled.h"
+#include "lrpack.h"
+#include "responsemap.h"
 #include "TROOT.h"
 #include <iostream>
-
-static CostML *RecCostML = nullptr;
-static CostChi2 *RecCostChi2 = nullptr;
+#include <algorithm>
 
 Reconstructor::Reconstructor(LRModel *lrm)
 {
     this->lrm = lrm;
-    nsensors = lrm->GetSensorCount();
+    clrm = new CompiledLRModel(lrm);
+    Init();
+}
+
+// the model is evaluated directly from the mapped file, which must outlive the reconstructor
+Reconstructor::Reconstructor(const LRModelFile *file)
+{
+    lrm = nullptr;
+    clrm = new CompiledLRModel(file);
+    Init();
+}
+
+void Reconstructor::Init()
+{
+    nsensors = clrm->GetSensorCount();
     sensor.resize(nsensors);
-    active.resize(nsensors, true);
+    usemask.resize(nsensors);
     for (int i=0; i<nsensors; i++) {
-        sensor[i].x = lrm->GetX(i);
-        sensor[i].y = lrm->GetY(i);
+        sensor[i].x = clrm->GetX(i);
+        sensor[i].y = clrm->GetY(i);
         sensor[i].gain = 1.;
         sensor[i].on = true;
     }
     A.resize(nsensors);
     sat.resize(nsensors);
+    active_ids.resize(nsensors);
+    active_a.resize(nsensors);
+    lrf_val.resize(nsensors);
+    lrf_gx.resize(nsensors);
+    lrf_gy.resize(nsensors);
+    lrf_gz.resize(nsensors);
+    pack = new LRSensorPack();
+}
+
+Reconstructor::~Reconstructor()
+{
+    ClearMinimizer();
+    delete clrm;
+    delete pack;
 }
 
+void Reconstructor::ClearMinimizer()
+{
+    delete RootMinimizer;
+    delete FunctorLSML;
+    delete RecCostChi2;
+    delete RecCostML;
+    RootMinimizer = nullptr;
+    FunctorLSML = nullptr;
+    FunctorGrad = nullptr;
+    RecCostChi2 = nullptr;
+    RecCostML = nullptr;
+}
+
+// NB: gErrorIgnoreLevel is a ROOT global, so InitMinimizer() should not be
+// called concurrently from several threads
 bool Reconstructor::InitMinimizer()
 {
+    ClearMinimizer();
+    clrm->SetTabulation(tab_step, tab_tolerance);
+    clrm->Compile();
+    bool depth = clrm->GetZRange(&zmin, &zmax);
+    if (fFitZ && !depth)
+        return false;
+    if (fAutoGuessZ)
+        guess_z = depth ? 0.5*(zmin + zmax) : 0.;
+    fProfile = fProfileEnergy && !fFitZ;
+
     RootMinimizer = new ROOT::Minuit2::Minuit2Minimizer(ROOT::Minuit2::kMigrad);
     //RootMinimizer = new ROOT::Minuit2::Minuit2Minimizer(ROOT::Minuit2::kSimplex);
     RootMinimizer->SetMaxFunctionCalls(M2MaxFuncCalls);
@@ -34,17 +88,22 @@ bool Reconstructor::InitMinimizer()
     RootMinimizer->SetPrintLevel(MinuitPrintLevel);
     gErrorIgnoreLevel = RootPrintLevel;
 
-    if (method == ML) {
-        RecCostML = new CostML(this);
-        FunctorLSML = new ROOT::Math::Functor(*RecCostML, 3);
-        LastMiniValue = 1.e100; // reset for the new event
+    int ndim = fProfile ? 2 : fFitZ ? 4 : 3;
+    if (fAnalyticGradient) {
+        FunctorLSML = FunctorGrad = new GradFunctor(this, method, fProfile, fFitZ);
+    } else if (method == ML) {
+        RecCostML = new CostML(this, fProfile, fFitZ);
+        FunctorLSML = new ROOT::Math::Functor(*RecCostML, ndim);
     } else {
-        RecCostChi2 = new CostChi2(this);
-        FunctorLSML = new ROOT::Math::Functor(*RecCostChi2, 3);
-        LastMiniValue = 1.e6; //reset for the new event
+        RecCostChi2 = new CostChi2(this, fProfile, fFitZ);
+        FunctorLSML = new ROOT::Math::Functor(*RecCostChi2, ndim);
     }
 
-    RootMinimizer->SetFunction(*FunctorLSML);
+// the gradient overload must be selected by the static type, otherwise the gradient is not used
+    if (FunctorGrad)
+        RootMinimizer->SetFunction(*FunctorGrad);
+    else
+        RootMinimizer->SetFunction(*FunctorLSML);
     return true;
 }
 
@@ -54,44 +113,170 @@ void Reconstructor::checkActive()
     nactive = 0;
     int maxid = getMaxSignalID();
     double cutoff = std::max(rec_abs_cutoff, A[maxid]*rec_rel_cutoff);
-    for (int i=0; i<nsensors; i++) {
+// candidates within the cutoff radius from the grid, all sensors if the radius is not set
+    int ncand = nsensors;
+    if (rec_cutoff_radius < 1.0e12) {
+        if (grid.GetRequestedCell() != rec_cutoff_radius) {
+            std::vector <double> x(nsensors), y(nsensors);
+            for (int i=0; i<nsensors; i++) {
+                x[i] = sensor[i].x;
+                y[i] = sensor[i].y;
+            }
+            grid.Build(x, y, rec_cutoff_radius);
+        }
+        ncand = grid.Query(guess_x, guess_y, rec_cutoff_radius, active_ids.data());
+    } else {
+        for (int i=0; i<nsensors; i++)
+            active_ids[i] = i;
+    }
 // sensor is active if it's enabled AND (NOT saturated) AND above the cutoff
-        active[i] = sensor[i].on && !sat[i] && A[i] > cutoff;
-// AND within cutoff radius
-        active[i] = active[i] && getDistFromSensor(i, guess_x, guess_y) <= rec_cutoff_radius;
-        nactive += active[i] ? 1 : 0;
+    for (int k=0; k<ncand; k++) {
+        int i = active_ids[k];
+        if (sensor[i].on && !sat[i] && A[i] > cutoff) {
+            active_ids[nactive] = i;
+            active_a[nactive++] = A[i];
+        }
     }
 }
 
-bool Reconstructor::ProcessEvent(std::vector <double> a, std::vector <bool> sat)
+bool Reconstructor::ProcessEvent(const std::vector <double> &a, const std::vector <bool> &sat)
 {
-    if (a.size() < nsensors || sat.size() < nsensors)
+    rec_ncalls = 0;
+    if (!RootMinimizer || a.size() < (size_t)nsensors || sat.size() < (size_t)nsensors) {
+        rec_status = -1;
+        rec_dof = 0;
         return false;
+    }
     for (int i=0; i<nsensors; i++) {
         A[i] = a[i]/sensor[i].gain;
         this->sat[i] = sat[i];
     }
 
+    return reconstruct();
+}
+
+// signals of event i, sensor j are at signals[i*evt_stride + j*sensor_stride]:
+// evt_stride = row length, sensor_stride = 1 for row-major (one event per row) data;
+// evt_stride = 1, sensor_stride = nevents for structure-of-arrays (one sensor per row) data
+// satmask holds (nsensors+63)/64 words per event, bit j set if sensor j is saturated;
+// pass nullptr if there is no saturation
+int Reconstructor::ProcessBatch(int nevents, const double *signals, int evt_stride, int sensor_stride,
+                                const uint64_t *satmask, const RecBatchOutput &out)
+{
+    if (!RootMinimizer) {
+        rec_status = -1;
+        rec_dof = 0;
+        if (out.status)
+            std::fill(out.status, out.status + nevents, -1);
+        if (out.dof)
+            std::fill(out.dof, out.dof + nevents, 0);
+        return 0;
+    }
+
+    int nwords = getSatMaskWords();
+    if (!satmask)
+        std::fill(sat.begin(), sat.end(), 0);
+    int nok = 0;
+    for (int ev=0; ev<nevents; ev++) {
+        const double *a = signals + (size_t)ev*evt_stride;
+        for (int i=0; i<nsensors; i++)
+            A[i] = a[(size_t)i*sensor_stride]/sensor[i].gain;
+        if (satmask) {
+            const uint64_t *mask = satmask + (size_t)ev*nwords;
+            for (int i=0; i<nsensors; i++)
+                sat[i] = (mask[i>>6] >> (i&63)) & 1;
+        }
+
+        rec_ncalls = 0;
+        bool ok = reconstruct();
+        nok += ok ? 1 : 0;
+
+        if (out.status) out.status[ev] = rec_status;
+        if (out.dof) out.dof[ev] = rec_dof;
+        if (!ok)
+            continue;
+        if (out.x) out.x[ev] = rec_x;
+        if (out.y) out.y[ev] = rec_y;
+        if (out.e) out.e[ev] = rec_e;
+        if (out.z) out.z[ev] = rec_z;
+        if (out.chi2) out.chi2[ev] = rec_min;
+        if (out.cov) {
+            double *c = out.cov + (size_t)ev*3;
+            c[0] = cov_xx;
+            c[1] = cov_yy;
+            c[2] = cov_xy;
+        }
+        if (out.cov_e) {
+            double *c = out.cov_e + (size_t)ev*3;
+            c[0] = cov_ee;
+            c[1] = cov_xe;
+            c[2] = cov_ye;
+        }
+        if (out.cov_z) {
+            double *c = out.cov_z + (size_t)ev*3;
+            c[0] = cov_zz;
+            c[1] = cov_xz;
+            c[2] = cov_yz;
+        }
+    }
+
+    return nok;
+}
+
+RecBatchOutput RecBatchOutput::Offset(int first) const
+{
+    RecBatchOutput o;
+    o.status = status ? status + first : nullptr;
+    o.x = x ? x + first : nullptr;
+    o.y = y ? y + first : nullptr;
+    o.e = e ? e + first : nullptr;
+    o.z = z ? z + first : nullptr;
+    o.chi2 = chi2 ? chi2 + first : nullptr;
+    o.dof = dof ? dof + first : nullptr;
+    o.cov = cov ? cov + (size_t)first*3 : nullptr;
+    o.cov_e = cov_e ? cov_e + (size_t)first*3 : nullptr;
+    o.cov_z = cov_z ? cov_z + (size_t)first*3 : nullptr;
+    return o;
+}
+
+// reconstruct the event currently loaded into A and sat
+bool Reconstructor::reconstruct()
+{
 // initial guess
-    guessByCOG();
-    guess_e = getSumSignal()*ecal;
+    if (!respmap || !guessByMap()) {
+        guessByCOG();
+        guess_e = getSumSignal()*ecal;
+    }
 
 // determine active sensors and see if there are enough for reconstruction
     checkActive();
-    rec_dof = nactive - 3;
+    rec_dof = nactive - (fFitZ ? 4 : 3);
     if (rec_dof < 1) {
         rec_status = 6;
         return false;
     }
+    fPacked = clrm->CanPack();
+    if (fPacked)
+        clrm->MakePack(nactive, active_ids.data(), *pack);
+
+    if (engine == LevMar && minimizeLM())
+        return true;
+    return minimizeMinuit();
+}
+
+bool Reconstructor::minimizeMinuit()
+{
+    LastMiniValue = method == ML ? 1.e100 : 1.e6; // reset for the new event
+    if (FunctorGrad)
+        FunctorGrad->Reset();
 
 // set initial variables to minimize
-    RootMinimizer->SetVariable(0, "x", guess_x, RMstepX);
-    RootMinimizer->SetVariable(1, "y", guess_y, RMstepY);
-    RootMinimizer->SetLowerLimitedVariable(2, "e", guess_e, guess_e*0.2, 1.0e-6);
+    setMinuitVariables(guess_x, guess_y, guess_e, guess_z);
 
     // do the minimization
     bool fOK = false;
     fOK = RootMinimizer->Minimize();
+    rec_ncalls += RootMinimizer->NCalls();
 
     if (fOK) {
         rec_status = 0 ;		// Reconstruction successfull
@@ -99,17 +284,25 @@ bool Reconstructor::ProcessEvent(std::vector <double> a, std::vector <bool> sat)
         const double *xs = RootMinimizer->X();
         rec_x = xs[0];
         rec_y = xs[1];
-        rec_e = xs[2];
+        rec_z = fFitZ ? xs[3] : guess_z;
+        if (fProfile)
+            getProfileChi2(rec_x, rec_y, &rec_e);
+        else
+            rec_e = xs[2];
         rec_min = RootMinimizer->MinValue();
 
-    // Calc Hessian matrix and get status
-        int ndim = RootMinimizer->NDim();
-        double cov[ndim*ndim];
-        RootMinimizer->Hesse();
-        RootMinimizer->GetCovMatrix(cov);
-        cov_xx = cov[0]; // first column first row
-        cov_yy = cov[ndim+1]; // second column second row
-        cov_xy = cov[1];      // second column first row
+        if (covmode == CovFisher) {
+            double f, g[4], H[4][4];
+            double p[4] = {rec_x, rec_y, rec_e, rec_z};
+            if (evalLM(p, f, g, H))
+                fisherCovariance(H);
+            else
+                clearCovariance();
+        } else if (covmode == CovHesse) {
+            hesseCovariance();
+        } else {
+            clearCovariance();
+        }
         return true;
     } else {
         rec_status = RootMinimizer->Status(); // reason why it has failed
@@ -117,6 +310,267 @@ bool Reconstructor::ProcessEvent(std::vector <double> a, std::vector <bool> sat)
     }
 }
 
+void Reconstructor::setMinuitVariables(double x, double y, double e, double z)
+{
+    RootMinimizer->SetVariable(0, "x", x, RMstepX);
+    RootMinimizer->SetVariable(1, "y", y, RMstepY);
+    if (!fProfile)
+        RootMinimizer->SetLowerLimitedVariable(2, "e", e, e*0.2, 1.0e-6);
+    if (fFitZ)
+        RootMinimizer->SetLimitedVariable(3, "z", z, RMstepZ, zmin, zmax);
+}
+
+// numerical Hessian by Minuit2 at the current point of the minimizer
+void Reconstructor::hesseCovariance()
+{
+    int ndim = RootMinimizer->NDim();
+    double cov[ndim*ndim];
+    RootMinimizer->Hesse();
+    RootMinimizer->GetCovMatrix(cov);
+    cov_xx = cov[0]; // first column first row
+    cov_yy = cov[ndim+1]; // second column second row
+    cov_xy = cov[1];      // second column first row
+    if (fProfile) {
+        profileCovariance();
+    } else {
+        cov_ee = cov[2*ndim+2];
+        cov_xe = cov[2];
+        cov_ye = cov[ndim+2];
+    }
+    if (fFitZ) {
+        cov_zz = cov[3*ndim+3];
+        cov_xz = cov[3];
+        cov_yz = cov[ndim+3];
+    } else {
+        cov_zz = cov_xz = cov_yz = 0.;
+    }
+}
+
+void Reconstructor::clearCovariance()
+{
+    cov_xx = cov_yy = cov_xy = 0.;
+    cov_ee = cov_xe = cov_ye = 0.;
+    cov_zz = cov_xz = cov_yz = 0.;
+}
+
+// x = M^-1 b for symmetric positive definite n x n M (n <= 4), by Cholesky
+static bool solveSym(int n, const double (*M)[4], const double *b, double *x)
+{
+    double L[4][4], z[4];
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<=i; j++) {
+            double sum = M[i][j];
+            for (int k=0; k<j; k++)
+                sum -= L[i][k]*L[j][k];
+            if (i == j) {
+                if (!(sum > 0.))
+                    return false;
+                L[i][i] = sqrt(sum);
+            } else {
+                L[i][j] = sum/L[j][j];
+            }
+        }
+    }
+
+    for (int i=0; i<n; i++) {
+        double sum = b[i];
+        for (int k=0; k<i; k++)
+            sum -= L[i][k]*z[k];
+        z[i] = sum/L[i][i];
+    }
+    for (int i=n-1; i>=0; i--) {
+        double sum = z[i];
+        for (int k=i+1; k<n; k++)
+            sum -= L[k][i]*x[k];
+        x[i] = sum/L[i][i];
+    }
+    return true;
+}
+
+// covariance 2*H^-1 from the expected Hessian (Fisher information) of evalLM(),
+// as from Minuit2 with ErrorDef = 1
+void Reconstructor::fisherCovariance(const double (*H)[4])
+{
+    int n = fFitZ ? 4 : 3;
+    double cov[4][4];
+    for (int i=0; i<n; i++) {
+        double b[4] = {0., 0., 0., 0.};
+        b[i] = 2.;
+        if (!solveSym(n, H, b, cov[i])) {
+            clearCovariance();
+            return;
+        }
+    }
+    cov_xx = cov[0][0];
+    cov_yy = cov[1][1];
+    cov_xy = cov[0][1];
+    cov_ee = cov[2][2];
+    cov_xe = cov[0][2];
+    cov_ye = cov[1][2];
+    if (fFitZ) {
+        cov_zz = cov[3][3];
+        cov_xz = cov[0][3];
+        cov_yz = cov[1][3];
+    } else {
+        cov_zz = cov_xz = cov_yz = 0.;
+    }
+}
+
+// observed Hessian of the LM cost at p by central differences of its analytic gradient,
+// the counterpart of Minuit2 Hesse() for the events reconstructed without Minuit2
+bool Reconstructor::numericHessian(const double *p, double (*H)[4])
+{
+    int n = fFitZ ? 4 : 3;
+    double step[4] = {RMstepX, RMstepY, 1e-3*p[2], RMstepZ};
+    for (int j=0; j<n; j++) {
+        double pp[4], pm[4], f, gp[4], gm[4], Hs[4][4];
+        std::copy(p, p+4, pp);
+        std::copy(p, p+4, pm);
+        pp[j] += 1e-4*step[j];
+        pm[j] -= 1e-4*step[j];
+        if (j == 3) {
+            pp[3] = std::min(pp[3], zmax);
+            pm[3] = std::max(pm[3], zmin);
+        }
+        if (!evalLM(pp, f, gp, Hs) || !evalLM(pm, f, gm, Hs))
+            return false;
+        for (int i=0; i<n; i++)
+            H[i][j] = (gp[i] - gm[i])/(pp[j] - pm[j]);
+    }
+    for (int i=0; i<n; i++)
+        for (int j=0; j<i; j++)
+            H[i][j] = H[j][i] = 0.5*(H[i][j] + H[j][i]);
+    return true;
+}
+
+// Levenberg-Marquardt over (x, y, energy[, z]) with the expected Hessian, i.e. Gauss-Newton for LS
+// and Fisher scoring for ML. Stops when the estimated distance to minimum (the decrease
+// promised by the undamped step) is below LMTolerance. The Hesse covariance is calculated
+// from the numerical Hessian of the cost at the found minimum, see numericHessian().
+bool Reconstructor::minimizeLM()
+{
+    int n = fFitZ ? 4 : 3;
+    double p[4] = {guess_x, guess_y, guess_e, guess_z};
+    double f, g[4], H[4][4];
+    rec_ncalls++;
+    if (!evalLM(p, f, g, H))
+        return false;
+
+    double lambda = 1e-3;
+    bool converged = false;
+    for (int it=0; it<LMMaxIterations; it++) {
+        double d[4];
+        if (!solveSym(n, H, g, d))
+            return false;
+        double dist = 0.;
+        for (int i=0; i<n; i++)
+            dist += 0.5*g[i]*d[i];
+        if (dist < LMTolerance) {
+            converged = true;
+            break;
+        }
+
+// increase damping until the step goes downhill (and stays within the z range)
+        double pt[4], ft, gt[4], Ht[4][4];
+        pt[3] = p[3];
+        while (true) {
+            double M[4][4];
+            for (int i=0; i<n; i++)
+                for (int j=0; j<n; j++)
+                    M[i][j] = H[i][j]*(i == j ? 1. + lambda : 1.);
+            if (!solveSym(n, M, g, d))
+                return false;
+            for (int i=0; i<n; i++)
+                pt[i] = p[i] - d[i];
+            if (pt[2] > 0. && (!fFitZ || (pt[3] >= zmin && pt[3] <= zmax))) {
+                rec_ncalls++;
+                if (evalLM(pt, ft, gt, Ht) && ft <= f)
+                    break;
+            }
+            lambda *= 10.;
+            if (lambda > 1e10)
+                return false;
+        }
+        lambda = std::max(lambda*0.1, 1e-9);
+        std::copy(pt, pt+4, p);
+        std::copy(gt, gt+4, g);
+        std::copy(&Ht[0][0], &Ht[0][0]+16, &H[0][0]);
+        f = ft;
+    }
+    if (!converged)
+        return false;
+
+    rec_status = 0;
+    rec_x = p[0];
+    rec_y = p[1];
+    rec_e = p[2];
+    rec_z = p[3];
+    rec_min = f;
+    if (covmode == CovFisher) {
+        fisherCovariance(H);
+    } else if (covmode == CovHesse) {
+        double Hn[4][4];
+        if (numericHessian(p, Hn))
+            fisherCovariance(Hn);
+        else
+            clearCovariance();
+    } else {
+        clearCovariance();
+    }
+    return true;
+}
+
+// with mu = LRF*energy for each sensor, F = sum(F_k(mu_k)) and
+//    grad F = sum(dF_k/dmu * grad mu),  H = sum(<d2F_k/dmu2> * grad mu * grad mu')
+// where <d2F_k/dmu2> is taken at a = mu: 2 for LS, 2/mu for weighted LS and 1/mu for ML
+bool Reconstructor::evalLM(const double *p, double &f, double *grad, double (*H)[4])
+{
+    int n = fFitZ ? 4 : 3;
+    double e = p[2];
+    evalActiveGrad(p[0], p[1], p[3]);
+
+    f = 0.;
+    for (int i=0; i<4; i++) {
+        grad[i] = 0.;
+        H[i][0] = H[i][1] = H[i][2] = H[i][3] = 0.;
+    }
+    for (int k = 0; k < nactive; k++) {
+        double lrf = lrf_val[k];
+        double mu = lrf*e;
+        if (mu <= 0.)
+            return false;
+
+        double a = active_a[k];
+        double df, w; // dF_k/dmu and the expected d2F_k/dmu2
+        if (method == ML) {
+            f += mu - a*log(mu);
+            df = 1. - a/mu;
+            w = 1./mu;
+        } else if (fWeightedLS) {
+            double delta = mu - a;
+            f += delta*delta/mu;
+            df = 1. - a*a/(mu*mu);
+            w = 2./mu;
+        } else {
+            double delta = mu - a;
+            f += delta*delta;
+            df = 2.*delta;
+            w = 2.;
+        }
+
+        double dmu[4] = {lrf_gx[k]*e, lrf_gy[k]*e, lrf, fFitZ ? lrf_gz[k]*e : 0.};
+        for (int i=0; i<n; i++) {
+            grad[i] += df*dmu[i];
+            for (int j=0; j<=i; j++)
+                H[i][j] += w*dmu[i]*dmu[j];
+        }
+    }
+    for (int i=0; i<n; i++)
+        for (int j=0; j<i; j++)
+            H[j][i] = H[i][j];
+    return true;
+}
+
 int Reconstructor::getMaxSignalID()
 {
     auto strongest = std::max_element(std::begin(A), std::end(A));
@@ -146,6 +600,17 @@ void Reconstructor::guessByCOG()
     guess_y = sum_y/sum_dn;
 }
 
+// all enabled sensors which are not saturated take part in the matching,
+// energy is the scale of the best matching response
+bool Reconstructor::guessByMap()
+{
+    if (respmap->GetSensorCount() != nsensors)
+        return false;
+    for (int i=0; i<nsensors; i++)
+        usemask[i] = sensor[i].on && !sat[i];
+    return respmap->FindBest(A.data(), usemask.data(), guess_x, guess_y, guess_e);
+}
+
 double Reconstructor::getSumSignal()
 {
     double sum = 0.;
@@ -159,54 +624,330 @@ double Reconstructor::getDistFromSensor(int id, double x, double y)
   return hypot(x-sensor[id].x, y-sensor[id].y);
 }
 
+// the pack holds axial LRFs only, which do not depend on z
+void Reconstructor::evalActive(double x, double y, double z)
+{
+    if (fPacked)
+        pack->Eval(x, y, lrf_val.data());
+    else
+        clrm->EvalList(nactive, active_ids.data(), x, y, z, lrf_val.data());
+}
+
+void Reconstructor::evalActiveGrad(double x, double y, double z)
+{
+    if (fPacked)
+        pack->Eval(x, y, lrf_val.data(), lrf_gx.data(), lrf_gy.data());
+    else
+        clrm->EvalGradList(nactive, active_ids.data(), x, y, z, lrf_val.data(), lrf_gx.data(), lrf_gy.data(), lrf_gz.data());
+}
+
 double Reconstructor::getChi2(double x, double y, double z, double energy)
 {
-    double sum = 0;
-    double r[3];
-    r[0] = x; r[1] = y; r[2] = z;
-//    std::cout << "X:" << x << "    Y:" << y << "   E:" << energy << std::endl;
+    evalActive(x, y, z);
+    return chi2Active(energy);
+}
+
+double Reconstructor::getLogLH(double x, double y, double z, double energy)
+{
+    evalActive(x, y, z);
+    return logLHActive(energy);
+}
+
+// grad[0..2] = d/dx, d/dy, d/denergy
+double Reconstructor::getChi2Grad(double x, double y, double z, double energy, double *grad, double *grad_z)
+{
+    evalActiveGrad(x, y, z);
+    return chi2GradActive(energy, grad, grad_z);
+}
+
+// returns logLH and its gradient, the minimizer should use the negated values
+double Reconstructor::getLogLHGrad(double x, double y, double z, double energy, double *grad, double *grad_z)
+{
+    evalActiveGrad(x, y, z);
+    return logLHGradActive(energy, grad, grad_z);
+}
+
+// by the envelope theorem the gradient of a profile cost function over (x, y)
+// is the partial gradient of the full one at the optimal energy
+double Reconstructor::getProfileChi2(double x, double y, double *energy)
+{
+    evalActive(x, y, guess_z);
+    double e = bestEnergy();
+    if (energy)
+        *energy = e;
+    return chi2Active(e);
+}
+
+double Reconstructor::getProfileLogLH(double x, double y, double *energy)
+{
+    evalActive(x, y, guess_z);
+    double e = bestEnergy();
+    if (energy)
+        *energy = e;
+    return logLHActive(e);
+}
+
+double Reconstructor::getProfileChi2Grad(double x, double y, double *grad)
+{
+    evalActiveGrad(x, y, guess_z);
+    return chi2GradActive(bestEnergy(), grad);
+}
 
-    for (int i = 0; i < nsensors; i++) {
-        if (!active[i])
+double Reconstructor::getProfileLogLHGrad(double x, double y, double *grad)
+{
+    evalActiveGrad(x, y, guess_z);
+    return logLHGradActive(bestEnergy(), grad);
+}
+
+// d(cost)/d(energy) = 0 gives
+//    ML:          E = sum(a) / sum(f)
+//    weighted LS: E^2 = sum(a^2/f) / sum(f)
+//    LS:          E = sum(a*f) / sum(f^2)
+// Sensors with undefined LRFs are skipped (the cost functions return the penalty value then
+// anyway), so that the energy is still meaningful at the edge of the LRFs' range.
+double Reconstructor::bestEnergy()
+{
+    double sf = 0., sa = 0.;
+    for (int k = 0; k < nactive; k++) {
+        double f = lrf_val[k];
+        if (f <= 0.)
             continue;
+        double a = active_a[k];
+        if (method == ML) {
+            sf += f;
+            sa += a;
+        } else if (fWeightedLS) {
+            sf += f;
+            sa += a*a/f;
+        } else {
+            sf += f*f;
+            sa += a*f;
+        }
+    }
+    if (sf <= 0. || sa <= 0.)
+        return 0.;
+    return method == LS && fWeightedLS ? sqrt(sa/sf) : sa/sf;
+}
+
+// The minimized cost is F(x, y, E) with Hessian H = [Hpp h; h' hee] (p = x, y). Minuit returns
+// the covariance of the profile fit Cp = 2*up*(Hpp - h*h'/hee)^-1, which is already the (x, y)
+// block of the full one, 2*up*H^-1. The rest of it follows from block inversion:
+//    cov(p, E) = -Cp*h/hee,  var(E) = 2*up/hee + h'*Cp*h/hee^2
+// with hee and h calculated analytically at the minimum.
+void Reconstructor::profileCovariance()
+{
+    evalActiveGrad(rec_x, rec_y, rec_z);
+    double e = rec_e;
+    double hee = 0., hxe = 0., hye = 0.;
+    for (int k = 0; k < nactive; k++) {
+        double f = lrf_val[k];
+        if (f <= 0.)
+            continue;
+        double a = active_a[k];
+        double he; // d2F/dE d(f)
+        if (method == ML) {
+// F = sum(E*f - a*log(E*f))
+            hee += a/(e*e);
+            he = 1.;
+        } else if (fWeightedLS) {
+// F = sum((E*f - a)^2/(E*f))
+            hee += 2.*a*a/(e*e*e*f);
+            he = 1. + a*a/(e*e*f*f);
+        } else {
+// F = sum((E*f - a)^2)
+            hee += 2.*f*f;
+            he = 2.*(2.*e*f - a);
+        }
+        hxe += he*lrf_gx[k];
+        hye += he*lrf_gy[k];
+    }
+
+    double up = RootMinimizer->ErrorDef();
+    double cx = -(cov_xx*hxe + cov_xy*hye)/hee;
+    double cy = -(cov_xy*hxe + cov_yy*hye)/hee;
+    cov_xe = cx;
+    cov_ye = cy;
+    cov_ee = 2.*up/hee - (cx*hxe + cy*hye)/hee;
+}
 
-        double LRFhere = lrm->Eval(i, r)*energy; // LRF(X, Y, Z) * energy;
+double Reconstructor::chi2Active(double energy)
+{
+    double sum = 0;
+
+    for (int k = 0; k < nactive; k++) {
+        double LRFhere = lrf_val[k]*energy; // LRF(X, Y, Z) * energy;
         if (LRFhere <= 0.)
             return LastMiniValue *= 1.25; //if LRFs are not defined for this coordinates
 
-        double delta = (LRFhere - A[i]);
+        double delta = (LRFhere - active_a[k]);
         sum += fWeightedLS ? delta*delta/LRFhere : delta*delta;
     }
-//    std::cout << "Sum: " << sum << std::endl;
     return LastMiniValue = sum;
 }
 
-double Reconstructor::getLogLH(double x, double y, double z, double energy)
+double Reconstructor::logLHActive(double energy)
 {
     double sum = 0;
-    double r[3];
-    r[0] = x; r[1] = y; r[2] = z;
-
-    for (int i = 0; i < nsensors; i++) {
-        if (!active[i])
-            continue;
 
-        double LRFhere = lrm->Eval(i, r)*energy; // LRF(X, Y, Z) * energy;
-        if (LRFhere <= 0.)
-            return LastMiniValue *= 1.25; //if LRFs are not defined for this coordinates
+    for (int k = 0; k < nactive; k++) {
+        double LRFhere = lrf_val[k]*energy; // LRF(X, Y, Z) * energy;
+        if (LRFhere <= 0.) { //if LRFs are not defined for this coordinates
+            LastMiniValue += fabs(LastMiniValue)*0.25;
+            return -LastMiniValue;
+        }
 
-        sum += A[i]*log(LRFhere) - LRFhere; // measures probability
+        sum += active_a[k]*log(LRFhere) - LRFhere; // measures probability
     }
 
+// the minimizer works with -logLH
+    LastMiniValue = -sum;
+    return sum;
+}
+
+double Reconstructor::chi2GradActive(double energy, double *grad, double *gz)
+{
+    double sum = 0;
+    grad[0] = grad[1] = grad[2] = 0.;
+    double sz = 0.;
+    grad_undefined = false;
+
+    for (int k = 0; k < nactive; k++) {
+        double lrf = lrf_val[k];
+        double LRFhere = lrf*energy;
+        if (LRFhere <= 0.) { //if LRFs are not defined for this coordinates
+            grad[0] = grad[1] = grad[2] = 0.;
+            if (gz) *gz = 0.;
+            grad_undefined = true;
+            return LastMiniValue *= 1.25;
+        }
+
+        double a = active_a[k];
+        double delta = (LRFhere - a);
+        double dsum; // d(sum)/d(LRFhere)
+        if (fWeightedLS) {
+            sum += delta*delta/LRFhere;
+            dsum = 1. - a*a/(LRFhere*LRFhere);
+        } else {
+            sum += delta*delta;
+            dsum = 2.*delta;
+        }
+        grad[0] += dsum*lrf_gx[k]*energy;
+        grad[1] += dsum*lrf_gy[k]*energy;
+        grad[2] += dsum*lrf;
+        if (gz) sz += dsum*lrf_gz[k]*energy;
+    }
+    if (gz) *gz = sz;
     return LastMiniValue = sum;
 }
 
-double CostChi2::operator()(const double *p) // 0-x, 1-y, 2-energy
+double Reconstructor::logLHGradActive(double energy, double *grad, double *gz)
+{
+    double sum = 0;
+    grad[0] = grad[1] = grad[2] = 0.;
+    double sz = 0.;
+    grad_undefined = false;
+
+    for (int k = 0; k < nactive; k++) {
+        double lrf = lrf_val[k];
+        double LRFhere = lrf*energy;
+        if (LRFhere <= 0.) { //if LRFs are not defined for this coordinates
+            grad[0] = grad[1] = grad[2] = 0.;
+            if (gz) *gz = 0.;
+            grad_undefined = true;
+            LastMiniValue += fabs(LastMiniValue)*0.25;
+            return -LastMiniValue;
+        }
+
+        double a = active_a[k];
+        sum += a*log(LRFhere) - LRFhere;
+        double dsum = a/LRFhere - 1.; // d(sum)/d(LRFhere)
+        grad[0] += dsum*lrf_gx[k]*energy;
+        grad[1] += dsum*lrf_gy[k]*energy;
+        grad[2] += dsum*lrf;
+        if (gz) sz += dsum*lrf_gz[k]*energy;
+    }
+    if (gz) *gz = sz;
+
+    LastMiniValue = -sum;
+    return sum;
+}
+
+double CostChi2::operator()(const double *p) // 0-x, 1-y, 2-energy, 3-z
+{
+    if (profile)
+        return rec->getProfileChi2(p[0], p[1]);
+    return rec->getChi2(p[0], p[1], fitz ? p[3] : rec->getGuessZ(), p[2]);
+}
+
+double CostML::operator()(const double *p) // 0-x, 1-y, 2-energy, 3-z
+{
+    if (profile)
+        return -rec->getProfileLogLH(p[0], p[1]);
+    return -rec->getLogLH(p[0], p[1], fitz ? p[3] : rec->getGuessZ(), p[2]);
+}
+
+void GradFunctor::Update(const double *p) const
+{
+    int ndim = NDim();
+    if (cached && p[0] == last_p[0] && p[1] == last_p[1] && (profile || p[2] == last_p[2]) &&
+        (!fitz || p[3] == last_p[3]))
+        return;
+
+    double z = fitz ? p[3] : rec->getGuessZ();
+    double *gz = fitz ? &last_grad[3] : nullptr;
+    if (method == Reconstructor::ML) {
+        last_f = profile ? -rec->getProfileLogLHGrad(p[0], p[1], last_grad)
+                         : -rec->getLogLHGrad(p[0], p[1], z, p[2], last_grad, gz);
+        for (int i=0; i<ndim; i++)
+            last_grad[i] = -last_grad[i];
+    } else {
+        last_f = profile ? rec->getProfileChi2Grad(p[0], p[1], last_grad)
+                         : rec->getChi2Grad(p[0], p[1], z, p[2], last_grad, gz);
+    }
+
+    if (!rec->isGradUndefined()) {
+        for (int i=0; i<ndim; i++) {
+            valid_p[i] = p[i];
+            valid_scale[i] = i == 2 ? std::max(fabs(p[2])*0.2, 1.e-6) : 1.;  // as the minimizer steps
+        }
+        has_valid = true;
+    } else if (has_valid) {
+        double d2 = 0.;
+        for (int i=0; i<ndim; i++) {
+            double d = (p[i] - valid_p[i])/valid_scale[i];
+            d2 += d*d;
+            last_grad[i] = 2.*fabs(last_f)*d/valid_scale[i];
+        }
+        last_f += fabs(last_f)*d2;
+    }
+    for (int i=0; i<ndim; i++)
+        last_p[i] = p[i];
+    cached = true;
+}
+
+double GradFunctor::DoEval(const double *p) const // 0-x, 1-y, 2-energy
+{
+    Update(p);
+    return last_f;
+}
+
+double GradFunctor::DoDerivative(const double *p, unsigned int icoord) const
+{
+    Update(p);
+    return last_grad[icoord];
+}
+
+void GradFunctor::Gradient(const double *p, double *grad) const
 {
-    return rec->getChi2(p[0], p[1], 0., p[2]);
+    Update(p);
+    for (int i=0; i<(int)NDim(); i++)
+        grad[i] = last_grad[i];
 }
 
-double CostML::operator()(const double *p) // 0-x, 1-y, 2-energy
+void GradFunctor::FdF(const double *p, double &f, double *grad) const
 {
-    return rec->getLogLH(p[0], p[1], 0., p[2]);
+    Update(p);
+    f = last_f;
+    for (int i=0; i<(int)NDim(); i++)
+        grad[i] = last_grad[i];
 }
@@ -2,11 +2,21 @@
 #define RECONSTRUCTOR_H
 
 #include <vector>
+#include <cstdint>
 #include "TMath.h"
 #include "Math/Functor.h"
+#include "Math/IFunction.h"
 #include "Minuit2/Minuit2Minimizer.h"
+#include "sensorgrid.h"
 
 class LRModel;
+class LRModelFile;
+class CompiledLRModel;
+class LRSensorPack;
+class ResponseMap;
+class GradFunctor;
+class CostChi2;
+class CostML;
 
 struct RecSensor
 {
@@ -16,6 +26,28 @@ struct RecSensor
     bool on;
 };
 
+// Caller-provided output arrays for Reconstructor::ProcessBatch(), nevents long
+// (cov: 3 values per event - xx, yy, xy; cov_e: 3 values per event - ee, xe, ye;
+// cov_z: 3 values per event - zz, xz, yz, zero unless z is fitted).
+// Arrays left as nullptr are not filled.
+// Only status and dof are written for events that failed reconstruction.
+struct RecBatchOutput
+{
+    int *status = nullptr;
+    double *x = nullptr;
+    double *y = nullptr;
+    double *e = nullptr;
+    double *z = nullptr;
+    double *chi2 = nullptr;     // minimized value
+    int *dof = nullptr;
+    double *cov = nullptr;
+    double *cov_e = nullptr;
+    double *cov_z = nullptr;
+
+// the same arrays starting from event number first
+    RecBatchOutput Offset(int first) const;
+};
+
 class Reconstructor
 {
 public:
@@ -23,63 +55,160 @@ public:
         LS,            // least squares
         ML,            // maximum likelyhood
     };
+    enum Engine {
+        Minuit,        // ROOT Minuit2 (Migrad)
+        LevMar,        // built-in Levenberg-Marquardt, Minuit2 for the events it fails on
+    };
+    enum CovMode {
+        CovHesse,      // numerical Hessian at the minimum: by Minuit2, or from the analytic gradient for LM fits
+        CovFisher,     // analytic Fisher information at the minimum, one pass over the sensors
+        CovNone,       // no uncertainties, covariance is left zero
+    };
 
 public:
     Reconstructor(LRModel *lrm);
-    ~Reconstructor() {;}
+    Reconstructor(const LRModelFile *file);
+    ~Reconstructor();
+// owns the minimizer and the cost functions
+    Reconstructor(const Reconstructor&) = delete;
+    Reconstructor& operator=(const Reconstructor&) = delete;
 
     bool InitMinimizer();
-    bool ProcessEvent(std::vector <double> a, std::vector <bool> sat);
+    bool ProcessEvent(const std::vector <double> &a, const std::vector <bool> &sat);
+    int ProcessBatch(int nevents, const double *signals, int evt_stride, int sensor_stride,
+                     const uint64_t *satmask, const RecBatchOutput &out);
+    int getSatMaskWords() const {return (nsensors+63)/64;}
 
 // cost functions
     double getChi2(double x, double y, double z, double energy);
     double getLogLH(double x, double y, double z, double energy);
-
-// tracking of minimized value
-    double LastMiniValue;
+// cost functions with gradient over (x, y, energy), evaluated in one pass over the sensors,
+// and over z in *grad_z if not nullptr
+    double getChi2Grad(double x, double y, double z, double energy, double *grad, double *grad_z = nullptr);
+    double getLogLHGrad(double x, double y, double z, double energy, double *grad, double *grad_z = nullptr);
+// profile cost functions of (x, y) at z = getGuessZ(): energy is set to its optimum for the given position
+// (closed form for both methods) and returned in *energy if not nullptr;
+// grad has 3 elements as above, the one over energy is zero at the optimum
+    double getProfileChi2(double x, double y, double *energy = nullptr);
+    double getProfileLogLH(double x, double y, double *energy = nullptr);
+    double getProfileChi2Grad(double x, double y, double *grad);
+    double getProfileLogLHGrad(double x, double y, double *grad);
+// true if the last gradient evaluation hit undefined LRFs: the value returned is then
+// a penalty and the gradient is zero
+    bool isGradUndefined() const {return grad_undefined;}
 
 // public interface
 public:
     double getGuessX() {return guess_x;}
     double getGuessY() {return guess_y;}
     double getGuessE() {return guess_e;}
+    double getGuessZ() {return guess_z;}
     int getRecStatus() {return rec_status;}
     int getDof() {return rec_dof;}
+    int getNCalls() {return rec_ncalls;}
     double getRecX() {return rec_x;}
     double getRecY() {return rec_y;}
     double getRecE() {return rec_e;}
+    double getRecZ() {return rec_z;}
     double getRecMin() {return rec_min;}
-    double getChi2Min() {return getChi2(rec_x, rec_y, 0., rec_e);}
+    double getChi2Min() {return getChi2(rec_x, rec_y, rec_z, rec_e);}
     double getCovXX() {return cov_xx;}
     double getCovYY() {return cov_yy;}
     double getCovXY() {return cov_xy;}
+    double getCovEE() {return cov_ee;}
+    double getCovXE() {return cov_xe;}
+    double getCovYE() {return cov_ye;}
+    double getCovZZ() {return cov_zz;}
+    double getCovXZ() {return cov_xz;}
+    double getCovYZ() {return cov_yz;}
     void setCogAbsCutoff(double val) {cog_abs_cutoff = val;}
     void setCogRelCutoff(double val) {cog_rel_cutoff = val;}
     void setRecAbsCutoff(double val) {rec_abs_cutoff = val;}
     void setRecRelCutoff(double val) {rec_rel_cutoff = val;}
     void setRecCutoffRadius(double val) {rec_cutoff_radius = val;}
     void setEnergyCalibration(double val) {ecal = val;}
+// initial guess from the response map instead of CoG, nullptr => CoG; the map is not owned,
+// must be made from the same model and can be shared by several reconstructors
+    void setResponseMap(const ResponseMap *map) {respmap = map;}
     void setGain(int id, double val) {sensor.at(id).gain = val;}
+// the following take effect on the next call to InitMinimizer(),
+// which also refreshes the compiled snapshot of the LRModel
+    void setMethod(Method val) {method = val;}
+    void setAnalyticGradient(bool val) {fAnalyticGradient = val;}
+    void setProfileEnergy(bool val) {fProfileEnergy = val;}
+    void setEngine(Engine val) {engine = val;}
+    void setLMMaxIterations(int val) {LMMaxIterations = val;}
+    void setLMTolerance(double val) {LMTolerance = val;}
+    void setCovMode(CovMode val) {covmode = val;}
+// LRFs evaluated from tables with the given step and relative tolerance (see TabulatedLRF),
+// step = 0 => exact evaluation. Tables replace the virtual calls of generic LRFs and the scalar
+// evaluation of axial ones, but axial LRFs are faster with the SIMD kernels of LRSensorPack
+    void setLRFTabulation(double step, double tolerance = 1e-4) {tab_step = step; tab_tolerance = tolerance;}
+// depth of interaction: with setFitZ(true) (x, y, z, energy) are reconstructed, z limited to the
+// range of the LRFs depending on it (InitMinimizer() fails if there are none) and the profile
+// energy option ignored; otherwise the LRFs are evaluated at the fixed z guess
+    void setFitZ(bool val) {fFitZ = val;}
+// initial or fixed z, by default the middle of the z range of the LRFs
+    void setGuessZ(double val) {guess_z = val; fAutoGuessZ = false;}
 
 protected:
+    void Init();
+    bool reconstruct();
     LRModel *getLRModel() {return lrm;}
     void checkActive();
     double getSumSignal();
     int getMaxSignalID();
     void guessByMax();
     void guessByCOG();
+    bool guessByMap();
     double getDistFromSensor(int id, double x, double y);
+    void ClearMinimizer();
+    bool minimizeMinuit();
+    bool minimizeLM();
+    void setMinuitVariables(double x, double y, double e, double z);
+// covariance at the minimum
+    void hesseCovariance();
+    void fisherCovariance(const double (*H)[4]);
+    bool numericHessian(const double *p, double (*H)[4]);
+    void clearCovariance();
+// cost function at p = (x, y, energy[, z]) with its gradient and the expected Hessian (Fisher
+// scoring); false if the LRFs are not defined there
+    bool evalLM(const double *p, double &f, double *grad, double (*H)[4]);
+// LRFs of the active sensors at (x, y, z) into lrf_val (and lrf_gx, lrf_gy, lrf_gz)
+    void evalActive(double x, double y, double z);
+    void evalActiveGrad(double x, double y, double z);
+// cost functions (and gradients) over the values in lrf_val (and lrf_gx, lrf_gy, lrf_gz if gz)
+    double chi2Active(double energy);
+    double logLHActive(double energy);
+    double chi2GradActive(double energy, double *grad, double *gz = nullptr);
+    double logLHGradActive(double energy, double *grad, double *gz = nullptr);
+// optimal energy for the values in lrf_val
+    double bestEnergy();
+// E row of the full covariance from the (x, y) one of the profile fit
+    void profileCovariance();
 
 protected:
     LRModel *lrm;
+    CompiledLRModel *clrm;  // flattened copy of lrm used in the cost functions
+    LRSensorPack *pack;     // active sensors of the current event, for SIMD evaluation
+    bool fPacked = false;   // pack is used if all LRFs can be evaluated by the SIMD kernels
     int nsensors = 0;
     int nactive = 0;
 // cached sensor parameters
     std::vector <RecSensor> sensor;
-    std::vector <bool> active;
+    std::vector <char> usemask;     // sensors taken by the response map
+// active sensors of the current event, first nactive elements are valid
+    std::vector <int> active_ids;
+    std::vector <double> active_a;  // their signals
+    SensorGrid grid;        // sensor positions, for the cutoff radius
+// per-call buffers for LRF values and gradients of active sensors
+    std::vector <double> lrf_val;
+    std::vector <double> lrf_gx;
+    std::vector <double> lrf_gy;
+    std::vector <double> lrf_gz;
 // cached input parameters
     std::vector <double> A;
-    std::vector <bool> sat;
+    std::vector <char> sat;
 
 // CoG
     double cog_abs_cutoff = 0.;
@@ -89,7 +218,10 @@ protected:
     double guess_x;
     double guess_y;
     double guess_e;
+    double guess_z = 0.;
+    bool fAutoGuessZ = true;        // guess_z from the z range of the LRFs
     double ecal = 3.75e-5; // approximate scaling factor between SumSignal and energy
+    const ResponseMap *respmap = nullptr;
 
 // dynamic passives
     double rec_cutoff_radius = 1.0e12; // all by default
@@ -99,50 +231,116 @@ protected:
 // method
     Method method = LS;
     bool fWeightedLS = true;
+    bool fAnalyticGradient = false; // provide the minimizer with analytic gradient
+    bool fProfileEnergy = false;    // minimize over (x, y) only, with energy profiled out (Minuit2)
+    bool fProfile = false;          // fProfileEnergy in effect, i.e. not with fFitZ
+    bool fFitZ = false;             // minimize over (x, y, energy, z)
+    double zmin = 0., zmax = 0.;    // z range for fFitZ
+    Engine engine = Minuit;
+    CovMode covmode = CovHesse;
+    double tab_step = 0.;           // LRF tables, 0 => exact LRFs
+    double tab_tolerance = 1e-4;
+// tracking of minimized value (per event)
+    double LastMiniValue;
+    bool grad_undefined = false;
 
 // ROOT/Minuit stuff
-    ROOT::Math::Functor *FunctorLSML;
-    ROOT::Minuit2::Minuit2Minimizer *RootMinimizer;
+    CostChi2 *RecCostChi2 = nullptr;
+    CostML *RecCostML = nullptr;
+    ROOT::Math::IMultiGenFunction *FunctorLSML = nullptr;
+    GradFunctor *FunctorGrad = nullptr; // same object as FunctorLSML if analytic gradient is on
+    ROOT::Minuit2::Minuit2Minimizer *RootMinimizer = nullptr;
 // initial steps
     double RMstepX = 1.;
     double RMstepY = 1.;
+    double RMstepZ = 1.;
     double RMstepEnergy;
 // control over MINUIT2 stopping conditions
     int M2MaxFuncCalls = 500;       // Max function calls
     int M2MaxIterations = 1000; 	// Max iterations
     double M2Tolerance = 0.001;		// Iteration stops when the function is within <tolerance> from the (estimated) min/max
+// Levenberg-Marquardt stopping conditions
+    int LMMaxIterations = 100;
+    double LMTolerance = 1e-6;      // on the estimated distance to minimum, g'H^-1g/2
 // control over ROOT/MINUIT2 output
     int MinuitPrintLevel = 0;       // MINUIT2 messages
     int RootPrintLevel = 1001;      // ROOT messsages
 
 // reconstruction result
-    int rec_status;         // returned status of reconstruction
+    int rec_status = -1;    // 0 - success, 1..5 - Minuit2 status, 6 - too few active sensors,
+                            // -1 - not reconstructed: invalid input or minimizer not initialized
     double rec_x;			// reconstructed X position
     double rec_y;			// reconstructed Y position
     double rec_e;           // reconstructed energy
+    double rec_z;           // reconstructed (or fixed) z
     double rec_min;         // reduced best chi-squared from reconstruction
-    int rec_dof;			// degrees of freedom
+    int rec_dof = 0;		// degrees of freedom
+    int rec_ncalls = 0;     // number of cost function calls made by the minimizer
     double cov_xx;		// variance in x
     double cov_yy;		// variance in y
     double cov_xy;		// covariance xy
+    double cov_ee;		// variance in energy
+    double cov_xe;		// covariance x-energy
+    double cov_ye;		// covariance y-energy
+    double cov_zz;		// variance in z
+    double cov_xz;		// covariance xz
+    double cov_yz;		// covariance yz
 };
 
+// with profile = true the cost functions take (x, y) only,
+// with fitz = true (x, y, energy, z), otherwise (x, y, energy) with z fixed at the guess
 class CostChi2
 {
     public:
-        CostChi2(Reconstructor *r) : rec(r) {;}
+        CostChi2(Reconstructor *r, bool profile = false, bool fitz = false) : rec(r), profile(profile), fitz(fitz) {;}
         double operator()(const double *p);
     private:
         Reconstructor *rec;
+        bool profile;
+        bool fitz;
 };
 
 class CostML
 {
     public:
-        CostML(Reconstructor *r) : rec(r) {;}
+        CostML(Reconstructor *r, bool profile = false, bool fitz = false) : rec(r), profile(profile), fitz(fitz) {;}
         double operator()(const double *p);
     private:
         Reconstructor *rec;
+        bool profile;
+        bool fitz;
+};
+
+// Cost function with analytic gradient: value and gradient are calculated together
+// and cached, as Minuit2 usually asks for both at the same point
+class GradFunctor : public ROOT::Math::IMultiGradFunction
+{
+    public:
+        GradFunctor(Reconstructor *r, Reconstructor::Method m, bool profile = false, bool fitz = false) :
+            rec(r), method(m), profile(profile), fitz(fitz) {;}
+        virtual GradFunctor *Clone() const {return new GradFunctor(*this);}
+        virtual unsigned int NDim() const {return profile ? 2 : fitz ? 4 : 3;}
+        virtual void Gradient(const double *p, double *grad) const;
+        virtual void FdF(const double *p, double &f, double *grad) const;
+        void Reset() {cached = has_valid = false;} // must be called when the event data change
+    private:
+        virtual double DoEval(const double *p) const;
+        virtual double DoDerivative(const double *p, unsigned int icoord) const;
+        void Update(const double *p) const;
+    private:
+        Reconstructor *rec;
+        Reconstructor::Method method;
+        bool profile;   // over (x, y) only
+        bool fitz;      // over (x, y, energy, z)
+        mutable bool cached = false;
+        mutable double last_p[4];
+        mutable double last_f;
+        mutable double last_grad[4];
+// last point with the LRFs defined: outside of it the penalty grows quadratically with
+// the distance (in the units of scale) to that point, so the gradient leads back
+        mutable bool has_valid = false;
+        mutable double valid_p[4];
+        mutable double valid_scale[4];
 };
 
 #endif // RECONSTRUCTOR_H
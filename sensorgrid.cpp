@@ -0,0 +1,78 @@
+#include "sensorgrid.h"
+#include <cmath>
+#include <algorithm>
+
+void SensorGrid::Clear()
+{
+    requested = 0.;
+    nx = ny = 0;
+    px.clear();
+    py.clear();
+    first.clear();
+    ids.clear();
+}
+
+void SensorGrid::Build(const std::vector <double> &x, const std::vector <double> &y, double cell)
+{
+    Clear();
+    int n = std::min(x.size(), y.size());
+    if (n == 0 || !(cell > 0.))
+        return;
+    requested = cell;
+    px.assign(x.begin(), x.begin()+n);
+    py.assign(y.begin(), y.begin()+n);
+
+    double xmin = *std::min_element(px.begin(), px.end());
+    double xmax = *std::max_element(px.begin(), px.end());
+    double ymin = *std::min_element(py.begin(), py.end());
+    double ymax = *std::max_element(py.begin(), py.end());
+    double spacing = sqrt((xmax - xmin)*(ymax - ymin)/n);
+    this->cell = std::max(cell, spacing);
+    x0 = xmin;
+    y0 = ymin;
+    nx = (int)((xmax - xmin)/this->cell) + 1;
+    ny = (int)((ymax - ymin)/this->cell) + 1;
+
+// counting sort of the points by cell
+    std::vector <int> cellof(n);
+    first.assign(nx*ny + 1, 0);
+    for (int i=0; i<n; i++) {
+        int ix = std::min((int)((px[i] - x0)/this->cell), nx-1);
+        int iy = std::min((int)((py[i] - y0)/this->cell), ny-1);
+        cellof[i] = ix + iy*nx;
+        first[cellof[i]+1]++;
+    }
+    for (int c=0; c<nx*ny; c++)
+        first[c+1] += first[c];
+    ids.resize(n);
+    std::vector <int> pos(first.begin(), first.end()-1);
+    for (int i=0; i<n; i++)
+        ids[pos[cellof[i]]++] = i;
+}
+
+int SensorGrid::Query(double x, double y, double r, int *out) const
+{
+    if (first.empty() || !std::isfinite(x) || !std::isfinite(y) || !(r >= 0.))
+        return 0;
+// cell range clamped to the grid before the conversion to int
+    double xmax = nx-1, ymax = ny-1;
+    int ix0 = (int)std::min(xmax, std::max(0., floor((x - r - x0)/cell)));
+    int ix1 = (int)std::min(xmax, std::max(0., floor((x + r - x0)/cell)));
+    int iy0 = (int)std::min(ymax, std::max(0., floor((y - r - y0)/cell)));
+    int iy1 = (int)std::min(ymax, std::max(0., floor((y + r - y0)/cell)));
+
+    int n = 0;
+    double r2 = r*r;
+    for (int iy=iy0; iy<=iy1; iy++)
+        for (int ix=ix0; ix<=ix1; ix++) {
+            int c = ix + iy*nx;
+            for (int k=first[c]; k<first[c+1]; k++) {
+                int i = ids[k];
+                double dx = px[i] - x, dy = py[i] - y;
+                if (dx*dx + dy*dy <= r2)
+                    out[n++] = i;
+            }
+    }
+    std::sort(out, out+n);
+    return n;
+}
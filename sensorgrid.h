@@ -0,0 +1,32 @@
+#ifndef SENSORGRID_H
+#define SENSORGRID_H
+
+#include <vector>
+
+// Uniform grid of cells over a set of points (sensor positions) for radius queries.
+// The point indices are stored cell by cell in one array (cell i owns ids[first[i]..first[i+1]-1]),
+// so a query visits only the cells overlapping the square around the disc.
+class SensorGrid
+{
+public:
+// cell size is at least the mean spacing of the points, so there are no more cells than points
+    void Build(const std::vector <double> &x, const std::vector <double> &y, double cell);
+    void Clear();
+    bool IsEmpty() const {return first.empty();}
+    double GetRequestedCell() const {return requested;}
+
+// indices of the points within r from (x, y), in increasing order, written to out;
+// returns their number
+    int Query(double x, double y, double r, int *out) const;
+
+protected:
+    double requested = 0.;  // cell size passed to Build()
+    double cell = 1.;
+    double x0 = 0., y0 = 0.;
+    int nx = 0, ny = 0;
+    std::vector <double> px, py;
+    std::vector <int> first;    // nx*ny + 1 offsets into ids
+    std::vector <int> ids;
+};
+
+#endif // SENSORGRID_H
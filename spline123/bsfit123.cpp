@@ -8,6 +8,7 @@
 #include <Eigen/OrderingMethods>
 
 #include <iostream>
+#include <limits>
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
@@ -18,35 +19,54 @@ using Eigen::SparseMatrix;
 
 // ================ Constraints =================
 
-void Constraints::AddInequality(MatrixXd DI, VectorXd di0)
+void Constraints::AddInequality(const Terms &terms, double c0)
 {
-    if (ci0.size() == 0) { // first constraint -> just copy
-        CI = DI;
-        ci0 = di0;
-    } else { // not first -> append new columns
-        // resize is destructive, must store CI and ci0 temporarily
-        MatrixXd TI = CI;
-        VectorXd ti0 = ci0;
-        CI.resize(CI.rows(), CI.cols()+DI.cols());
-        ci0.resize(ci0.rows()+di0.rows());
-        CI << TI, DI;
-        ci0 << ti0, di0;
-    }
+    int row = ci0.size();
+    for (auto &t : terms)
+        if (t.second != 0.)
+            ti.push_back(Triplet<double>(row, t.first, t.second));
+    ci0.push_back(c0);
+}
+
+void Constraints::AddEquality(const Terms &terms, double c0)
+{
+    int row = ce0.size();
+    for (auto &t : terms)
+        if (t.second != 0.)
+            te.push_back(Triplet<double>(row, t.first, t.second));
+    ce0.push_back(c0);
 }
 
-void Constraints::AddEquality(MatrixXd DE, VectorXd de0)
+void Constraints::GetDense(MatrixXd &CI, VectorXd &ci0, MatrixXd &CE, VectorXd &ce0) const
 {
-    if (ce0.size() == 0) { // first constraint -> just copy
-        CE = DE;
-        ce0 = de0;
-    } else { // not first -> append new columns
-        // resize is destructive, must store CE and ce0 temporarily
-        MatrixXd TE = CE;
-        VectorXd te0 = ce0;
-        CE.resize(CE.rows(), CE.cols()+DE.cols());
-        ce0.resize(ce0.cols()+de0.cols());
-        CE << TE, DE;
-        ce0 << te0, de0;
+    CI = MatrixXd::Zero(nbas, this->ci0.size());
+    for (auto &t : ti)
+        CI(t.col(), t.row()) += t.value();
+    ci0 = Eigen::Map<const VectorXd> (this->ci0.data(), this->ci0.size());
+
+    CE = MatrixXd::Zero(nbas, this->ce0.size());
+    for (auto &t : te)
+        CE(t.col(), t.row()) += t.value();
+    ce0 = Eigen::Map<const VectorXd> (this->ce0.data(), this->ce0.size());
+}
+
+void Constraints::GetSparse(SparseQP::Constraints &C, VectorXd &l, VectorXd &u) const
+{
+    int ne = ce0.size();
+    int m = ne + ci0.size();
+    std::vector <Triplet<double> > trip(te);
+    for (auto &t : ti)
+        trip.push_back(Triplet<double>(t.row() + ne, t.col(), t.value()));
+    C.resize(m, nbas);
+    C.setFromTriplets(trip.begin(), trip.end());
+
+    l.resize(m);
+    u.resize(m);
+    for (int i=0; i<ne; i++)
+        l(i) = u(i) = -ce0[i];
+    for (int i=ne; i<m; i++) {
+        l(i) = -ci0[i-ne];
+        u(i) = std::numeric_limits<double>::infinity();
     }
 }
 
@@ -58,50 +78,26 @@ void Constraints::AddEquality(MatrixXd DE, VectorXd de0)
 
 void Constraints::SetMinimum(double min)
 {
-    MatrixXd TI = MatrixXd::Zero(nbas, nbas);
-    VectorXd ti0 = VectorXd::Constant(nbas, -min);
-
     for (int i = 0; i<nbas; i++)
-        TI(i, i) = 1.;
-
-    AddInequality(TI, ti0); 
+        AddInequality({{i, 1.}}, -min);
 }
 
 void Constraints::SetMaximum(double max)
 {
-    MatrixXd TI = MatrixXd::Zero(nbas, nbas);
-    VectorXd ti0 = VectorXd::Constant(nbas, max);
-
     for (int i = 0; i<nbas; i++)
-        TI(i, i) = -1.;
-
-    AddInequality(TI, ti0); 
+        AddInequality({{i, -1.}}, max);
 }
 
 void ConstrainedFit1D::ForceNonIncreasing()
 {
-    MatrixXd TI = MatrixXd::Zero(nbas, nbas);
-    VectorXd ti0 = VectorXd::Zero(nbas);
-
-    for (int i = 0; i<nbas-1; i++) {
-        TI(i, i) = 1.;
-        TI(i+1, i) = -1.;
-    }
-
-    cstr->AddInequality(TI, ti0);
+    for (int i = 0; i<nbas-1; i++)
+        cstr->AddInequality({{i, 1.}, {i+1, -1.}}, 0.);
 }
 
 void ConstrainedFit1D::ForceNonDecreasing()
 {
-    MatrixXd TI = MatrixXd::Zero(nbas, nbas);
-    VectorXd ti0 = VectorXd::Zero(nbas);
-
-    for (int i = 1; i<nbas; i++) {
-        TI(i, i) = 1.;
-        TI(i-1, i) = -1.;
-    }
-
-    cstr->AddInequality(TI, ti0);
+    for (int i = 1; i<nbas; i++)
+        cstr->AddInequality({{i, 1.}, {i-1, -1.}}, 0.);
 }
 
 void ConstrainedFit1D::FixAt(double x, double f)
@@ -109,13 +105,11 @@ void ConstrainedFit1D::FixAt(double x, double f)
     if (x < bs->GetXmin() || x > bs->GetXmax())
         return;
 
-    MatrixXd TE = MatrixXd::Zero(nbas, 1);
-    VectorXd te0 = VectorXd::Constant(1, -f);
-
+    Constraints::Terms terms;
     for (int k=0; k<nbas; k++)
-        TE(k, 0) = bs->Basis(x, k);
+        terms.push_back(std::make_pair(k, bs->Basis(x, k)));
     
-    cstr->AddEquality(TE, te0);
+    cstr->AddEquality(terms, -f);
 }
 
 void ConstrainedFit1D::FixDrvAt(double x, double f)
@@ -123,13 +117,11 @@ void ConstrainedFit1D::FixDrvAt(double x, double f)
     if (x < bs->GetXmin() || x > bs->GetXmax())
         return;
 
-    MatrixXd TE = MatrixXd::Zero(nbas, 1);
-    VectorXd te0 = VectorXd::Constant(1, -f);
-
+    Constraints::Terms terms;
     for (int k=0; k<nbas; k++)
-        TE(k, 0) = bs->BasisDrv(x, k);
+        terms.push_back(std::make_pair(k, bs->BasisDrv(x, k)));
     
-    cstr->AddEquality(TE, te0);
+    cstr->AddEquality(terms, -f);
 }
 
 void ConstrainedFit2D::ForceNonIncreasingX()
@@ -137,17 +129,11 @@ void ConstrainedFit2D::ForceNonIncreasingX()
     int nbasx = bs->GetBSX().GetNbas();
     int nbasy = bs->GetBSY().GetNbas();
 
-    MatrixXd TI = MatrixXd::Zero(nbas, nbas);
-    VectorXd ti0 = VectorXd::Zero(nbas);
-
     for (int iy = 0; iy<nbasy; iy++)
         for (int ix = 0; ix<nbasx-1; ix++) {
             int i = ix + iy*nbasx;
-            TI(i, i) = 1.;
-            TI(i+1, i) = -1.;
+            cstr->AddInequality({{i, 1.}, {i+1, -1.}}, 0.);
     }
-
-    cstr->AddInequality(TI, ti0);
 }
 
 void ConstrainedFit2D::SetSlopeY(int slope_y)
@@ -159,16 +145,9 @@ void ConstrainedFit2D::SetSlopeY(int slope_y)
     int nbasx = bs->GetBSX().GetNbas();
     int nbasy = bs->GetBSY().GetNbas();
 
-    MatrixXd TI = MatrixXd::Zero(nbas, (nbasy-1)*3);
-    VectorXd ti0 = VectorXd::Zero((nbasy-1)*3);
-
     for (int iy = 0; iy<nbasy-1; iy++)
-        for (int i=0; i<3; i++) {
-        TI(iy*nbasx+i, iy*3+i) = -slope_y;
-        TI((iy+1)*nbasx+i, iy*3+i) = slope_y;
-    }
-
-    cstr->AddInequality(TI, ti0);
+        for (int i=0; i<3; i++)
+            cstr->AddInequality({{iy*nbasx+i, -slope_y}, {(iy+1)*nbasx+i, slope_y}}, 0.);
 }
 
 // this is a special constraint requiring the spline to have maximum around (x0, y0)
@@ -182,7 +161,7 @@ void ConstrainedFit2D::ForceTopDown(double x0, double y0)
     int nbasx = bs->GetBSX().GetNbas();
     int nbasy = bs->GetBSY().GetNbas();;
     int nintx = bs->GetNintX();
-    int ninty = bs->GetNintX();
+    int ninty = bs->GetNintY();
 
     double xmin = bs->GetXmin();
     double xmax = bs->GetXmax();
@@ -191,33 +170,18 @@ void ConstrainedFit2D::ForceTopDown(double x0, double y0)
     double dx = (xmax-xmin)/nintx;
     double dy = (ymax-ymin)/ninty;
 
-    int cols = (nbasx-1)*(nbasy-1)*2;
-    int shift = (nbasx-1)*(nbasy-1); // shift to the second group of inequalities
-
-    MatrixXd TI = MatrixXd::Zero(nbas, cols);
-    VectorXd ti0 = VectorXd::Zero(cols);
-
+// two inequalities for each coefficient: towards the next one in y and in x
     for (int iy = 0; iy<nbasy-1; iy++)
         for (int ix = 0; ix<nbasx-1; ix++) {
             int i = ix + iy*nbasx;
-//                                        int i = ix + iy*(nbasx-1);
             double x = xmin + dx*(ix-1);
             double y = ymin + dy*(iy-1);
 
-// 1st group of inequalities
-            if (r(x, y) > r(x, y+dy)) {
-                TI(i, i) = -1; TI(i+nbasx, i)=1;
-            } else {
-                TI(i, i) = 1; TI(i+nbasx, i)=-1;
-            }
-// 2nd group of inequalities
-            if (r(x, y) > r(x+dx, y)) {
-                TI(i, i+shift) = -1; TI(i+1, i+shift)=1;
-            } else {
-                TI(i, i+shift) = 1; TI(i+1, i+shift)=-1;
-            }
+            double sy = r(x, y) > r(x, y+dy) ? 1. : -1.;
+            cstr->AddInequality({{i, -sy}, {i+nbasx, sy}}, 0.);
+            double sx = r(x, y) > r(x+dx, y) ? 1. : -1.;
+            cstr->AddInequality({{i, -sx}, {i+1, sx}}, 0.);
     }
-    cstr->AddInequality(TI, ti0);
 }
 
 // force the function even by constraining d/dx to 0 at x=0
@@ -229,15 +193,249 @@ void ConstrainedFit2D::ForceFlatTopX()
     double ymax = bs->GetYmax();
 
     double dy = (ymax-ymin)/nbasy;
-    MatrixXd TE = MatrixXd::Zero(nbas, nbasy);
-    VectorXd te0 = VectorXd::Zero(nbasy);
     for (int iy=0; iy<nbasy; iy++) {
         double y = ymin + (iy+0.5)*dy;
+        Constraints::Terms terms;
         for (int k=0; k<nbas; k++)
-            TE(k, iy) = bs->BasisDrvX(0., y, k);
+            terms.push_back(std::make_pair(k, bs->BasisDrvX(0., y, k)));
+        cstr->AddEquality(terms, 0.);
+    }
+}
+
+// ================ Normal equations =================
+
+void NormalEq::Init(int nbasx, int nbasy, int nbasz, int order)
+{
+    dim = nbasz > 0 ? 3 : nbasy > 0 ? 2 : 1;
+    this->nbasx = nbasx;
+    this->nbasy = std::max(nbasy, 1);
+    this->nbasz = std::max(nbasz, 1);
+    this->order = order;
+    nbas = this->nbasx * this->nbasy * this->nbasz;
+    int w = 2*order - 1;
+    nloc = dim == 1 ? order : dim == 2 ? order*order : order*order*order;
+    nst = dim == 1 ? w : dim == 2 ? w*w : w*w*w;
+    N.clear();
+    cur = -1;
+    Nloc.assign(nloc*nloc, 0.);
+    rloc.assign(nloc, 0.);
+
+// local basis functions: x index runs fastest, as in the global numbering
+    int ny = dim > 1 ? order : 1;
+    loc.resize(nloc);
+    std::vector <int> ax(nloc), ay(nloc), az(nloc);
+    for (int a=0; a<nloc; a++) {
+        ax[a] = a%order;
+        ay[a] = a/order%ny;
+        az[a] = a/order/ny;
+        loc[a] = ax[a] + this->nbasx*(ay[a] + this->nbasy*az[a]);
+    }
+
+// band entry: (dx+3) + 7*(dy+3) + 49*(dz+3) for cubic splines, with the unused axes omitted
+    int h = order - 1;
+    pair.resize(nloc*nloc);
+    for (int a=0; a<nloc; a++)
+        for (int b=0; b<nloc; b++) {
+            int s = ax[b]-ax[a]+h;
+            if (dim > 1)
+                s += w*(ay[b]-ay[a]+h);
+            if (dim > 2)
+                s += w*w*(az[b]-az[a]+h);
+            pair[a*nloc+b] = s;
+        }
+}
+
+void NormalEq::Clear()
+{
+    N.assign((size_t)nbas*nst, 0.);
+    r = VectorXd::Zero(nbas);
+    yty = 0.;
+    cur = -1;
+}
+
+bool NormalEq::Merge(const NormalEq &other)
+{
+    if (other.dim != dim || other.order != order || other.nbasx != nbasx || other.nbasy != nbasy || other.nbasz != nbasz)
+        return false;
+    if (other.N.empty())
+        return true;
+    if (N.empty())
+        Clear();
+
+    flush();
+    for (size_t k=0; k<N.size(); k++)
+        N[k] += other.N[k];
+    r += other.r;
+    yty += other.yty;
+// the block not yet flushed by other
+    if (other.cur >= 0) {
+        cur = other.cur;
+        Nloc = other.Nloc;
+        rloc = other.rloc;
+        flush();
     }
+    return true;
+}
 
-    cstr->AddEquality(TE, te0);
+// index j of the basis function at band entry s of basis function i, false if out of range
+bool NormalEq::neighbour(int i, int s, int *j) const
+{
+    int w = 2*order - 1;
+    int dx = s%w - (order-1);
+    int dy = dim > 1 ? s/w%w - (order-1) : 0;
+    int dz = dim > 2 ? s/(w*w) - (order-1) : 0;
+    int ix = i%nbasx + dx;
+    int iy = i/nbasx%nbasy + dy;
+    int iz = i/nbasx/nbasy + dz;
+    if (ix < 0 || ix >= nbasx || iy < 0 || iy >= nbasy || iz < 0 || iz >= nbasz)
+        return false;
+    *j = i + dx + nbasx*(dy + nbasy*dz);
+    return true;
+}
+
+void NormalEq::AddRow(double w, double f, int ix, const double *ux, int iy, const double *uy, int iz, const double *uz)
+{
+    double v[64];
+    int k = 0;
+    for (int c=0; c<(dim>2 ? order : 1); c++)
+        for (int b=0; b<(dim>1 ? order : 1); b++) {
+            double wyz = w * (dim>1 ? uy[b] : 1.) * (dim>2 ? uz[c] : 1.);
+            for (int a=0; a<order; a++)
+                v[k++] = ux[a]*wyz;
+        }
+
+    int first = ix + nbasx*(iy + nbasy*iz);
+    if (first != cur) {
+        flush();
+        cur = first;
+    }
+    double wf = w*f;
+    for (int a=0; a<nloc; a++) {
+        double va = v[a];
+        double *Na = &Nloc[a*nloc];
+        for (int b=0; b<nloc; b++)
+            Na[b] += va*v[b];
+        rloc[a] += va*wf;
+    }
+    yty += wf*wf;
+}
+
+void NormalEq::flush()
+{
+    if (cur < 0)
+        return;
+    for (int a=0; a<nloc; a++) {
+        double *Na = &N[(size_t)(cur + loc[a])*nst];
+        double *La = &Nloc[a*nloc];
+        const int *pa = &pair[a*nloc];
+        for (int b=0; b<nloc; b++) {
+            Na[pa[b]] += La[b];
+            La[b] = 0.;
+        }
+        r(cur + loc[a]) += rloc[a];
+        rloc[a] = 0.;
+    }
+    cur = -1;
+}
+
+void NormalEq::GetBand(BandMatrix &G, VectorXd &g0)
+{
+    flush();
+    G.Init(nbas, (order-1)*(1 + (dim > 1 ? nbasx : 0) + (dim > 2 ? nbasx*nbasy : 0)));
+    for (int i=0; i<nbas; i++)
+        for (int s=0; s<nst; s++) {
+            int j;
+            if (neighbour(i, s, &j) && j >= i)
+                G.At(i, j) = N[(size_t)i*nst + s];
+        }
+    g0 = -r;
+}
+
+bool NormalEq::Solve(VectorXd &c, double *residual, std::string &err)
+{
+    if (N.empty()) {
+        err = "NormalEq: no equations";
+        return false;
+    }
+
+    BandMatrix U;
+    VectorXd g0;
+    GetBand(U, g0);
+    if (!U.Factorize()) {
+        err = "Cholesky: normal matrix is not positive definite";
+        return false;
+    }
+    c = r;
+    U.Solve(c);
+
+// |Ac - y|^2 = c'Nc - 2c'r + y'y = y'y - c'r at the solution
+    *residual = sqrt(std::max(0., yty - c.dot(r)));
+    return true;
+}
+
+void NormalEq::GetDense(MatrixXd &G, VectorXd &g0)
+{
+    flush();
+    G = MatrixXd::Zero(nbas, nbas);
+    for (int i=0; i<nbas; i++)
+        for (int s=0; s<nst; s++) {
+            int j;
+            if (neighbour(i, s, &j))
+                G(j, i) = N[(size_t)i*nst + s];
+        }
+    g0 = -r;
+}
+
+// ================ Sparse QR cache =================
+
+struct SparseQRSolver
+{
+    SparseQR <SparseMatrix<double>, Eigen::COLAMDOrdering<int> > qr;
+// pattern of the analyzed matrix
+    int rows = 0;
+    int cols = 0;
+    std::vector <int> outer;
+    std::vector <int> inner;
+};
+
+void SparseQRCache::Reset()
+{
+    delete solver;
+    solver = nullptr;
+}
+
+SparseQRSolver *SparseQRCache::Get(const SparseMatrix<double> &As)
+{
+    int nnz = As.nonZeros();
+    const int *outer = As.outerIndexPtr();
+    const int *inner = As.innerIndexPtr();
+    if (solver && solver->rows == As.rows() && solver->cols == As.cols() && (int)solver->inner.size() == nnz
+               && std::equal(outer, outer + As.cols() + 1, solver->outer.begin())
+               && std::equal(inner, inner + nnz, solver->inner.begin()))
+        return solver;
+
+    if (!solver)
+        solver = new SparseQRSolver;
+    solver->qr.analyzePattern(As);
+    solver->rows = As.rows();
+    solver->cols = As.cols();
+    solver->outer.assign(outer, outer + As.cols() + 1);
+    solver->inner.assign(inner, inner + nnz);
+    return solver;
+}
+
+// nonzero elements of a row of the design matrix: tensor product of the local basis values
+// (order per axis), the row is scaled by w
+static void sparseRow(std::vector <Triplet<double> > &trip, int row, double w, int order, int nbasx, int nbasy,
+                      int ix, const double *ux, int iy = 0, const double *uy = nullptr, int iz = 0, const double *uz = nullptr)
+{
+    for (int c=0; c<(uz ? order : 1); c++)
+        for (int b=0; b<(uy ? order : 1); b++) {
+            double wyz = w * (uy ? uy[b] : 1.) * (uz ? uz[c] : 1.);
+            int col = ix + nbasx*(iy + b + nbasy*(iz + c));
+            for (int a=0; a<order; a++)
+                trip.push_back(Triplet<double>(row, col + a, ux[a]*wyz));
+        }
 }
 
 // ================ Base class functions =================
@@ -249,14 +447,18 @@ BSfit::Method BSfit::SelectMethod()
 
     if (nbas < 16) 
         return SVD;
-    else if (nbas < 400) 
+    else if (nbas < 100) 
         return QR;
     else
-        return QR_Sparse;
+        return Cholesky;
 }
 
 bool BSfit::SolveLinSystem()
 {
+// the streamed samples exist only as normal equations
+    if (fNormalEq)
+        return SolveCholesky();
+
     switch (SelectMethod()) {
         case SVD:
             return SolveSVD();
@@ -267,6 +469,9 @@ bool BSfit::SolveLinSystem()
         case QR_Sparse:
             return SolveSparseQR();
             break;          
+        case Cholesky:
+            return SolveCholesky();
+            break;
         default:
             return false;
             break;
@@ -298,25 +503,22 @@ bool BSfit::SolveQR()
 
 bool BSfit::SolveSparseQR()
 {
-// sparse version - EXPERIMENTAL
-    int nz_elem = 0;
-    for (int i=0; i<A.rows(); i++)
-        for (int j=0; j<A.cols(); j++)
-            if (A(i,j) != 0.)
-                nz_elem++;
-
-    std::vector <Eigen::Triplet<double> > tripletList;
-    tripletList.reserve(nz_elem);
-    for (int i=0; i<A.rows(); i++)
-        for (int j=0; j<A.cols(); j++)
-            if (A(i,j) != 0.)
-                tripletList.push_back(Eigen::Triplet<double>(i,j,A(i,j)));
-
-    SparseMatrix <double> A_sp(A.rows(),A.cols());
-    A_sp.setFromTriplets(tripletList.begin(), tripletList.end());
-
-    SparseQR <SparseMatrix<double>, Eigen::COLAMDOrdering<int> > solver;
-    solver.compute(A_sp);
+// the system was made by MkLinSystem: collect the nonzero elements of the dense A
+    if (!fSparse) {
+        std::vector <Eigen::Triplet<double> > tripletList;
+        for (int i=0; i<A.rows(); i++)
+            for (int j=0; j<A.cols(); j++)
+                if (A(i,j) != 0.)
+                    tripletList.push_back(Eigen::Triplet<double>(i,j,A(i,j)));
+
+        As.resize(A.rows(),A.cols());
+        As.setFromTriplets(tripletList.begin(), tripletList.end());
+    }
+    As.makeCompressed();
+
+// ordering and symbolic analysis are reused if the pattern is the same as in the previous fit
+    SparseQR <SparseMatrix<double>, Eigen::COLAMDOrdering<int> > &solver = sqr.Get(As)->qr;
+    solver.factorize(As);
     if(solver.info()!=Eigen::Success) {
         error_msg = "SparseQR: decomposition failed";
         return false;
@@ -328,20 +530,60 @@ bool BSfit::SolveSparseQR()
         return false;
     }
 
-    VectorXd r = A_sp*x - y;
+    VectorXd r = As*x - y;
     residual = sqrt(r.squaredNorm());
     return true;
 }  
 
-bool BSfit::SolveQuadProg(MatrixXd &CI, VectorXd &ci0, MatrixXd &CE, VectorXd &ce0)
+bool BSfit::SolveCholesky()
+{
+    if (fNormalEq)
+        return neq.Solve(x, &residual, error_msg);
+
+// the system was made by MkLinSystem
+    x = (A.transpose()*A).ldlt().solve(A.transpose()*y);
+    VectorXd r = A*x - y;
+    residual = sqrt(r.squaredNorm());
+    return true;
+}
+
+bool BSfit::SolveQuadProg(const Constraints &cstr)
 {
 // constrained fit
 
 // solve the system using quadratic programming, i.e.
 // minimize 1/2 * x G x + g0 x subject to some inequality and equality constraints,
 // where G = A'A and g0 = -y'A (' denotes transposition)
-    G = A.transpose()*A;
-    g0 = (y.transpose()*A)*(-1.);
+
+// large problems with normal equations: ADMM with band G and sparse constraints,
+// it falls back to the dense solver if the constraints do not fit into the band of G
+    if (fNormalEq && nbas >= 100) {
+        BandMatrix GB;
+        neq.GetBand(GB, g0);
+        SparseQP::Constraints C;
+        VectorXd l, u;
+        cstr.GetSparse(C, l, u);
+        if (qp.Solve(GB, g0, C, l, u, x)) {
+            VectorXd Gx;
+            GB.Multiply(x, Gx);
+            residual = 0.5*x.dot(Gx) + g0.dot(x);
+            return true;
+        }
+    }
+
+    if (fNormalEq)
+        neq.GetDense(G, g0);
+    else if (fSparse) {
+        G = As.transpose()*As;
+        g0 = As.transpose()*y*(-1.);
+    } else {
+        G = A.transpose()*A;
+        g0 = (y.transpose()*A)*(-1.);
+    }
+
+    MatrixXd CI, CE;
+    VectorXd ci0, ce0;
+    cstr.GetDense(CI, ci0, CE, ce0);
 
 // all prepared - call the solver
     residual = solve_quadprog(G, g0,  CE, ce0,  CI, ci0, x);
@@ -400,6 +642,8 @@ BSfit1D* BSfit1D::clone() const
 void BSfit1D::Init()
 {
     nbas = bs->GetNbas();
+    neq.Init(nbas, 0, 0, bs->GetDegree()+1);
+    stream.Init(nbas, 0, 0, bs->GetDegree()+1);
     h1 = 0;
     nbins = 0;  
     SetBinningAuto();
@@ -427,16 +671,70 @@ void BSfit1D::SetBinningAuto()
 void BSfit1D::AddData(double const x, double const f)
 {
     h1->Fill(x, f);
+    if (fStreaming) {
+        int ix;
+        double u[4];
+        if (bs->LocalBasis(x, &ix, u))
+            stream.AddRow(1., f, ix, u);
+        else
+            stream.AddZeroRow(1., f);
+    }
 }
 
 void BSfit1D::AddData(int npts, double const *datax, double const *datay)
 {
+    if (fStreaming) {
+        for (int i=0; i<npts; i++)
+            AddData(datax[i], datay[i]);
+        return;
+    }
     for (int i=0; i<npts; i++)
         h1->Fill(datax[i], datay[i]);
 }
 
+void BSfit1D::SetStreaming(bool val)
+{
+    fStreaming = val;
+    if (val && stream.IsEmpty())
+        stream.Clear();
+}
+
+bool BSfit1D::StreamedFit()
+{
+    if (!fStreaming || !h1 || h1->GetEntries() == 0.) {
+        error_msg = "BSfit1D: No streamed data to fit. Call SetStreaming(true) and AddData(npts, datax, datay) first";
+        return false;
+    }
+
+// the stream stays open for more data, smoothness equations go to the copy
+    neq = stream;
+    int ix;
+    double u[4];
+    for (int i=0; i<nbins; i++)
+        if (h1->GetBinEntries(i) < 0.5 && bs->LocalBasis(h1->GetBinCenterX(i), &ix, u, 2))
+            neq.AddRow(1., 0., ix, u);
+
+    fNormalEq = true;
+    fSparse = false;
+    A.resize(0, 0);
+    y.resize(0);
+    status = SolveLinSystem();
+    return status;
+}
+
+bool BSfit1D::MergeData(const BSfit1D &other)
+{
+    if (!h1 || !other.h1 || fStreaming != other.fStreaming)
+        return false;
+    if (fStreaming && !stream.Merge(other.stream))
+        return false;
+    return h1->Merge(*other.h1);
+}
+
 void BSfit1D::MkLinSystem(int npts, double const *datax, double const *data, double const *dataw)
 {
+    fNormalEq = false;
+    fSparse = false;
 // linear least squares: matrix eqation Ax=y
 // we've got npts equations with nbas unknowns
     A.resize(npts, nbas);
@@ -464,6 +762,58 @@ void BSfit1D::MkLinSystem(int npts, double const *datax, double const *data, dou
     }
 }
 
+// the same equations as in MkLinSystem, accumulated directly into normal equations
+void BSfit1D::MkNormalEq(int npts, double const *datax, double const *data, double const *dataw)
+{
+    fNormalEq = true;
+    fSparse = false;
+    A.resize(0, 0);
+    As.resize(0, 0);
+    y.resize(0);
+    neq.Clear();
+
+    int ix;
+    double u[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        if (w > 0.5) {          // normal point (W >= 1)
+            if (bs->LocalBasis(datax[i], &ix, u))
+                neq.AddRow(w, data[i], ix, u);
+            else
+                neq.AddZeroRow(w, data[i]);
+        } else if (bs->LocalBasis(datax[i], &ix, u, 2)) // missing point: 2nd derivative set to zero
+            neq.AddRow(1., 0., ix, u);
+    }
+}
+
+// the same equations as in MkLinSystem, only the nonzero elements of A are stored
+void BSfit1D::MkSparseSystem(int npts, double const *datax, double const *data, double const *dataw)
+{
+    fNormalEq = false;
+    fSparse = true;
+    A.resize(0, 0);
+    y.resize(npts);
+
+    std::vector <Triplet<double> > trip;
+    trip.reserve((size_t)npts*4);
+    int ix;
+    double u[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        if (w > 0.5) {          // normal point (W >= 1)
+            y(i) = data[i] * w;
+            if (bs->LocalBasis(datax[i], &ix, u))
+                sparseRow(trip, i, w, bs->GetDegree()+1, nbas, 1, ix, u);
+        } else {                // missing point: 2nd derivative set to zero
+            y(i) = 0.;
+            if (bs->LocalBasis(datax[i], &ix, u, 2))
+                sparseRow(trip, i, 1., bs->GetDegree()+1, nbas, 1, ix, u);
+        }
+    }
+    As.resize(npts, nbas);
+    As.setFromTriplets(trip.begin(), trip.end());
+}
+
 // this is the default fitting routine to be performed on the binned data
 bool BSfit1D::BinnedFit()
 {
@@ -485,7 +835,22 @@ bool BSfit1D::BinnedFit()
 
 bool BSfit1D::WeightedFit(int npts, double const *datax, double const *data, double const *dataw)
 {
-    MkLinSystem(npts, datax, data, dataw);
+    if (UseNormalEq()) {
+        MkNormalEq(npts, datax, data, dataw);
+        status = SolveLinSystem();
+// without the smoothness equations of the binned fits the normal matrix is singular if some
+// basis functions have no data: the automatic choice then falls back to sparse QR
+        if (status || method != Auto)
+            return status;
+        error_msg.clear();
+        MkSparseSystem(npts, datax, data, dataw);
+        status = SolveSparseQR();
+        return status;
+    }
+    if (SelectMethod() == QR_Sparse)
+        MkSparseSystem(npts, datax, data, dataw);
+    else
+        MkLinSystem(npts, datax, data, dataw);
     status = SolveLinSystem();
     return status;
 }
@@ -520,11 +885,13 @@ ProfileHist *BSfit1D::GetHist()
 ConstrainedFit1D::ConstrainedFit1D(double xmin, double xmax, int n_int) : BSfit1D(xmin, xmax, n_int)
 {
     cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
 }
 
 ConstrainedFit1D::ConstrainedFit1D(Bspline1d *bs_) : BSfit1D(bs_)
 {
     cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
 }
 
 ConstrainedFit1D* ConstrainedFit1D::clone() const 
@@ -538,7 +905,7 @@ ConstrainedFit1D* ConstrainedFit1D::clone() const
 
 bool ConstrainedFit1D::SolveLinSystem()
 {
-    return SolveQuadProg(cstr->CI, cstr->ci0, cstr->CE, cstr->ce0);
+    return SolveQuadProg(*cstr);
 }
 
 // =============== Fit 2D spline ===============
@@ -574,6 +941,7 @@ void BSfit2D::Init()
     nbas = bs->GetNbas();
     nbasx = bs->GetBSX().GetNbas();
     nbasy = bs->GetBSY().GetNbas();
+    neq.Init(nbasx, nbasy);
 
 // set binning to zero -- ToDo: probably not needed now that auto binning is default
     nbinsx = 0;
@@ -619,6 +987,8 @@ void BSfit2D::AddData(int npts, double const *datax, double const *datay, const
 
 void BSfit2D::MkLinSystem(int npts, double const *datax, double const *datay, double const *data, double const *dataw)
 {
+    fNormalEq = false;
+    fSparse = false;
 // for the case of weighted data with missing points,
 // we need to make a provision for additional 2nd derivative equations
     int missing = 0;
@@ -671,7 +1041,89 @@ void BSfit2D::MkLinSystem(int npts, double const *datax, double const *datay, do
     }
 }
 
+// the same equations as in MkLinSystem, accumulated directly into normal equations
+void BSfit2D::MkNormalEq(int npts, double const *datax, double const *datay, double const *data, double const *dataw)
+{
+    fNormalEq = true;
+    fSparse = false;
+    A.resize(0, 0);
+    As.resize(0, 0);
+    y.resize(0);
+    neq.Clear();
+
+    const BsplineBasis1d &bsx = bs->GetBSX();
+    const BsplineBasis1d &bsy = bs->GetBSY();
+    int ix, iy;
+    double ux[4], uy[4], dx[4], dy[4], d2x[4], d2y[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        if (!bsx.LocalBasis(datax[i], &ix, ux) || !bsy.LocalBasis(datay[i], &iy, uy)) {
+            if (w > 0.5)
+                neq.AddZeroRow(w, data[i]);
+            continue;
+        }
+        if (w > 0.5) {          // normal point (W >= 1)
+            neq.AddRow(w, data[i], ix, ux, iy, uy);
+            continue;
+        }
+// missing point: d2/dxdy, d2/dx2 and d2/dy2 set to zero
+        bsx.LocalBasis(datax[i], &ix, dx, 1);
+        bsx.LocalBasis(datax[i], &ix, d2x, 2);
+        bsy.LocalBasis(datay[i], &iy, dy, 1);
+        bsy.LocalBasis(datay[i], &iy, d2y, 2);
+        neq.AddRow(1., 0., ix, dx, iy, dy);
+        neq.AddRow(1., 0., ix, d2x, iy, uy);
+        neq.AddRow(1., 0., ix, ux, iy, d2y);
+    }
+}
+
+// the same equations as in MkLinSystem, only the nonzero elements of A are stored
+void BSfit2D::MkSparseSystem(int npts, double const *datax, double const *datay, double const *data, double const *dataw)
+{
+    fNormalEq = false;
+    fSparse = true;
+    A.resize(0, 0);
 
+    int missing = 0;
+    if (dataw != 0) {
+        for (int i=0; i<npts; i++)
+            if (dataw[i] < 0.5) // missing point
+                missing++;
+    }
+    int nrows = npts + missing*2;
+    int missing_ptr = npts; // additional 2nd derivative equations go to the end
+    y = VectorXd::Zero(nrows);
+
+    const BsplineBasis1d &bsx = bs->GetBSX();
+    const BsplineBasis1d &bsy = bs->GetBSY();
+    std::vector <Triplet<double> > trip;
+    trip.reserve((size_t)nrows*16);
+    int ix, iy;
+    double ux[4], uy[4], dx[4], dy[4], d2x[4], d2y[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        bool inside = bsx.LocalBasis(datax[i], &ix, ux) && bsy.LocalBasis(datay[i], &iy, uy);
+        if (w > 0.5) {          // normal point (W >= 1)
+            y(i) = data[i] * w;
+            if (inside)
+                sparseRow(trip, i, w, 4, nbasx, nbasy, ix, ux, iy, uy);
+            continue;
+        }
+// missing point: d2/dxdy in place of the original equation, d2/dx2 and d2/dy2 in the end
+        if (inside) {
+            bsx.LocalBasis(datax[i], &ix, dx, 1);
+            bsx.LocalBasis(datax[i], &ix, d2x, 2);
+            bsy.LocalBasis(datay[i], &iy, dy, 1);
+            bsy.LocalBasis(datay[i], &iy, d2y, 2);
+            sparseRow(trip, i, 1., 4, nbasx, nbasy, ix, dx, iy, dy);
+            sparseRow(trip, missing_ptr, 1., 4, nbasx, nbasy, ix, d2x, iy, uy);
+            sparseRow(trip, missing_ptr+1, 1., 4, nbasx, nbasy, ix, ux, iy, d2y);
+        }
+        missing_ptr += 2;
+    }
+    As.resize(nrows, nbas);
+    As.setFromTriplets(trip.begin(), trip.end());
+}
 
 // this is the default fitting routine to be performed on the binned data
 bool BSfit2D::BinnedFit()
@@ -695,7 +1147,20 @@ bool BSfit2D::BinnedFit()
 
 bool BSfit2D::WeightedFit(int npts, double const *datax, double const *datay, double const *data, double const *dataw)
 {
-    MkLinSystem(npts, datax, datay, data, dataw);
+    if (UseNormalEq()) {
+        MkNormalEq(npts, datax, datay, data, dataw);
+        bool ok = SolveLinSystem();
+// singular normal matrix: sparse QR, as in BSfit1D::WeightedFit
+        if (ok || method != Auto)
+            return ok;
+        error_msg.clear();
+        MkSparseSystem(npts, datax, datay, data, dataw);
+        return SolveSparseQR();
+    }
+    if (SelectMethod() == QR_Sparse)
+        MkSparseSystem(npts, datax, datay, data, dataw);
+    else
+        MkLinSystem(npts, datax, datay, data, dataw);
     return SolveLinSystem();
 }
 
@@ -732,10 +1197,24 @@ ProfileHist *BSfit2D::GetHist()
     return h2; // dynamic_cast <ProfileHist*>(h2);
 }
 
+bool BSfit2D::MergeData(const BSfit2D &other)
+{
+    if (!h2 || !other.h2)
+        return false;
+    return h2->Merge(*other.h2);
+}
+
 ConstrainedFit2D::ConstrainedFit2D(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty) : 
         BSfit2D(xmin, xmax, n_intx, ymin, ymax, n_inty)
 {
     cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
+}
+
+ConstrainedFit2D::ConstrainedFit2D(Bspline2d *bs_) : BSfit2D(bs_)
+{
+    cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
 }
 
 ConstrainedFit2D* ConstrainedFit2D::clone() const 
@@ -749,7 +1228,7 @@ ConstrainedFit2D* ConstrainedFit2D::clone() const
 
 bool ConstrainedFit2D::SolveLinSystem()
 {
-    return SolveQuadProg(cstr->CI, cstr->ci0, cstr->CE, cstr->ce0);
+    return SolveQuadProg(*cstr);
 }
 
 
@@ -788,6 +1267,7 @@ void BSfit3D::Init()
     nbasy = bs->GetBSXY().GetBSY().GetNbas();
     nbasxy = bs->GetNbasXY();
     nbasz = bs->GetNbasZ();
+    neq.Init(nbasx, nbasy, nbasz);
 // no binning by default
     nbinsx = 0;
     nbinsy = 0;
@@ -824,6 +1304,14 @@ void BSfit3D::SetBinningAuto()
     SetBinning(bs->GetNintX()*2, bs->GetNintY()*2, bs->GetNintZ()*2);
 }
 
+void BSfit3D::AddData(double const x, double const y, double const z, double const f)
+{
+    if (nbinsx == 0)
+        SetBinningAuto();
+
+    h3->Fill(x, y, z, f);
+}
+
 void BSfit3D::AddData(int npts, double const *x, double const *y, const double *z, const double *data)
 {
     if (nbinsx == 0)
@@ -835,6 +1323,8 @@ void BSfit3D::AddData(int npts, double const *x, double const *y, const double *
 
 void BSfit3D::MkLinSystem(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw)
 {
+    fNormalEq = false;
+    fSparse = false;
 // for the case of weighted data with missing points,
 // we need to make a provision for additional 2nd derivative equations
     int missing = 0;
@@ -902,6 +1392,102 @@ void BSfit3D::MkLinSystem(int npts, double const *datax, double const *datay, do
     }
 }
 
+// the same equations as in MkLinSystem, accumulated directly into normal equations
+void BSfit3D::MkNormalEq(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw)
+{
+    fNormalEq = true;
+    fSparse = false;
+    A.resize(0, 0);
+    As.resize(0, 0);
+    y.resize(0);
+    neq.Clear();
+
+    const BsplineBasis1d &bsx = bs->GetBSXY().GetBSX();
+    const BsplineBasis1d &bsy = bs->GetBSXY().GetBSY();
+    const BsplineBasis1d &bsz = bs->GetBSZ();
+    int ix, iy, iz;
+    double ux[4], uy[4], uz[4], dx[4], dy[4], dz[4], d2x[4], d2y[4], d2z[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        if (!bsx.LocalBasis(datax[i], &ix, ux) || !bsy.LocalBasis(datay[i], &iy, uy) || !bsz.LocalBasis(dataz[i], &iz, uz)) {
+            if (w > 0.5)
+                neq.AddZeroRow(w, data[i]);
+            continue;
+        }
+        if (w > 0.5) {          // normal point (W >= 1)
+            neq.AddRow(w, data[i], ix, ux, iy, uy, iz, uz);
+            continue;
+        }
+// missing point: all six 2nd derivatives set to zero
+        bsx.LocalBasis(datax[i], &ix, dx, 1);
+        bsx.LocalBasis(datax[i], &ix, d2x, 2);
+        bsy.LocalBasis(datay[i], &iy, dy, 1);
+        bsy.LocalBasis(datay[i], &iy, d2y, 2);
+        bsz.LocalBasis(dataz[i], &iz, dz, 1);
+        bsz.LocalBasis(dataz[i], &iz, d2z, 2);
+        neq.AddRow(1., 0., ix, dx, iy, dy, iz, uz);
+        neq.AddRow(1., 0., ix, d2x, iy, uy, iz, uz);
+        neq.AddRow(1., 0., ix, ux, iy, d2y, iz, uz);
+        neq.AddRow(1., 0., ix, ux, iy, uy, iz, d2z);
+        neq.AddRow(1., 0., ix, dx, iy, uy, iz, dz);
+        neq.AddRow(1., 0., ix, ux, iy, dy, iz, dz);
+    }
+}
+
+// the same equations as in MkLinSystem, only the nonzero elements of A are stored
+void BSfit3D::MkSparseSystem(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw)
+{
+    fNormalEq = false;
+    fSparse = true;
+    A.resize(0, 0);
+
+    int missing = 0;
+    if (dataw != 0) {
+        for (int i=0; i<npts; i++)
+            if (dataw[i] < 0.5) // missing point
+                missing++;
+    }
+    int nrows = npts + missing*5;
+    int missing_ptr = npts; // additional 2nd derivative equations go to the end
+    y = VectorXd::Zero(nrows);
+
+    const BsplineBasis1d &bsx = bs->GetBSXY().GetBSX();
+    const BsplineBasis1d &bsy = bs->GetBSXY().GetBSY();
+    const BsplineBasis1d &bsz = bs->GetBSZ();
+    std::vector <Triplet<double> > trip;
+    trip.reserve((size_t)nrows*64);
+    int ix, iy, iz;
+    double ux[4], uy[4], uz[4], dx[4], dy[4], dz[4], d2x[4], d2y[4], d2z[4];
+    for (int i=0; i<npts; i++) {
+        double w = dataw ? dataw[i] : 1.;
+        bool inside = bsx.LocalBasis(datax[i], &ix, ux) && bsy.LocalBasis(datay[i], &iy, uy) && bsz.LocalBasis(dataz[i], &iz, uz);
+        if (w > 0.5) {          // normal point (W >= 1)
+            y(i) = data[i] * w;
+            if (inside)
+                sparseRow(trip, i, w, 4, nbasx, nbasy, ix, ux, iy, uy, iz, uz);
+            continue;
+        }
+// missing point: d2/dxdy in place of the original equation, the other five 2nd derivatives in the end
+        if (inside) {
+            bsx.LocalBasis(datax[i], &ix, dx, 1);
+            bsx.LocalBasis(datax[i], &ix, d2x, 2);
+            bsy.LocalBasis(datay[i], &iy, dy, 1);
+            bsy.LocalBasis(datay[i], &iy, d2y, 2);
+            bsz.LocalBasis(dataz[i], &iz, dz, 1);
+            bsz.LocalBasis(dataz[i], &iz, d2z, 2);
+            sparseRow(trip, i, 1., 4, nbasx, nbasy, ix, dx, iy, dy, iz, uz);
+            sparseRow(trip, missing_ptr, 1., 4, nbasx, nbasy, ix, d2x, iy, uy, iz, uz);
+            sparseRow(trip, missing_ptr+1, 1., 4, nbasx, nbasy, ix, ux, iy, d2y, iz, uz);
+            sparseRow(trip, missing_ptr+2, 1., 4, nbasx, nbasy, ix, ux, iy, uy, iz, d2z);
+            sparseRow(trip, missing_ptr+3, 1., 4, nbasx, nbasy, ix, dx, iy, uy, iz, dz);
+            sparseRow(trip, missing_ptr+4, 1., 4, nbasx, nbasy, ix, ux, iy, dy, iz, dz);
+        }
+        missing_ptr += 5;
+    }
+    As.resize(nrows, nbas);
+    As.setFromTriplets(trip.begin(), trip.end());
+}
+
 // this is the default fitting routine to be performed on the binned data
 bool BSfit3D::BinnedFit()
 {
@@ -926,7 +1512,20 @@ bool BSfit3D::BinnedFit()
 
 bool BSfit3D::WeightedFit(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw)
 {
-    MkLinSystem(npts, datax, datay, dataz, data, dataw);
+    if (UseNormalEq()) {
+        MkNormalEq(npts, datax, datay, dataz, data, dataw);
+        bool ok = SolveLinSystem();
+// singular normal matrix: sparse QR, as in BSfit1D::WeightedFit
+        if (ok || method != Auto)
+            return ok;
+        error_msg.clear();
+        MkSparseSystem(npts, datax, datay, dataz, data, dataw);
+        return SolveSparseQR();
+    }
+    if (SelectMethod() == QR_Sparse)
+        MkSparseSystem(npts, datax, datay, dataz, data, dataw);
+    else
+        MkLinSystem(npts, datax, datay, dataz, data, dataw);
     return SolveLinSystem();
 }
 
@@ -965,10 +1564,24 @@ ProfileHist *BSfit3D::GetHist()
     return h3; // dynamic_cast <ProfileHist*>(h3);
 }
 
+bool BSfit3D::MergeData(const BSfit3D &other)
+{
+    if (!h3 || !other.h3)
+        return false;
+    return h3->Merge(*other.h3);
+}
+
 ConstrainedFit3D::ConstrainedFit3D(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty, double zmin, double zmax, int n_intz) : 
         BSfit3D(xmin, xmax, n_intx, ymin, ymax, n_inty, zmin, zmax, n_intz)
 {
     cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
+}
+
+ConstrainedFit3D::ConstrainedFit3D(Bspline3d *bs_) : BSfit3D(bs_)
+{
+    cstr = new Constraints(bs->GetNbas());
+    method = QuadProg;
 }
 
 ConstrainedFit3D* ConstrainedFit3D::clone() const 
@@ -982,7 +1595,7 @@ ConstrainedFit3D* ConstrainedFit3D::clone() const
 
 bool ConstrainedFit3D::SolveLinSystem()
 {
-    return SolveQuadProg(cstr->CI, cstr->ci0, cstr->CE, cstr->ce0);
+    return SolveQuadProg(*cstr);
 }
 
 
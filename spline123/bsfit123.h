@@ -4,8 +4,10 @@
 #include <vector>
 #include <string>
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 #include "bspline123d.h"
+#include "sparseqp.h"
 
 class ProfileHist;
 class ProfileHist1D;
@@ -19,6 +21,10 @@ class Constraints
 friend class ConstrainedFit1D;
 friend class ConstrainedFit2D;
 friend class ConstrainedFit3D;
+public:
+// linear combination of the coefficients: pairs of basis function index and factor
+    typedef std::vector <std::pair <int, double> > Terms;
+
 public:
     Constraints(int nbas) {this->nbas = nbas;}
     virtual ~Constraints() {;}
@@ -27,21 +33,105 @@ public:
     void SetMaximum(double max);
     void ForceNonNegative() {SetMinimum(0.);}
 
+    int GetInequalityCount() const {return ci0.size();}
+    int GetEqualityCount() const {return ce0.size();}
+// dense form for eiquadprog: CE^T x + ce0 = 0 and CI^T x + ci0 >= 0
+    void GetDense(Eigen::MatrixXd &CI, Eigen::VectorXd &ci0, Eigen::MatrixXd &CE, Eigen::VectorXd &ce0) const;
+// stacked form for SparseQP: l <= C x <= u, equalities first
+    void GetSparse(SparseQP::Constraints &C, Eigen::VectorXd &l, Eigen::VectorXd &u) const;
+
 protected:
-    void AddInequality(Eigen::MatrixXd DI, Eigen::VectorXd di0);
-    void AddEquality(Eigen::MatrixXd DE, Eigen::VectorXd de0);  
+// terms*x + c0 >= 0 and terms*x + c0 = 0
+    void AddInequality(const Terms &terms, double c0);
+    void AddEquality(const Terms &terms, double c0);
 
 protected:
-// ineqaulity constraints (leave zero-size if not used)
-    Eigen::MatrixXd CI;
-    Eigen::VectorXd ci0;
-// equality constraints (leave zero-size if not used)
-    Eigen::MatrixXd CE;
-    Eigen::VectorXd ce0;
+// nonzero factors: row = constraint, col = basis function
+    std::vector <Eigen::Triplet<double> > ti;
+    std::vector <double> ci0;
+    std::vector <Eigen::Triplet<double> > te;
+    std::vector <double> ce0;
 private:
     int nbas;
 };
 
+// Normal equations N c = r of the linear least squares problem A c = y (N = A'A, r = A'y),
+// accumulated row by row from the nonzero basis values, A itself is never stored.
+// A data point of a cubic spline in D dimensions touches 4^D basis functions, and two of them
+// interact only if their indices differ by at most 3 along every axis, so N is kept as a band
+// of 7^D entries per basis function (7, 49 and 343 in 1D, 2D and 3D). The system is solved
+// by banded Cholesky decomposition with the bandwidth of 3, 3*(1+nbasx) and 3*(1+nbasx+nbasx*nbasy).
+// For splines of another order (quadratic: 3) 4, 7 and 3 become order, 2*order-1 and order-1.
+
+class NormalEq
+{
+public:
+// numbers of basis functions along the axes, 0 for the unused ones
+    void Init(int nbasx, int nbasy = 0, int nbasz = 0, int order = 4);
+    void Clear();
+    bool IsEmpty() const {return N.empty();}
+    int GetNbas() const {return nbas;}
+    double GetYY() const {return yty;}
+// adds the equations accumulated by other with the same basis, e.g. in another thread
+    bool Merge(const NormalEq &other);
+
+// adds equation w*(u c) = w*f, where the row u is the tensor product of the local basis values
+// along the used axes (order per axis, see BsplineBasis1d::LocalBasis) starting at basis function ix, iy, iz
+    void AddRow(double w, double f, int ix, const double *ux, int iy = 0, const double *uy = nullptr,
+                int iz = 0, const double *uz = nullptr);
+// equation with zero row (data point outside of the spline domain) only adds to the residual
+    void AddZeroRow(double w, double f) {yty += w*w*f*f;}
+
+// c = N^-1 r, residual = |Ac - y|
+    bool Solve(Eigen::VectorXd &c, double *residual, std::string &err);
+// G = N and g0 = -r for QuadProg, dense or as a band
+    void GetDense(Eigen::MatrixXd &G, Eigen::VectorXd &g0);
+    void GetBand(BandMatrix &G, Eigen::VectorXd &g0);
+
+protected:
+    void flush();
+    bool neighbour(int i, int s, int *j) const;
+
+protected:
+    int dim = 0;
+    int nbasx = 0;
+    int nbasy = 1;
+    int nbasz = 1;
+    int nbas = 0;
+    int order = 4;              // local basis functions per axis
+    int nloc = 0;               // order^dim local basis functions per row
+    int nst = 0;                // (2*order-1)^dim band entries per basis function
+    std::vector <int> loc;      // index offsets of the local basis functions from the first one
+    std::vector <int> pair;     // band entry of local basis function b in the row of a: pair[a*nloc+b]
+    std::vector <double> N;     // nbas x nst, allocated by Clear()
+    Eigen::VectorXd r;
+    double yty = 0.;
+// rows sharing the same local basis functions are summed up in a dense nloc x nloc block first
+    int cur = -1;               // first basis function of the block, -1 if empty
+    std::vector <double> Nloc;
+    std::vector <double> rloc;
+};
+
+// Sparse QR factorization kept between the fits: column ordering (COLAMD) and symbolic analysis
+// are redone only if the sparsity pattern of the design matrix changes. Copies start empty.
+
+struct SparseQRSolver;
+
+class SparseQRCache
+{
+public:
+    SparseQRCache() {;}
+    SparseQRCache(const SparseQRCache&) {;}
+    SparseQRCache& operator=(const SparseQRCache&) {Reset(); return *this;}
+    ~SparseQRCache() {Reset();}
+    void Reset();
+// the solver ready for factorization of As
+    SparseQRSolver *Get(const Eigen::SparseMatrix<double> &As);
+
+protected:
+    SparseQRSolver *solver = nullptr;
+};
+
 // Base fit class
 
 class BSfit
@@ -52,7 +142,8 @@ public:
         SVD,            // more robust but slowest
         QR,             // fastest for small-size problems
         QR_Sparse,      // adequate for larger problems
-        QuadProg        // use for constrained fit
+        QuadProg,       // use for constrained fit
+        Cholesky        // banded normal equations, fastest for large 2D and 3D problems
     };
 
 public:
@@ -65,9 +156,11 @@ public:
     bool SolveSVD();
     bool SolveQR();
     bool SolveSparseQR();
-    bool SolveQuadProg(Eigen::MatrixXd &CI, Eigen::VectorXd &ci0, Eigen::MatrixXd &CE, Eigen::VectorXd &ce0);
+    bool SolveCholesky();
+    bool SolveQuadProg(const Constraints &cstr);
     void SetMethod(Method m) {method = m;}
     Method SelectMethod();
+    bool UseNormalEq() {Method m = SelectMethod(); return m == Cholesky || m == QuadProg;}
 
 //    void DumpQuadProg();
     double GetResidual() const {return residual;}    // Andr const
@@ -83,6 +176,13 @@ protected:
     Eigen::MatrixXd A;
     Eigen::VectorXd y;
     Eigen::VectorXd x;
+// the same system as normal equations, used instead of A and y if fNormalEq is set
+    NormalEq neq;
+    bool fNormalEq = false;
+// sparse A, used instead of the dense one if fSparse is set
+    Eigen::SparseMatrix<double> As;
+    SparseQRCache sqr;
+    bool fSparse = false;
 // feedback from linear solver
     bool status;
     double residual;
@@ -90,6 +190,7 @@ protected:
 // Quadratic Programming           
     Eigen:: MatrixXd G;
     Eigen::VectorXd g0;
+    SparseQP qp;    // for large problems, keeps the previous solution as the starting point
 // Error reporting       
     std::string error_msg;
 // Options
@@ -128,12 +229,25 @@ public:
 
     ProfileHist *GetHist();
 
+// Streaming (unbinned) mode: AddData() also adds each sample to normal equations, which is exact
+// and needs O(nbas) memory for any number of samples. The histogram is still filled, its empty
+// bins get the same smoothness equations as in BinnedFit()
+    void SetStreaming(bool val);
+    bool IsStreaming() const {return fStreaming;}
+    bool StreamedFit();
+// adds the data accumulated by other with the same basis and binning
+    bool MergeData(const BSfit1D &other);
+
 protected:
     void MkLinSystem(int npts, double const *datax, double const *data, double const *dataw);
+    void MkNormalEq(int npts, double const *datax, double const *data, double const *dataw);
+    void MkSparseSystem(int npts, double const *datax, double const *data, double const *dataw);
 private:
     BsplineBasis1d *bs;
     int nbins;
     ProfileHist1D *h1;
+    bool fStreaming = false;
+    NormalEq stream;
 //public:
 //    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
@@ -192,8 +306,12 @@ public:
     Bspline2d *FitAndMakeSpline(std::vector <double> &datax, std::vector <double> &datay, std::vector <double> &data);
 
     ProfileHist *GetHist();
+// adds the data accumulated by other with the same basis and binning
+    bool MergeData(const BSfit2D &other);
 protected:
    void MkLinSystem(int npts, double const *datax, double const *datay, double const *data, double const *dataw);
+    void MkNormalEq(int npts, double const *datax, double const *datay, double const *data, double const *dataw);
+    void MkSparseSystem(int npts, double const *datax, double const *datay, double const *data, double const *dataw);
 
 private:
     BsplineBasis2d *bs;
@@ -208,6 +326,7 @@ class ConstrainedFit2D : public BSfit2D
 {
 public:
     ConstrainedFit2D(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty);
+    ConstrainedFit2D(Bspline2d *bs_);
     virtual ~ConstrainedFit2D() {;}
     virtual ConstrainedFit2D* clone() const;
     bool SolveLinSystem();
@@ -238,10 +357,13 @@ public:
     ~BSfit3D();
     virtual BSfit3D* clone() const;
     void Init();
+    void AddData(double const x, double const y, double const z, double const f);
     void AddData(int npts, double const *x, double const *y, double const *z, double const *data);
     bool SetBinning(int binsx, int binsy, int binsz);
     void SetBinningAuto();
     void MkLinSystem(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw);
+    void MkNormalEq(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw);
+    void MkSparseSystem(int npts, double const *datax, double const *datay, double const *dataz, double const *data, double const *dataw);
 
     bool Fit(std::vector <double> &datax, std::vector <double> &datay, std::vector <double> &dataz, std::vector <double> &data);
     bool Fit(int npts, double const *datax, double const *datay, double const *dataz, double const *data)
@@ -254,6 +376,8 @@ public:
     Bspline3d *FitAndMakeSpline(std::vector <double> &datax, std::vector <double> &datay, std::vector <double> &dataz, std::vector <double> &data);
 
     ProfileHist *GetHist();
+// adds the data accumulated by other with the same basis and binning
+    bool MergeData(const BSfit3D &other);
 
 protected:
     int nbasx;
@@ -271,6 +395,7 @@ class ConstrainedFit3D : public BSfit3D
 {
 public:
     ConstrainedFit3D(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty, double zmin, double zmax, int n_intz);
+    ConstrainedFit3D(Bspline3d *bs_);
     virtual ~ConstrainedFit3D() {;}
     virtual ConstrainedFit3D* clone() const;
     bool SolveLinSystem();
@@ -0,0 +1,95 @@
+#ifndef BSKERNEL_H
+#define BSKERNEL_H
+
+// Compile-time kernels for uniform B-splines of degree D (2 - quadratic, 3 - cubic).
+//
+// On each interval a spline is a polynomial in the local coordinate t = 0..1, stored as
+// a patch of (D+1)^dim coefficients of the powers of t, x power fastest, then y, then z.
+// The kernels are unrolled by the compiler for every (dim, D) and are used by Bspline1d/2d/3d
+// on their polynomial patches. Patches of lower degree may be stored in a wider (cubic) layout
+// with zero higher coefficients, the stride is then given by the layout degree L.
+
+// value of basis function k (0..D) of the interval at t: sum_p ucbs[k][p]*t^p
+constexpr double bs_ucbs2[3][3] = {
+    { 1./2., -1.,     1./2.},
+    { 1./2.,  1.,    -1.   },
+    { 0.,     0.,     1./2.}
+};
+
+constexpr double bs_ucbs3[4][4] = {
+    { 1./6., -1./2.,  1./2., -1./6.},
+    { 4./6.,  0.,    -1.,     1./2.},
+    { 1./6.,  1./2.,  1./2., -1./2.},
+    { 0.,     0.,     0.,     1./6.}
+};
+
+template <int D> struct BsUcbs;
+template <> struct BsUcbs<2> { static constexpr double At(int k, int p) {return bs_ucbs2[k][p];} };
+template <> struct BsUcbs<3> { static constexpr double At(int k, int p) {return bs_ucbs3[k][p];} };
+
+// c[0] + c[1]*t + ... + c[D]*t^D, and the derivative over t
+template <int D, int P = 0> struct BsHorner
+{
+    static double Eval(const double *c, double t) {return c[P] + t*BsHorner<D, P+1>::Eval(c, t);}
+    static double Drv(const double *c, double t) {return (P+1)*c[P+1] + t*BsHorner<D, P+1>::Drv(c, t);}
+};
+
+template <int D> struct BsHorner<D, D>
+{
+    static double Eval(const double *c, double) {return c[D];}
+    static double Drv(const double *, double) {return 0.;}
+};
+
+// patch of dimension Dim at the local coordinates t[0..Dim-1]; gradient in interval units
+template <int Dim, int D, int L = D> struct BsPatch
+{
+    static constexpr int stride = (L+1)*BsPatch<Dim-1, D, L>::stride;   // coefficients per slice along the last axis
+
+    static double Eval(const double *c, const double *t)
+    {
+        double s[D+1];
+        for (int i=0; i<=D; i++)
+            s[i] = BsPatch<Dim-1, D, L>::Eval(c + i*BsPatch<Dim-1, D, L>::stride, t);
+        return BsHorner<D>::Eval(s, t[Dim-1]);
+    }
+
+// derivative along axis A only
+    template <int A> static double EvalDrv(const double *c, const double *t)
+    {
+        double s[D+1];
+        for (int i=0; i<=D; i++)
+            s[i] = A == Dim-1 ? BsPatch<Dim-1, D, L>::Eval(c + i*BsPatch<Dim-1, D, L>::stride, t)
+                              : BsPatch<Dim-1, D, L>::template EvalDrv<A>(c + i*BsPatch<Dim-1, D, L>::stride, t);
+        return A == Dim-1 ? BsHorner<D>::Drv(s, t[Dim-1]) : BsHorner<D>::Eval(s, t[Dim-1]);
+    }
+
+    static double EvalGrad(const double *c, const double *t, double *grad)
+    {
+        double s[D+1], g[Dim-1][D+1];
+        for (int i=0; i<=D; i++) {
+            double gi[Dim-1];
+            s[i] = BsPatch<Dim-1, D, L>::EvalGrad(c + i*BsPatch<Dim-1, D, L>::stride, t, gi);
+            for (int a=0; a<Dim-1; a++)
+                g[a][i] = gi[a];
+        }
+        for (int a=0; a<Dim-1; a++)
+            grad[a] = BsHorner<D>::Eval(g[a], t[Dim-1]);
+        grad[Dim-1] = BsHorner<D>::Drv(s, t[Dim-1]);
+        return BsHorner<D>::Eval(s, t[Dim-1]);
+    }
+};
+
+template <int D, int L> struct BsPatch<1, D, L>
+{
+    static constexpr int stride = L+1;
+
+    static double Eval(const double *c, const double *t) {return BsHorner<D>::Eval(c, t[0]);}
+    template <int A> static double EvalDrv(const double *c, const double *t) {return BsHorner<D>::Drv(c, t[0]);}
+    static double EvalGrad(const double *c, const double *t, double *grad)
+    {
+        grad[0] = BsHorner<D>::Drv(c, t[0]);
+        return BsHorner<D>::Eval(c, t[0]);
+    }
+};
+
+#endif // BSKERNEL_H
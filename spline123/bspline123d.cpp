@@ -4,16 +4,24 @@
 #include "json11.hpp"
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BSPLINE_X86
+#include <immintrin.h>
+#endif
+
 // ============== Base class functions ==================
-BsplineBase::BsplineBase() {
-// construct UCBS matrix
-    B <<    1, -3,  3, -1,
-            4,  0, -6,  3,
-            1,  3,  3, -3,
-            0,  0,  0,  1;
-    B /= 6.;
+template <int D> static Matrix4d MakeUcbs()
+{
+    Matrix4d m = Matrix4d::Zero();
+    for (int k=0; k<=D; k++)
+        for (int p=0; p<=D; p++)
+            m(k, p) = BsUcbs<D>::At(k, p);
+    return m;
 }
 
+const Matrix4d BsplineBase::B = MakeUcbs<3>();
+const Matrix4d BsplineBase::B2 = MakeUcbs<2>();
+
 // return 4-vector of powers of x: Vx = {1, x, x^2, x^3}
 Vector4d BsplineBase::PowerVec(double x) const
 {
@@ -40,33 +48,206 @@ Vector4d BsplineBase::PowerVecDrv2(double x) const
     return X;
 }
 
+// ============== Batch kernels ==================
+// 4 points per step; each kernel returns the number of points done, the rest is left to the scalar code
+
+static bool CpuHasAVX2()
+{
+#ifdef BSPLINE_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+static bool UseAVX2 = CpuHasAVX2();
+
+void BsplineBase::SetVectorized(bool on)
+{
+    UseAVX2 = on && CpuHasAVX2();
+}
+
+bool BsplineBase::IsVectorized()
+{
+    return UseAVX2;
+}
+
+#ifdef BSPLINE_X86
+
+// the same as BsplineBasis1d::Locate(), lane by lane; lanes outside the domain get ix = xf = 0
+__attribute__((target("avx2,fma")))
+static inline __m256d LocateAVX2(const BsplineBasis1d &bs, __m256d x, __m128i *ix, __m256d *xf)
+{
+    const __m256d vnint = _mm256_set1_pd(bs.GetNint());
+    const __m256d vdx = _mm256_set1_pd(bs.GetXmax() - bs.GetXmin());
+    __m256d xi = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(x, _mm256_set1_pd(bs.GetXmin())), vdx), vnint);
+    __m256d edge = _mm256_cmp_pd(x, _mm256_set1_pd(bs.GetXmax()), _CMP_EQ_OQ);
+    __m256d inside = _mm256_and_pd(_mm256_cmp_pd(xi, _mm256_setzero_pd(), _CMP_GE_OQ), _mm256_cmp_pd(xi, vnint, _CMP_LT_OQ));
+    __m256d valid = _mm256_or_pd(inside, edge);
+    xi = _mm256_and_pd(_mm256_blendv_pd(xi, vnint, edge), valid);
+    __m256d fix = _mm256_min_pd(_mm256_floor_pd(xi), _mm256_sub_pd(vnint, _mm256_set1_pd(1.)));
+    *xf = _mm256_sub_pd(xi, fix);
+    *ix = _mm256_cvttpd_epi32(fix);
+    return valid;
+}
+
+// c0 + c1*t + c2*t^2 + c3*t^3 and its derivative over t
+__attribute__((target("avx2,fma")))
+static inline __m256d HornerAVX2(__m256d t, __m256d c0, __m256d c1, __m256d c2, __m256d c3)
+{
+    return _mm256_fmadd_pd(t, _mm256_fmadd_pd(t, _mm256_fmadd_pd(t, c3, c2), c1), c0);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d HornerDrvAVX2(__m256d t, __m256d c1, __m256d c2, __m256d c3)
+{
+    const __m256d two = _mm256_set1_pd(2.);
+    const __m256d three = _mm256_set1_pd(3.);
+    return _mm256_fmadd_pd(t, _mm256_fmadd_pd(t, _mm256_mul_pd(three, c3), _mm256_mul_pd(two, c2)), c1);
+}
+
+// poly: 4 coefficients per interval
+__attribute__((target("avx2,fma")))
+static int Eval1dAVX2(const BsplineBasis1d &bs, const double *poly, int n, const double *x, double *f, double *drv)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d scale = _mm256_set1_pd(bs.GetScale());
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128i ix;
+        __m256d xf;
+        __m256d valid = LocateAVX2(bs, _mm256_loadu_pd(x+i), &ix, &xf);
+        __m128i off = _mm_slli_epi32(ix, 2);
+        __m256d c0 = _mm256_mask_i32gather_pd(zero, poly, off, valid, 8);
+        __m256d c1 = _mm256_mask_i32gather_pd(zero, poly+1, off, valid, 8);
+        __m256d c2 = _mm256_mask_i32gather_pd(zero, poly+2, off, valid, 8);
+        __m256d c3 = _mm256_mask_i32gather_pd(zero, poly+3, off, valid, 8);
+        _mm256_storeu_pd(f+i, HornerAVX2(xf, c0, c1, c2, c3));
+        if (drv)
+            _mm256_storeu_pd(drv+i, _mm256_mul_pd(HornerDrvAVX2(xf, c1, c2, c3), scale));
+    }
+    return i;
+}
+
+// poly: 16 coefficients per cell, cells x fastest, inside a cell the power of x is fastest
+__attribute__((target("avx2,fma")))
+static int Eval2dAVX2(const BsplineBasis1d &bsx, const BsplineBasis1d &bsy, const double *poly,
+                      int n, const double *x, const double *y, double *f, double *dx, double *dy)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d scalex = _mm256_set1_pd(bsx.GetScale());
+    const __m256d scaley = _mm256_set1_pd(bsy.GetScale());
+    const __m128i nintx = _mm_set1_epi32(bsx.GetNint());
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128i ix, iy;
+        __m256d xf, yf;
+        __m256d valid = _mm256_and_pd(LocateAVX2(bsx, _mm256_loadu_pd(x+i), &ix, &xf),
+                                      LocateAVX2(bsy, _mm256_loadu_pd(y+i), &iy, &yf));
+        __m128i off = _mm_slli_epi32(_mm_add_epi32(ix, _mm_mullo_epi32(iy, nintx)), 4);
+// Horner in x along each of the 4 rows of the patch
+        __m256d r[4], d[4];
+        for (int b=0; b<4; b++) {
+            const double *pb = poly + 4*b;
+            __m256d c0 = _mm256_mask_i32gather_pd(zero, pb, off, valid, 8);
+            __m256d c1 = _mm256_mask_i32gather_pd(zero, pb+1, off, valid, 8);
+            __m256d c2 = _mm256_mask_i32gather_pd(zero, pb+2, off, valid, 8);
+            __m256d c3 = _mm256_mask_i32gather_pd(zero, pb+3, off, valid, 8);
+            r[b] = HornerAVX2(xf, c0, c1, c2, c3);
+            if (dx)
+                d[b] = HornerDrvAVX2(xf, c1, c2, c3);
+        }
+        _mm256_storeu_pd(f+i, HornerAVX2(yf, r[0], r[1], r[2], r[3]));
+        if (dx) {
+            _mm256_storeu_pd(dx+i, _mm256_mul_pd(HornerAVX2(yf, d[0], d[1], d[2], d[3]), scalex));
+            _mm256_storeu_pd(dy+i, _mm256_mul_pd(HornerDrvAVX2(yf, r[1], r[2], r[3]), scaley));
+        }
+    }
+    return i;
+}
+
+// poly: 64 coefficients per cell, as in Bspline3d::T
+__attribute__((target("avx2,fma")))
+static int Eval3dAVX2(const BsplineBasis1d &bsx, const BsplineBasis1d &bsy, const BsplineBasis1d &bsz,
+                      const double *poly, int n, const double *x, const double *y, const double *z,
+                      double *f, double *dx, double *dy, double *dz)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d scalex = _mm256_set1_pd(bsx.GetScale());
+    const __m256d scaley = _mm256_set1_pd(bsy.GetScale());
+    const __m256d scalez = _mm256_set1_pd(bsz.GetScale());
+    const __m128i nintx = _mm_set1_epi32(bsx.GetNint());
+    const __m128i ninty = _mm_set1_epi32(bsy.GetNint());
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128i ix, iy, iz;
+        __m256d xf, yf, zf;
+        __m256d valid = _mm256_and_pd(LocateAVX2(bsx, _mm256_loadu_pd(x+i), &ix, &xf),
+                        _mm256_and_pd(LocateAVX2(bsy, _mm256_loadu_pd(y+i), &iy, &yf),
+                                      LocateAVX2(bsz, _mm256_loadu_pd(z+i), &iz, &zf)));
+        __m128i cell = _mm_add_epi32(ix, _mm_mullo_epi32(nintx, _mm_add_epi32(iy, _mm_mullo_epi32(ninty, iz))));
+        __m128i off = _mm_slli_epi32(cell, 6);
+// Horner in x along the rows, then in y within each z layer
+        __m256d sv[4], sx[4], sy[4];
+        for (int c=0; c<4; c++) {
+            __m256d r[4], d[4];
+            for (int b=0; b<4; b++) {
+                const double *pb = poly + 4*(b + 4*c);
+                __m256d c0 = _mm256_mask_i32gather_pd(zero, pb, off, valid, 8);
+                __m256d c1 = _mm256_mask_i32gather_pd(zero, pb+1, off, valid, 8);
+                __m256d c2 = _mm256_mask_i32gather_pd(zero, pb+2, off, valid, 8);
+                __m256d c3 = _mm256_mask_i32gather_pd(zero, pb+3, off, valid, 8);
+                r[b] = HornerAVX2(xf, c0, c1, c2, c3);
+                if (dx)
+                    d[b] = HornerDrvAVX2(xf, c1, c2, c3);
+            }
+            sv[c] = HornerAVX2(yf, r[0], r[1], r[2], r[3]);
+            if (dx) {
+                sx[c] = HornerAVX2(yf, d[0], d[1], d[2], d[3]);
+                sy[c] = HornerDrvAVX2(yf, r[1], r[2], r[3]);
+            }
+        }
+        _mm256_storeu_pd(f+i, HornerAVX2(zf, sv[0], sv[1], sv[2], sv[3]));
+        if (dx) {
+            _mm256_storeu_pd(dx+i, _mm256_mul_pd(HornerAVX2(zf, sx[0], sx[1], sx[2], sx[3]), scalex));
+            _mm256_storeu_pd(dy+i, _mm256_mul_pd(HornerAVX2(zf, sy[0], sy[1], sy[2], sy[3]), scaley));
+            _mm256_storeu_pd(dz+i, _mm256_mul_pd(HornerDrvAVX2(zf, sv[1], sv[2], sv[3]), scalez));
+        }
+    }
+    return i;
+}
+
+#endif // BSPLINE_X86
+
 // ============== 1D spline ==================
 
 // ------------ BsplineBasis1d ---------------
 
-BsplineBasis1d::BsplineBasis1d(double xmin, double xmax, int n_int)
+BsplineBasis1d::BsplineBasis1d(double xmin, double xmax, int n_int, int degree)
 {
-    Init(xmin, xmax, n_int);
+    Init(xmin, xmax, n_int, degree);
 }
 
 BsplineBasis1d::BsplineBasis1d(const BsplineBasis1d &obj)
 {
-    Init(obj.xl, obj.xr, obj.nint);
+    Init(obj.xl, obj.xr, obj.nint, obj.degree);
     this->fValid = obj.fValid;
     this->fReady = obj.fReady;
 }
 
-void BsplineBasis1d::Init(double xmin, double xmax, int n_int)
+void BsplineBasis1d::Init(double xmin, double xmax, int n_int, int degree)
 {
 // bail out if input is not valid, fValid stays false in this case
-    if ((xmin == xmax) || (n_int < 1))
+    if ((xmin == xmax) || (n_int < 1) || (degree != 2 && degree != 3))
         return;
 
     xl = xmin;
     xr = xmax;
     nint = n_int;
     dx = xr-xl;
-    nbas = nint + 3;
+    this->degree = degree;
+    nbas = nint + degree;
     fValid = true;
 }
 
@@ -97,10 +278,10 @@ double BsplineBasis1d::Basis(double x, int n) const
 {
     int ix;
     double xf;
-    if (!Locate(x, &ix, &xf) || n<ix || n>ix+3)
+    if (!Locate(x, &ix, &xf) || n<ix || n>ix+degree)
         return 0.;
 
-    return PowerVec(xf).dot(B.row(n-ix));
+    return PowerVec(xf).dot(Ucbs().row(n-ix));
 }
 
 std::vector <double> BsplineBasis1d::Basis (std::vector <double> &vx, int n) const
@@ -117,10 +298,10 @@ double BsplineBasis1d::BasisDrv(double x, int n) const
 {
     int ix;
     double xf;
-    if (!Locate(x, &ix, &xf) || n<ix || n>ix+3)
+    if (!Locate(x, &ix, &xf) || n<ix || n>ix+degree)
         return 0.;
 
-    return PowerVecDrv(xf).dot(B.row(n-ix));
+    return PowerVecDrv(xf).dot(Ucbs().row(n-ix));
 }
 
 std::vector <double> BsplineBasis1d::BasisDrv (std::vector <double> &vx, int n) const
@@ -137,16 +318,29 @@ double BsplineBasis1d::BasisDrv2(double x, int n) const
 {
     int ix;
     double xf;
-    if (!Locate(x, &ix, &xf) || n<ix || n>ix+3)
+    if (!Locate(x, &ix, &xf) || n<ix || n>ix+degree)
         return 0.;
 
-    return PowerVecDrv2(xf).dot(B.row(n-ix));
+    return PowerVecDrv2(xf).dot(Ucbs().row(n-ix));
+}
+
+bool BsplineBasis1d::LocalBasis(double x, int *first, double *val, int drv) const
+{
+    double xf;
+    if (!Locate(x, first, &xf))
+        return false;
+
+    Vector4d X = drv == 0 ? PowerVec(xf) : drv == 1 ? PowerVecDrv(xf) : PowerVecDrv2(xf);
+    Vector4d v = Ucbs()*X;
+    for (int k=0; k<4; k++)
+        val[k] = v(k);
+    return true;
 }
 
 // --------------- Bspline1d ----------------
 
 
-Bspline1d::Bspline1d(double xmin, double xmax, int n_int) : BsplineBasis1d(xmin, xmax, n_int)
+Bspline1d::Bspline1d(double xmin, double xmax, int n_int, int degree) : BsplineBasis1d(xmin, xmax, n_int, degree)
 {
     Init();
 }
@@ -180,19 +374,29 @@ double Bspline1d::Eval(double x) const
     if (!Locate(x, &ix, &xf))
         return 0.;
 
-    return PowerVec(xf).dot(P[ix]);
+    if (degree == 2)
+        return BsPatch<1, 2, 3>::Eval(P[ix].data(), &xf);
+    return BsPatch<1, 3>::Eval(P[ix].data(), &xf);
 }
 
-std::vector <double> Bspline1d::Eval (std::vector <double> &vx) const
+std::vector <double> Bspline1d::Eval (const std::vector <double> &vx) const
 {
-	std::vector <double> vf;
-	vf.reserve(vx.size());
-	for (double x : vx) 
-		vf.push_back(Eval(x));
-		
+	std::vector <double> vf(vx.size());
+	Eval(vx.size(), vx.data(), vf.data());
 	return vf;
 }
 
+void Bspline1d::Eval(int n, const double *x, double *f, double *drv) const
+{
+    int i = 0;
+#ifdef BSPLINE_X86
+    if (UseAVX2 && fValid)
+        i = Eval1dAVX2(*this, P[0].data(), n, x, f, drv);
+#endif
+    for (; i<n; i++)
+        f[i] = drv ? EvalWithDrv(x[i], drv+i) : Eval(x[i]);
+}
+
 double Bspline1d::Eval_compact(double x) const
 {
     int ix;
@@ -201,7 +405,11 @@ double Bspline1d::Eval_compact(double x) const
     if (!Locate(x, &ix, &xf))
         return 0.;
 
-    return C.segment(ix,4).dot(B*PowerVec(xf));
+    Vector4d u = Ucbs()*PowerVec(xf);
+    double sum = 0.;
+    for (int k=0; k<=degree; k++)
+        sum += C(ix+k)*u(k);
+    return sum;
 }
 
 double Bspline1d::EvalDrv(double x) const
@@ -213,17 +421,32 @@ double Bspline1d::EvalDrv(double x) const
     if (!Locate(x, &ix, &xf))
         return 0.;
 
-    return PowerVecDrv(xf).dot(P[ix]);
+    if (degree == 2)
+        return BsHorner<2>::Drv(P[ix].data(), xf)*GetScale();
+    return BsHorner<3>::Drv(P[ix].data(), xf)*GetScale();
 }
 
-std::vector <double> Bspline1d::EvalDrv (std::vector <double> &vx) const
+std::vector <double> Bspline1d::EvalDrv (const std::vector <double> &vx) const
 {
-	std::vector <double> vf;
-	vf.reserve(vx.size());
-	for (double x : vx) 
-		vf.push_back(EvalDrv(x));
-		
-	return vf;
+	std::vector <double> vf(vx.size()), vd(vx.size());
+	Eval(vx.size(), vx.data(), vf.data(), vd.data());
+	return vd;
+}
+
+double Bspline1d::EvalWithDrv(double x, double *drv) const
+{
+    int ix;
+    double xf;
+
+    if (!Locate(x, &ix, &xf)) {
+        *drv = 0.;
+        return 0.;
+    }
+
+    double val = degree == 2 ? BsPatch<1, 2, 3>::EvalGrad(P[ix].data(), &xf, drv)
+                             : BsPatch<1, 3>::EvalGrad(P[ix].data(), &xf, drv);
+    *drv *= GetScale();
+    return val;
 }
 
 bool Bspline1d::SetCoef(std::vector<double> &c)
@@ -234,9 +457,11 @@ bool Bspline1d::SetCoef(std::vector<double> &c)
     for (int i=0; i<nbas; i++)
         C(i) = c[i];
    
-    Matrix4d Bt = B.transpose();
+    Matrix4d Bt = Ucbs().transpose();
+    Vector4d c4 = Vector4d::Zero();
     for (int i=0; i<nint; i++) {
-        P[i] = Bt*C.segment(i,4);
+        c4.head(degree+1) = C.segment(i, degree+1);
+        P[i] = Bt*c4;
     }
     fReady = true;
     return true;
@@ -273,8 +498,9 @@ BsplineBasis1d::BsplineBasis1d(const Json &json)
     double xmin = json["xmin"].number_value();
     double xmax = json["xmax"].number_value();
     double xintervals = json["intervals"].int_value();
+    int degree = json["degree"].is_number() ? json["degree"].int_value() : 3;
 
-    Init(xmin, xmax, xintervals);
+    Init(xmin, xmax, xintervals, degree);
 }
 
 Bspline1d::Bspline1d(const Json &json) : BsplineBasis1d(json)
@@ -302,6 +528,8 @@ void Bspline1d::ToJsonObject(Json::object &json) const
     json["xmin"] = xl; // this->GetXmin();
     json["xmax"] = xr; // this->GetXmax();
     json["intervals"] = nint;
+    if (degree != 3)
+        json["degree"] = degree;
     json["data"] = GetCoef();
 }
 
@@ -332,6 +560,7 @@ BsplineBasis2d::BsplineBasis2d(double xmin, double xmax, int n_intx, double ymin
 BsplineBasis2d::BsplineBasis2d(const BsplineBasis2d &obj) 
 {
     Init(obj.GetXmin(), obj.GetXmax(), obj.nintx, obj.GetYmin(), obj.GetYmax(), obj.ninty);
+    this->fReady = obj.fReady;
 }
 
 void BsplineBasis2d::Init(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty)
@@ -451,19 +680,29 @@ double Bspline2d::Eval(double x, double y) const
     if (!bsx.Locate(x, &ix, &xf) || !bsy.Locate(y, &iy, &yf))
         return 0.;
 
-    return PowerVec(xf).transpose()*P[ix + iy*nintx]*PowerVec(yf);
+    double t[2] = {xf, yf};
+    return BsPatch<2, 3>::Eval(P[ix + iy*nintx].data(), t);
 }
 
-std::vector <double> Bspline2d::Eval (std::vector <double> &vx, std::vector <double> &vy) const
+std::vector <double> Bspline2d::Eval (const std::vector <double> &vx, const std::vector <double> &vy) const
 {
     int len = std::min(vx.size(), vy.size());
 	std::vector <double> vf(len);
-	for (int i=0; i<len; i++)
-		vf[i] = Eval(vx[i], vy[i]);
-		
+	Eval(len, vx.data(), vy.data(), vf.data());
 	return vf;
 }
 
+void Bspline2d::Eval(int n, const double *x, const double *y, double *f, double *dx, double *dy) const
+{
+    int i = 0;
+#ifdef BSPLINE_X86
+    if (UseAVX2 && fValid)
+        i = Eval2dAVX2(bsx, bsy, P[0].data(), n, x, y, f, dx, dy);
+#endif
+    for (; i<n; i++)
+        f[i] = dx ? EvalWithDrv(x[i], y[i], dx+i, dy+i) : Eval(x[i], y[i]);
+}
+
 // this eval tries to get best speed with reduced shared memory usage
 double Bspline2d::Eval_compact(double x, double y) const
 {
@@ -485,17 +724,16 @@ double Bspline2d::EvalDrvX(double x, double y) const
     if (!bsx.Locate(x, &ix, &xf) || !bsy.Locate(y, &iy, &yf))
         return 0.;
 
-    return PowerVecDrv(xf).transpose()*P[ix + iy*nintx]*PowerVec(yf);
+    double t[2] = {xf, yf};
+    return BsPatch<2, 3>::EvalDrv<0>(P[ix + iy*nintx].data(), t)*bsx.GetScale();
 }
 
-std::vector <double> Bspline2d::EvalDrvX (std::vector <double> &vx, std::vector <double> &vy) const
+std::vector <double> Bspline2d::EvalDrvX (const std::vector <double> &vx, const std::vector <double> &vy) const
 {
     int len = std::min(vx.size(), vy.size());
-	std::vector <double> vf(len);
-	for (int i=0; i<len; i++)
-		vf[i] = EvalDrvX(vx[i], vy[i]);
-		
-	return vf;
+	std::vector <double> vf(len), vdx(len), vdy(len);
+	Eval(len, vx.data(), vy.data(), vf.data(), vdx.data(), vdy.data());
+	return vdx;
 }
 
 double Bspline2d::EvalDrvY(double x, double y) const
@@ -505,17 +743,32 @@ double Bspline2d::EvalDrvY(double x, double y) const
     if (!bsx.Locate(x, &ix, &xf) || !bsy.Locate(y, &iy, &yf))
         return 0.;
 
-    return PowerVec(xf).transpose()*P[ix + iy*nintx]*PowerVecDrv(yf);
+    double t[2] = {xf, yf};
+    return BsPatch<2, 3>::EvalDrv<1>(P[ix + iy*nintx].data(), t)*bsy.GetScale();
 }
 
-std::vector <double> Bspline2d::EvalDrvY (std::vector <double> &vx, std::vector <double> &vy) const
+std::vector <double> Bspline2d::EvalDrvY (const std::vector <double> &vx, const std::vector <double> &vy) const
 {
     int len = std::min(vx.size(), vy.size());
-	std::vector <double> vf(len);
-	for (int i=0; i<len; i++)
-		vf[i] = EvalDrvY(vx[i], vy[i]);
-		
-	return vf;
+	std::vector <double> vf(len), vdx(len), vdy(len);
+	Eval(len, vx.data(), vy.data(), vf.data(), vdx.data(), vdy.data());
+	return vdy;
+}
+
+double Bspline2d::EvalWithDrv(double x, double y, double *dx, double *dy) const
+{
+    int ix, iy;
+    double xf, yf;
+    if (!bsx.Locate(x, &ix, &xf) || !bsy.Locate(y, &iy, &yf)) {
+        *dx = *dy = 0.;
+        return 0.;
+    }
+
+    double t[2] = {xf, yf}, grad[2];
+    double val = BsPatch<2, 3>::EvalGrad(P[ix + iy*nintx].data(), t, grad);
+    *dx = grad[0]*bsx.GetScale();
+    *dy = grad[1]*bsy.GetScale();
+    return val;
 }
 
 bool Bspline2d::SetCoef(std::vector <double> &c)
@@ -622,6 +875,7 @@ BsplineBasis3d::BsplineBasis3d(const BsplineBasis3d &obj)
 {
     Init(obj.GetXmin(), obj.GetXmax(), obj.nintx, obj.GetYmin(), obj.GetYmax(), obj.ninty,
          obj.GetZmin(), obj.GetZmax(), obj.nintz);
+    this->fReady = obj.fReady;
 }
 
 void BsplineBasis3d::Init(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty,
@@ -655,7 +909,7 @@ double BsplineBasis3d::BasisDrvX(double x, double y, double z, int n) const
 
 double BsplineBasis3d::BasisDrvY(double x, double y, double z, int n) const
 {
-    return bsxy.BasisDrvX(x, y, n%nbasxy)*bsz.Basis(z, n/nbasxy);
+    return bsxy.BasisDrvY(x, y, n%nbasxy)*bsz.Basis(z, n/nbasxy);
 }
 
 double BsplineBasis3d::BasisDrvZ(double x, double y, double z, int n) const
@@ -706,12 +960,46 @@ Bspline3d::Bspline3d(BsplineBasis3d &base) : BsplineBasis3d(base)
     Init();
 }
 
+Bspline3d::Bspline3d(const Bspline3d &obj) : BsplineBasis3d(obj), T(obj.T)
+{
+    for (const Bspline2d *tps : obj.Zplane)
+        Zplane.push_back(new Bspline2d(*tps));
+}
+
+Bspline3d::~Bspline3d()
+{
+    for (Bspline2d *tps : Zplane)
+        delete tps;
+}
+
 void Bspline3d::Init()
 {
     for (int i=0; i<nbasz; i++) {
         Zplane.push_back(new Bspline2d(bsxy.GetXmin(), bsxy.GetXmax(), nintx,
                                        bsxy.GetYmin(), bsxy.GetYmax(), ninty));
     }
+    T.assign(64*nintx*ninty*nintz, 0.);
+    fReady = false;
+}
+
+// polynomial patches of the 4 contributing z-planes combined with the z part of the basis,
+// so that a cell is evaluated from a single block of 64 coefficients
+void Bspline3d::MakePatches()
+{
+    for (int iz=0; iz<nintz; iz++)
+      for (int iy=0; iy<ninty; iy++)
+        for (int ix=0; ix<nintx; ix++) {
+            int ip = ix + iy*nintx;
+            double *t = &T[64*(ip + nintx*ninty*iz)];
+            for (int c=0; c<4; c++)
+              for (int b=0; b<4; b++)
+                for (int a=0; a<4; a++) {
+                    double sum = 0.;
+                    for (int i=0; i<4; i++)
+                        sum += Zplane[iz+i]->P[ip](a, b)*B(i, c);
+                    t[a + 4*(b + 4*c)] = sum;
+                }
+        }
 }
 
 double Bspline3d::Eval(double x, double y, double z) const
@@ -721,20 +1009,15 @@ double Bspline3d::Eval(double x, double y, double z) const
     if (!bsxy.Locate(x, &ix, &xf, y, &iy, &yf) || !bsz.Locate(z, &iz, &zf))
         return 0.;       
 
-    Vector4d xy;
-    for (int i=0; i<4; i++)
-        xy(i) = Zplane[iz+i]->Eval(x, y);
-
-    return xy.dot(B*PowerVec(zf));
+    double t[3] = {xf, yf, zf};
+    return BsPatch<3, 3>::Eval(Patch(ix, iy, iz), t);
 }
 
-std::vector <double> Bspline3d::Eval (std::vector <double> &vx, std::vector <double> &vy, std::vector <double> &vz) const
+std::vector <double> Bspline3d::Eval (const std::vector <double> &vx, const std::vector <double> &vy, const std::vector <double> &vz) const
 {
     int len = std::min({vx.size(), vy.size(), vz.size()});
 	std::vector <double> vf(len);
-	for (int i=0; i<len; i++)
-		vf[i] = Eval(vx[i], vy[i], vz[i]);
-		
+	Eval(len, vx.data(), vy.data(), vz.data(), vf.data());
 	return vf;
 }
 
@@ -745,11 +1028,8 @@ double Bspline3d::EvalDrvX(double x, double y, double z) const
     if (!bsxy.Locate(x, &ix, &xf, y, &iy, &yf) || !bsz.Locate(z, &iz, &zf))
         return 0.;
 
-    Vector4d xy;
-    for (int i=0; i<4; i++)
-        xy(i) = Zplane[iz+i]->EvalDrvX(x, y);
-
-    return xy.dot(B*PowerVec(zf));
+    double t[3] = {xf, yf, zf};
+    return BsPatch<3, 3>::EvalDrv<0>(Patch(ix, iy, iz), t)*bsxy.GetBSX().GetScale();
 }
 
 double Bspline3d::EvalDrvY(double x, double y, double z) const
@@ -759,11 +1039,8 @@ double Bspline3d::EvalDrvY(double x, double y, double z) const
     if (!bsxy.Locate(x, &ix, &xf, y, &iy, &yf) || !bsz.Locate(z, &iz, &zf))
         return 0.;
 
-    Vector4d xy;
-    for (int i=0; i<4; i++)
-        xy(i) = Zplane[iz+i]->EvalDrvY(x, y);
-
-    return xy.dot(B*PowerVec(zf));
+    double t[3] = {xf, yf, zf};
+    return BsPatch<3, 3>::EvalDrv<1>(Patch(ix, iy, iz), t)*bsxy.GetBSY().GetScale();
 }
 
 double Bspline3d::EvalDrvZ(double x, double y, double z) const
@@ -773,11 +1050,37 @@ double Bspline3d::EvalDrvZ(double x, double y, double z) const
     if (!bsxy.Locate(x, &ix, &xf, y, &iy, &yf) || !bsz.Locate(z, &iz, &zf))
         return 0.;
 
-    Vector4d xy;
-    for (int i=0; i<4; i++)
-        xy(i) = Zplane[iz+i]->Eval(x, y);
+    double t[3] = {xf, yf, zf};
+    return BsPatch<3, 3>::EvalDrv<2>(Patch(ix, iy, iz), t)*bsz.GetScale();
+}
+
+double Bspline3d::EvalWithDrv(double x, double y, double z, double *dx, double *dy, double *dz) const
+{
+    int ix, iy, iz;
+    double xf, yf, zf;
+    if (!bsxy.Locate(x, &ix, &xf, y, &iy, &yf) || !bsz.Locate(z, &iz, &zf)) {
+        *dx = *dy = *dz = 0.;
+        return 0.;
+    }
 
-    return xy.dot(B*PowerVecDrv(zf));
+    double t[3] = {xf, yf, zf}, grad[3];
+    double val = BsPatch<3, 3>::EvalGrad(Patch(ix, iy, iz), t, grad);
+    *dx = grad[0]*bsxy.GetBSX().GetScale();
+    *dy = grad[1]*bsxy.GetBSY().GetScale();
+    *dz = grad[2]*bsz.GetScale();
+    return val;
+}
+
+void Bspline3d::Eval(int n, const double *x, const double *y, const double *z,
+                     double *f, double *dx, double *dy, double *dz) const
+{
+    int i = 0;
+#ifdef BSPLINE_X86
+    if (UseAVX2 && fValid && !T.empty())
+        i = Eval3dAVX2(bsxy.GetBSX(), bsxy.GetBSY(), bsz, T.data(), n, x, y, z, f, dx, dy, dz);
+#endif
+    for (; i<n; i++)
+        f[i] = dx ? EvalWithDrv(x[i], y[i], z[i], dx+i, dy+i, dz+i) : Eval(x[i], y[i], z[i]);
 }
 
 bool Bspline3d::SetZplaneCoef(int iz, std::vector <double> c)
@@ -786,6 +1089,12 @@ bool Bspline3d::SetZplaneCoef(int iz, std::vector <double> c)
         return false;
 
     Zplane[iz]->SetCoef(c);
+// ready when all the planes are
+    fReady = true;
+    for (const Bspline2d *tps : Zplane)
+        fReady = fReady && tps->IsReady();
+    if (fReady)
+        MakePatches();
     return true;
 }
 
@@ -793,10 +1102,18 @@ bool Bspline3d::SetZplane(int iz, Bspline2d *tps)
 {
     if (iz<0 || iz>=Zplane.size())
         return false;
+// the plane must have the same (x, y) intervals to share the cell layout
+    if (tps->GetNintX() != nintx || tps->GetNintY() != ninty)
+        return false;
 
     if (Zplane[iz])
         delete Zplane[iz];
     Zplane[iz]=tps;
+    fReady = true;
+    for (const Bspline2d *plane : Zplane)
+        fReady = fReady && plane->IsReady();
+    if (fReady)
+        MakePatches();
     return true;
 }
 
@@ -845,6 +1162,7 @@ Bspline3d::Bspline3d(const Json &json) : BsplineBasis3d(json)
 
         Zplane[i]->SetCoef(c);
     }
+    MakePatches();
     fReady = true;
 }
 
@@ -6,6 +6,7 @@
 #include <Eigen/Dense>
 // the following is needed to ensure proper alignment of std::vector <Vector4d>
 #include <Eigen/StdVector>
+#include "bskernel.h"
 
 // to remove serialization routines and dependence on json11 library
 // comment the following line
@@ -28,7 +29,7 @@ typedef std::map<std::string, Json> Json_object;
 class BsplineBase
 {
     public:
-        BsplineBase();
+        BsplineBase() {}
         virtual ~BsplineBase(){}    // Andr +
 
         Vector4d PowerVec(double x) const;  // Andr ! maybe put Get.. in front of all getters?
@@ -36,8 +37,15 @@ class BsplineBase
         Vector4d PowerVecDrv2(double x) const;
         bool IsReady() const {return fReady;}
         bool isInvalid() const { return !fValid; }
+// batch evaluation runs 4 points at a time with AVX2 when the CPU supports it,
+// switching it off selects the scalar loop (same results up to rounding)
+        static void SetVectorized(bool on);
+        static bool IsVectorized();
     protected:
-        Matrix4d B; // matrix of UCBS coefficients
+// matrices of UCBS coefficients (bs_ucbs3 and bs_ucbs2 of bskernel.h), shared by all splines;
+// the quadratic one is padded with zeros to the cubic size
+        static const Matrix4d B;
+        static const Matrix4d B2;
 // flags
         bool fValid = false; // true if spline is initialized
         // "ready" means that the object contains a spline loaded through SetCoef() routine
@@ -56,31 +64,41 @@ class BsplineBasis1d : public BsplineBase
 {
 public:
     BsplineBasis1d() {;}
-    BsplineBasis1d(double xmin, double xmax, int n_int);
+// degree: 3 (cubic) or 2 (quadratic), the latter is available in 1D only
+    BsplineBasis1d(double xmin, double xmax, int n_int, int degree = 3);
     BsplineBasis1d(const BsplineBasis1d &obj);
-    void Init(double xmin, double xmax, int n_int);
+    void Init(double xmin, double xmax, int n_int, int degree = 3);
     void SetRange(double xmin, double xmax) {xl = xmin; xr = xmax; dx = xr-xl;}
     void GetRange(double *xmin, double *xmax) const {*xmin = xl;	*xmax = xr;}
     double GetXmin() const {return xl;}
     double GetXmax() const {return xr;}
     int GetNint() const {return nint;}
     int GetNbas() const {return nbas;}
+    int GetDegree() const {return degree;}
+    double GetScale() const {return nint/dx;} // d(xf)/dx, converts derivatives from interval to x units
     double Basis(double x, int n) const;
     std::vector <double> Basis (std::vector <double> &vx, int n) const;
     double BasisDrv(double x, int n) const;
     std::vector <double> BasisDrv (std::vector <double> &vx, int n) const;
     double BasisDrv2(double x, int n) const;
     bool Locate(double x, int *ix, double *xf) const;
+// values (drv = 0) or derivatives (drv = 1, 2, interval units as in BasisDrv) of the degree+1 basis functions
+// nonzero at x, the first of them is *first; returns false if x is outside the domain.
+// val has room for 4 values, for a quadratic spline val[3] is 0
+    bool LocalBasis(double x, int *first, double *val, int drv = 0) const;
 #ifdef BSIO
     BsplineBasis1d(const Json &json);
 #endif
 
 protected:
+    const Matrix4d &Ucbs() const {return degree == 2 ? B2 : B;}
+
     double xl;
     double xr;
     double dx;
     int nint = 0;	// number of intervals
     int nbas = 0;	// number of basis splines
+    int degree = 3;
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
@@ -89,12 +107,15 @@ public:
 class Bspline1d : public BsplineBasis1d
 {
     public:
-        Bspline1d(double xmin, double xmax, int n_int);
+        Bspline1d(double xmin, double xmax, int n_int, int degree = 3);
         Bspline1d(BsplineBasis1d &base);
         double Eval(double x) const;
-        std::vector <double> Eval (std::vector <double> &vx) const;        
+        std::vector <double> Eval (const std::vector <double> &vx) const;
         double EvalDrv(double x) const;
-        std::vector <double> EvalDrv (std::vector <double> &vx) const;
+        std::vector <double> EvalDrv (const std::vector <double> &vx) const;
+        double EvalWithDrv(double x, double *drv) const; // value and derivative with one Locate
+// batch: values of n points written to f, and derivatives to drv unless it is nullptr
+        void Eval(int n, const double *x, double *f, double *drv = nullptr) const;
         bool SetCoef(std::vector<double> &c);
         std::vector<double> GetCoef() const;
         double GetCoef(int i) const {return i>=0 && i<C.size() ? C(i) : 0.;}
@@ -117,7 +138,7 @@ class Bspline1d : public BsplineBasis1d
 
     private:
         VectorXd C; // spline coefficients
-        std::vector <Vector4d, Eigen::aligned_allocator<Vector4d> > P; // vector of vectors with polynomial coefficients
+        std::vector <Vector4d, Eigen::aligned_allocator<Vector4d> > P; // vector of vectors with polynomial coefficients (cubic layout for any degree)
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
@@ -176,15 +197,19 @@ class BsplineBasis2d : public BsplineBase
 
 class Bspline2d : public BsplineBasis2d
 {
+friend class Bspline3d;     // evaluates the patches of its z-planes directly
     public:
         Bspline2d(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty);
         Bspline2d(BsplineBasis2d &base);
         double Eval(double x, double y) const;
-        std::vector <double> Eval (std::vector <double> &vx, std::vector <double> &vy) const;
+        std::vector <double> Eval (const std::vector <double> &vx, const std::vector <double> &vy) const;
         double EvalDrvX(double x, double y) const;
-        std::vector <double> EvalDrvX (std::vector <double> &vx, std::vector <double> &vy) const;
+        std::vector <double> EvalDrvX (const std::vector <double> &vx, const std::vector <double> &vy) const;
         double EvalDrvY(double x, double y) const;
-        std::vector <double> EvalDrvY (std::vector <double> &vx, std::vector <double> &vy) const;
+        std::vector <double> EvalDrvY (const std::vector <double> &vx, const std::vector <double> &vy) const;
+        double EvalWithDrv(double x, double y, double *dx, double *dy) const; // value and gradient with one Locate
+// batch: values of n points written to f, and the gradient to (dx, dy) unless dx is nullptr
+        void Eval(int n, const double *x, const double *y, double *f, double *dx = nullptr, double *dy = nullptr) const;
         double GetCoef(int i) const {return i>=0 && i<nbas ? C(i%nbasx, i/nbasx) : 0.;}
         std::vector <double> GetCoef() const;
         bool SetCoef(std::vector <double> &c);
@@ -273,13 +298,19 @@ class Bspline3d : public BsplineBasis3d
         Bspline3d(double xmin, double xmax, int n_intx, double ymin, double ymax, int n_inty,
                    double zmin, double zmax, int n_intz);
         Bspline3d(BsplineBasis3d &base);
+        Bspline3d(const Bspline3d &obj);
+        ~Bspline3d();
         void Init();
         double Eval(double x, double y, double z) const;
-        std::vector <double> Eval (std::vector <double> &vx, std::vector <double> &vy, std::vector <double> &vz) const;
+        std::vector <double> Eval (const std::vector <double> &vx, const std::vector <double> &vy, const std::vector <double> &vz) const;
         double Eval_greedy(double x, double y, double z) const;
         double EvalDrvX(double x, double y, double z) const;
         double EvalDrvY(double x, double y, double z) const;
         double EvalDrvZ(double x, double y, double z) const;
+        double EvalWithDrv(double x, double y, double z, double *dx, double *dy, double *dz) const; // value and gradient with one Locate
+// batch: values of n points written to f, and the gradient to (dx, dy, dz) unless dx is nullptr
+        void Eval(int n, const double *x, const double *y, const double *z,
+                  double *f, double *dx = nullptr, double *dy = nullptr, double *dz = nullptr) const;
         bool SetZplaneCoef(int iz, std::vector <double> c);
         bool SetZplane(int iz, Bspline2d *tps);
         const Bspline2d *GetZplane(int iz) const {return Zplane[iz];}
@@ -291,8 +322,15 @@ class Bspline3d : public BsplineBasis3d
         std::string GetJsonString() const;
 #endif
 
+	private:
+        void MakePatches();
+        const double *Patch(int ix, int iy, int iz) const {return &T[64*(ix + nintx*(iy + ninty*iz))];}
+
 	private:
         std::vector <Bspline2d*> Zplane; // using 2D splines to do part of the housekeeping
+// polynomial coefficients of all the cells in one contiguous block: 64 per cell, cells ordered
+// x fastest, then y, then z; inside a cell T[a + 4*(b + 4*c)] multiplies xf^a*yf^b*zf^c
+        std::vector <double> T;
 
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
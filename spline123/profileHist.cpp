@@ -33,7 +33,7 @@ bool ProfileHist::Fill(double x, double y, double z, double t)
 {
     int ix = LocateX(x);
     int iy = LocateY(y);
-    int iz = LocateY(z);
+    int iz = LocateZ(z);
     if (ix>=0 && ix<xdim && iy>=0 && iy<ydim && iz>=0 && iz<zdim)
         data[ix+(iy+iz*ydim)*xdim].Add(t);
     return true;
@@ -41,10 +41,22 @@ bool ProfileHist::Fill(double x, double y, double z, double t)
 
 void ProfileHist::Clear()
 {
-    for (PHCell cell : data)
+    for (PHCell &cell : data)
         cell.Clear();
 }
 
+bool ProfileHist::Merge(const ProfileHist &other)
+{
+    if (other.ndim != ndim || other.xdim != xdim || other.ydim != ydim || other.zdim != zdim)
+        return false;
+    for (int i=0; i<data.size(); i++) {
+        data[i].sum += other.data[i].sum;
+        data[i].sum2 += other.data[i].sum2;
+        data[i].cnt += other.data[i].cnt;
+    }
+    return true;
+}
+
 ProfileHist::ProfileHist(int x_dim, double x_min, double x_max) : xdim(x_dim), xmin(x_min), xmax(x_max)
 {
     data.resize(xdim);
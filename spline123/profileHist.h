@@ -49,6 +49,8 @@ public:
     int LocateZ(double z) const {return ndim>=3 ? (int)((z-zmin)/dz*zdim) : 0;}
 
     void Clear();
+// adds contents of a histogram with the same binning, returns false if the binning differs
+    bool Merge(const ProfileHist &other);
     bool Fill(double x, double t);
     bool Fill(double x, double y, double t);
     bool Fill(double x, double y, double z, double t);  
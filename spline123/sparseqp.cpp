@@ -0,0 +1,270 @@
+#include "sparseqp.h"
+
+#include <cmath>
+#include <algorithm>
+
+using Eigen::VectorXd;
+
+// ================ Band matrix =================
+
+void BandMatrix::Init(int n, int kd)
+{
+    this->n = n;
+    this->kd = std::min(kd, std::max(n-1, 0));
+    ld = this->kd + 1;
+    U.assign((size_t)n*ld, 0.);
+}
+
+void BandMatrix::Multiply(const VectorXd &x, VectorXd &y) const
+{
+    y = VectorXd::Zero(n);
+    for (int i=0; i<n; i++) {
+        const double *Ui = &U[(size_t)i*ld];
+        int m = std::min(kd, n-1-i);
+        double sum = Ui[0]*x(i);
+        for (int k=1; k<=m; k++) {
+            sum += Ui[k]*x(i+k);
+            y(i+k) += Ui[k]*x(i);
+        }
+        y(i) += sum;
+    }
+}
+
+bool BandMatrix::Factorize()
+{
+    for (int i=0; i<n; i++) {
+        double *Ui = &U[(size_t)i*ld];
+        int m = std::min(kd, n-1-i);
+        if (!(Ui[0] > 0.))
+            return false;
+        double d = sqrt(Ui[0]);
+        Ui[0] = d;
+        for (int k=1; k<=m; k++)
+            Ui[k] /= d;
+// rank-1 update of the rows below, the band is contiguous in each of them
+        for (int k=1; k<=m; k++) {
+            double a = Ui[k];
+            if (a == 0.)
+                continue;
+            double *Uk = &U[(size_t)(i+k)*ld];
+            for (int l=0; l<=m-k; l++)
+                Uk[l] -= a*Ui[k+l];
+        }
+    }
+    return true;
+}
+
+void BandMatrix::Solve(VectorXd &b) const
+{
+// R'z = b, then R x = z
+    for (int i=0; i<n; i++) {
+        const double *Ui = &U[(size_t)i*ld];
+        int m = std::min(kd, n-1-i);
+        b(i) /= Ui[0];
+        for (int k=1; k<=m; k++)
+            b(i+k) -= Ui[k]*b(i);
+    }
+    for (int i=n-1; i>=0; i--) {
+        const double *Ui = &U[(size_t)i*ld];
+        int m = std::min(kd, n-1-i);
+        double sum = b(i);
+        for (int k=1; k<=m; k++)
+            sum -= Ui[k]*b(i+k);
+        b(i) = sum/Ui[0];
+    }
+}
+
+// ================ ADMM QP solver =================
+
+// K = P*scale + reg*I + C'*diag(w)*C
+bool SparseQP::factorize(const BandMatrix &P, const Constraints &C, const VectorXd &w, double reg, BandMatrix &K) const
+{
+    int n = P.GetSize();
+    K.Init(n, P.GetBand());
+    for (int i=0; i<n; i++) {
+        for (int j=i; j<=std::min(i+P.GetBand(), n-1); j++)
+            K.At(i, j) = P.At(i, j)*scale;
+        K.At(i, i) += reg;
+    }
+
+    for (int r=0; r<C.rows(); r++) {
+        if (w(r) == 0.)
+            continue;
+        for (Constraints::InnerIterator a(C, r); a; ++a)
+            for (Constraints::InnerIterator b(C, r); b; ++b) {
+                if (b.col() < a.col())
+                    continue;
+                if (!K.Contains(a.col(), b.col()))
+                    return false;
+                K.At(a.col(), b.col()) += w(r)*a.value()*b.value();
+            }
+    }
+
+    return K.Factorize();
+}
+
+// Solution polishing as in OSQP: the constraints found active by ADMM are imposed as equalities
+// and the reduced problem is solved by the method of multipliers, starting from the ADMM duals.
+// Poorly determined coefficients may still be off the right active set, so it is corrected
+// as in the primal-dual active set method: violated constraints are added, those with
+// multipliers of the wrong sign are released, and the reduced problem is solved again.
+// x0 is replaced only if the active set settles, otherwise the ADMM solution is kept.
+bool SparseQP::polish(const BandMatrix &P, const VectorXd &qs, const Constraints &C,
+                      const VectorXd &l, const VectorXd &u)
+{
+    int n = P.GetSize();
+    int m = C.rows();
+    const double delta = 1e6;
+
+// b is the bound of the active constraints, w is the penalty (zero for the inactive ones)
+    VectorXd b = VectorXd::Zero(m), w = VectorXd::Zero(m), lambda = VectorXd::Zero(m);
+    for (int r=0; r<m; r++) {
+        if (l(r) == u(r) || z(r) - l(r) < -y(r))
+            b(r) = l(r);
+        else if (u(r) - z(r) < y(r))
+            b(r) = u(r);
+        else
+            continue;
+        w(r) = delta;
+        lambda(r) = y(r);
+    }
+
+    VectorXd xp = x0, rhs(n), Cx(m);
+    for (int round=0; round<20; round++) {
+// no regularization unless P is singular on the subspace of the active constraints
+        BandMatrix K;
+        double reg = 0.;
+        if (!factorize(P, C, w, reg, K)) {
+            reg = sigma;
+            if (!factorize(P, C, w, reg, K))
+                return false;
+        }
+
+        for (int k=0; k<10; k++) {
+            rhs = reg*xp - qs - C.transpose()*(lambda - w.cwiseProduct(b));
+            K.Solve(rhs);
+            xp = rhs;
+            Cx = C*xp;
+            double viol = 0.;
+            for (int r=0; r<m; r++)
+                if (w(r) != 0.) {
+                    lambda(r) += w(r)*(Cx(r) - b(r));
+                    viol = std::max(viol, fabs(Cx(r) - b(r)));
+                }
+            if (viol <= eps_abs*1e-3)
+                break;
+        }
+
+        double tol = eps_abs + eps_rel*Cx.lpNorm<Eigen::Infinity>();
+        bool changed = false;
+        for (int r=0; r<m; r++) {
+            if (l(r) == u(r))
+                continue;
+            if (w(r) == 0.) {
+                if (Cx(r) < l(r) - tol)
+                    b(r) = l(r);
+                else if (Cx(r) > u(r) + tol)
+                    b(r) = u(r);
+                else
+                    continue;
+                w(r) = delta;
+                lambda(r) = 0.;
+                changed = true;
+            } else if (b(r) == l(r) ? lambda(r) > tol : lambda(r) < -tol) {
+                w(r) = 0.;
+                lambda(r) = 0.;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            x0 = xp;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SparseQP::Solve(const BandMatrix &P, const VectorXd &q, const Constraints &C,
+                     const VectorXd &l, const VectorXd &u, VectorXd &x)
+{
+    int n = P.GetSize();
+    int m = C.rows();
+
+// the objective is scaled to the unit largest diagonal element of P,
+// then the default rho and sigma suit any normalization of the data
+    double dmax = 0.;
+    for (int i=0; i<n; i++)
+        dmax = std::max(dmax, P.At(i, i));
+    if (!(dmax > 0.))
+        return false;
+    scale = 1./dmax;
+    VectorXd qs = q*scale;
+
+    if (!warm || x0.size() != n || z.size() != m) {
+        x0 = VectorXd::Zero(n);
+        z = VectorXd::Zero(m);
+        y = VectorXd::Zero(m);
+        rho = 0.1;
+    }
+
+// equality constraints get much larger rho
+    rho_vec.resize(m);
+    for (int r=0; r<m; r++)
+        rho_vec(r) = l(r) == u(r) ? rho*1e3 : rho;
+    if (!factorize(P, C, rho_vec, sigma, M)) {
+        warm = false;
+        return false;
+    }
+
+    VectorXd xt(n), zt(m), zr(m), zn(m), Px(n), Cx(m), Cty(n);
+    bool converged = false;
+    for (iter=1; iter<=max_iter; iter++) {
+        xt = sigma*x0 - qs + C.transpose()*(rho_vec.cwiseProduct(z) - y);
+        M.Solve(xt);
+        zt = C*xt;
+        x0 = alpha*xt + (1.-alpha)*x0;
+        zr = alpha*zt + (1.-alpha)*z;
+        zn = (zr + y.cwiseQuotient(rho_vec)).cwiseMax(l).cwiseMin(u);
+        y += rho_vec.cwiseProduct(zr - zn);
+        z = zn;
+
+        if (iter%10 != 0)
+            continue;
+
+// primal and dual residuals
+        Cx = C*x0;
+        P.Multiply(x0, Px);
+        Px *= scale;
+        Cty = C.transpose()*y;
+        double rp = m ? (Cx - z).lpNorm<Eigen::Infinity>() : 0.;
+        double rd = (Px + qs + Cty).lpNorm<Eigen::Infinity>();
+        double np = m ? std::max(Cx.lpNorm<Eigen::Infinity>(), z.lpNorm<Eigen::Infinity>()) : 0.;
+        double nd = std::max({Px.lpNorm<Eigen::Infinity>(), Cty.lpNorm<Eigen::Infinity>(), qs.lpNorm<Eigen::Infinity>()});
+        if (rp <= eps_abs + eps_rel*np && rd <= eps_abs + eps_rel*nd) {
+            converged = true;
+            break;
+        }
+
+// rho follows the ratio of the relative residuals, refactorization is cheap for the band
+        if (iter%50 == 0 && m > 0) {
+            double ratio = sqrt((rp/(np + 1e-30)) / (rd/(nd + 1e-30) + 1e-30));
+            if (ratio > 5. || ratio < 0.2) {
+                rho = std::min(std::max(rho*ratio, 1e-6), 1e6);
+                for (int r=0; r<m; r++)
+                    rho_vec(r) = l(r) == u(r) ? rho*1e3 : rho;
+                if (!factorize(P, C, rho_vec, sigma, M)) {
+                    warm = false;
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (converged && m > 0)
+        polish(P, qs, C, l, u);
+
+    x = x0;
+    warm = converged;
+    return converged;
+}
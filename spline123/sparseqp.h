@@ -0,0 +1,80 @@
+#ifndef SPARSEQP_H
+#define SPARSEQP_H
+
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// Symmetric band matrix: only the upper band is stored, row by row, U[i*(kd+1) + j-i] = M(i, j)
+// for i <= j <= i+kd. Factorize() replaces it with the Cholesky factor R (M = R'R) in place.
+
+class BandMatrix
+{
+public:
+    void Init(int n, int kd);   // zero matrix
+    int GetSize() const {return n;}
+    int GetBand() const {return kd;}
+    bool Contains(int i, int j) const {return (i > j ? i-j : j-i) <= kd;}
+// element (i, j) of the upper band, i <= j
+    double &At(int i, int j) {return U[(size_t)i*ld + j-i];}
+    double At(int i, int j) const {return U[(size_t)i*ld + j-i];}
+
+    void Multiply(const Eigen::VectorXd &x, Eigen::VectorXd &y) const;   // y = M x, not factorized
+    bool Factorize();
+    void Solve(Eigen::VectorXd &b) const;   // b = M^-1 b, factorized
+
+protected:
+    int n = 0;
+    int kd = 0;
+    int ld = 1;
+    std::vector <double> U;
+};
+
+// Convex quadratic programming problem
+//    minimize 1/2 x'Px + q'x  subject to  l <= Cx <= u
+// with band P and sparse C, solved by ADMM as in OSQP (Stellato et al., 2020).
+// Equality constraints have l = u. The linear system P + sigma*I + C'*rho*C has the band of P
+// as long as every constraint involves only basis functions within the band, so it is
+// factorized by band Cholesky, once per change of rho.
+// The solution and the duals are kept and used as the starting point of the next Solve()
+// with the same constraints, which makes refits with slightly different data fast.
+
+class SparseQP
+{
+public:
+    typedef Eigen::SparseMatrix <double, Eigen::RowMajor> Constraints;
+
+    bool Solve(const BandMatrix &P, const Eigen::VectorXd &q, const Constraints &C,
+               const Eigen::VectorXd &l, const Eigen::VectorXd &u, Eigen::VectorXd &x);
+    void Reset() {warm = false;}
+    int GetIterations() const {return iter;}
+    void SetTolerance(double abs, double rel) {eps_abs = abs; eps_rel = rel;}
+    void SetMaxIterations(int val) {max_iter = val;}
+
+protected:
+    bool factorize(const BandMatrix &P, const Constraints &C, const Eigen::VectorXd &w, double reg,
+                   BandMatrix &K) const;
+    bool polish(const BandMatrix &P, const Eigen::VectorXd &qs, const Constraints &C,
+                const Eigen::VectorXd &l, const Eigen::VectorXd &u);
+
+protected:
+// settings
+    double eps_abs = 1e-7;
+    double eps_rel = 1e-7;
+    int max_iter = 20000;
+    double sigma = 1e-6;
+    double alpha = 1.6;
+// state, kept for the warm start
+    bool warm = false;
+    double rho = 0.1;
+    Eigen::VectorXd x0;
+    Eigen::VectorXd z;
+    Eigen::VectorXd y;
+    int iter = 0;
+// work
+    double scale = 1.;      // of the objective
+    BandMatrix M;
+    Eigen::VectorXd rho_vec;
+};
+
+#endif // SPARSEQP_H